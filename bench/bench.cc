@@ -0,0 +1,136 @@
+#include "common.hh"
+
+#include "args.hh"
+#include "bench.hh"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+constexpr int kDefaultMinTimeMs = 200;
+
+struct Result {
+  std::string name;
+  uint64_t iterations;
+  double ns_per_iteration;
+  double bytes_per_second;
+};
+
+class BenchImpl : public Bench {
+public:
+  BenchImpl(std::string program, std::string json, std::string filter,
+            std::chrono::milliseconds min_time)
+    : program_(std::move(program)), json_(std::move(json)),
+      filter_(std::move(filter)), min_time_(min_time) {}
+
+  void run(std::string name,
+           std::function<void(uint64_t iterations)> const& fn,
+           uint64_t bytes) override {
+    if (!filter_.empty() && name.find(filter_) == std::string::npos)
+      return;
+
+    uint64_t iterations = 1;
+    std::chrono::steady_clock::duration elapsed;
+    while (true) {
+      auto start = std::chrono::steady_clock::now();
+      fn(iterations);
+      elapsed = std::chrono::steady_clock::now() - start;
+      if (elapsed >= min_time_ || iterations >= (1ull << 40))
+        break;
+      iterations *= 2;
+    }
+
+    std::chrono::duration<double, std::nano> ns = elapsed;
+    Result result;
+    result.name = std::move(name);
+    result.iterations = iterations;
+    result.ns_per_iteration = ns.count() / iterations;
+    result.bytes_per_second = bytes == 0 ? 0.0
+      : bytes * iterations / (ns.count() / 1e9);
+    std::cerr << result.name << ": " << result.ns_per_iteration << " ns";
+    if (bytes)
+      std::cerr << ", " << result.bytes_per_second / 1e6 << " MB/s";
+    std::cerr << std::endl;
+    results_.push_back(std::move(result));
+  }
+
+  int finish() override {
+    if (json_.empty()) {
+      write(std::cout);
+      return EXIT_SUCCESS;
+    }
+    std::ofstream out(json_);
+    write(out);
+    out.close();
+    if (!out) {
+      std::cerr << json_ << ": Unable to write results" << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+private:
+  void write(std::ostream& out) const {
+    // Names are chosen by the benchmarks, no escaping needed.
+    out << "{\n  \"program\": \"" << program_ << "\",\n"
+        << "  \"benchmarks\": [";
+    bool first = true;
+    for (auto const& result : results_) {
+      out << (first ? "\n" : ",\n");
+      first = false;
+      out << "    {\"name\": \"" << result.name << "\", "
+          << "\"iterations\": " << result.iterations << ", "
+          << "\"ns_per_iteration\": " << result.ns_per_iteration << ", "
+          << "\"bytes_per_second\": " << result.bytes_per_second << "}";
+    }
+    out << "\n  ]\n}" << std::endl;
+  }
+
+  std::string const program_;
+  std::string const json_;
+  std::string const filter_;
+  std::chrono::milliseconds const min_time_;
+  std::vector<Result> results_;
+};
+
+}  // namespace
+
+std::unique_ptr<Bench> Bench::create(int argc, char** argv,
+                                     std::string program) {
+  auto args = Args::create();
+  auto* help = args->add_option('h', "help", "display this text and exit.");
+  auto* json = args->add_option_with_arg(
+      'j', "json", "write results to FILE instead of stdout.", "FILE");
+  auto* filter = args->add_option_with_arg(
+      'f', "filter", "only run benchmarks with names containing STR.", "STR");
+  auto* min_time = args->add_option_with_arg(
+      't', "min-time", "run each benchmark for at least MS milliseconds,"
+      " default 200.", "MS");
+  std::vector<std::string> arguments;
+  if (!args->run(argc, argv, program, std::cerr, &arguments))
+    return nullptr;
+  if (help->is_set()) {
+    std::cout << "Usage: `" << program << " [OPTIONS]`\n\n";
+    args->print_descriptions(std::cout, 80);
+    exit(EXIT_SUCCESS);
+  }
+  if (!arguments.empty()) {
+    std::cerr << "Unexpected arguments after options." << std::endl;
+    return nullptr;
+  }
+  int ms = kDefaultMinTimeMs;
+  if (min_time->is_set()) {
+    ms = atoi(min_time->arg().c_str());
+    if (ms <= 0) {
+      std::cerr << "Invalid argument to --min-time." << std::endl;
+      return nullptr;
+    }
+  }
+  return std::make_unique<BenchImpl>(
+      std::move(program), json->is_set() ? json->arg() : std::string(),
+      filter->is_set() ? filter->arg() : std::string(),
+      std::chrono::milliseconds(ms));
+}
@@ -0,0 +1,41 @@
+#ifndef BENCH_HH
+#define BENCH_HH
+
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+// Minimal benchmark harness. Each benchmark is run with a doubling number of
+// iterations until one run takes at least the minimum time, the last run is
+// reported. Results are written as JSON, see bench/compare.py.
+class Bench {
+public:
+  virtual ~Bench() = default;
+
+  // Parses the command line, returns nullptr if it's invalid.
+  static std::unique_ptr<Bench> create(int argc, char** argv,
+                                       std::string program);
+
+  // fn must run the benchmarked code iterations times. bytes is the number
+  // of bytes processed per iteration, used to report throughput.
+  virtual void run(std::string name,
+                   std::function<void(uint64_t iterations)> const& fn,
+                   uint64_t bytes = 0) = 0;
+
+  // Writes the results, returns the exit code for main.
+  virtual int finish() = 0;
+
+protected:
+  Bench() = default;
+  Bench(Bench const&) = delete;
+  Bench& operator=(Bench const&) = delete;
+};
+
+// Keeps the compiler from optimizing away the computation of value.
+template<typename T>
+inline void do_not_optimize(T const& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif  // BENCH_HH
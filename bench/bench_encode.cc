@@ -0,0 +1,41 @@
+#include "common.hh"
+
+#include "bench.hh"
+#include "qr_capacity.hh"
+#include "qr_encode.hh"
+
+#include <cstdio>
+#include <iostream>
+
+int main(int argc, char** argv) {
+  auto bench = Bench::create(argc, argv, "bench_encode");
+  if (!bench)
+    return EXIT_FAILURE;
+
+  for (int version = kQRMinVersion; version <= kQRMaxVersion; ++version) {
+    // Fill the version exactly, with printable non-alphanumeric content so
+    // libqrencode picks 8-bit mode just like for a typical URL.
+    std::string str(qr_capacity_8bit(version), 'a');
+    for (size_t i = 0; i < str.size(); ++i)
+      str[i] = "abcdefghijklmnopqrstuvwxyz/.:?&="[i % 32];
+    {
+      auto code = qr_encode(str);
+      if (!code || code->version != version) {
+        std::cerr << "Unexpected version for " << str.size() << " bytes: "
+                  << (code ? code->version : 0) << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "qr_encode/v%02d", version);
+    bench->run(name, [&str] (uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+          auto code = qr_encode(str);
+          do_not_optimize(code.get());
+        }
+      }, str.size());
+  }
+
+  return bench->finish();
+}
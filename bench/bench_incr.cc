@@ -0,0 +1,55 @@
+#include "common.hh"
+
+#include "bench.hh"
+#include "selection.hh"
+
+#include <cstdio>
+#include <iostream>
+
+namespace {
+
+constexpr size_t kSizes[] = { 64 * 1024, 1024 * 1024 };
+constexpr size_t kChunkSizes[] = { 256, 4096, 65536 };
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto bench = Bench::create(argc, argv, "bench_incr");
+  if (!bench)
+    return EXIT_FAILURE;
+
+  // Arbitrary, the property is never used to talk to a server.
+  xcb_atom_t const property = 1;
+
+  for (size_t size : kSizes) {
+    std::string content(size, 'x');
+    for (size_t i = 0; i < size; ++i)
+      content[i] = static_cast<char>('a' + i % 26);
+
+    for (size_t chunk_size : kChunkSizes) {
+      IncrReader reader(size);
+      std::string data;
+      data.reserve(size);
+
+      char name[48];
+      snprintf(name, sizeof(name), "incr/%zuk/%zu", size / 1024, chunk_size);
+      bench->run(name, [&] (uint64_t iterations) {
+          for (uint64_t i = 0; i < iterations; ++i) {
+            // Vary the last byte so finish() sees new content every time.
+            content.back() = static_cast<char>('a' + i % 26);
+            reader.start(property, 0);
+            std::string_view remaining(content);
+            while (!remaining.empty()) {
+              auto chunk = remaining.substr(0, chunk_size);
+              reader.append(chunk);
+              remaining.remove_prefix(chunk.size());
+            }
+            bool changed = reader.finish(data);
+            do_not_optimize(changed);
+          }
+        }, size);
+    }
+  }
+
+  return bench->finish();
+}
@@ -0,0 +1,57 @@
+#include "common.hh"
+
+#include "bench.hh"
+#include "qr_capacity.hh"
+#include "qr_encode.hh"
+#include "render.hh"
+
+#include <cstdio>
+#include <iostream>
+
+namespace {
+
+constexpr int kVersions[] = { 1, 5, 10, 20, 30, 40 };
+constexpr uint16_t kWindowSize = 800;
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto bench = Bench::create(argc, argv, "bench_render");
+  if (!bench)
+    return EXIT_FAILURE;
+
+  SurfacePool pool;
+  auto canvas = make_memory_canvas(kWindowSize, kWindowSize);
+  xcb_rectangle_t const area{0, 0, kWindowSize, kWindowSize};
+
+  for (int version : kVersions) {
+    std::string str(qr_capacity_8bit(version), 'x');
+    auto code = qr_encode(str);
+    if (!code) {
+      std::cerr << "Unable to encode version " << version << std::endl;
+      return EXIT_FAILURE;
+    }
+    int const width = code->width;
+    uint8_t const* const modules = code->data;
+
+    char name[32];
+    snprintf(name, sizeof(name), "rasterize/v%02d", version);
+    bench->run(name, [&pool, width, modules] (uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+          auto* image = rasterize(pool, width, modules);
+          do_not_optimize(image);
+        }
+      }, static_cast<uint64_t>(width) * width);
+
+    auto* image = rasterize(pool, width, modules);
+    snprintf(name, sizeof(name), "scale/v%02d", version);
+    bench->run(name, [&canvas, image, &area] (uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+          paint(canvas.get(), image, area, kWindowSize, kWindowSize);
+          flush_canvas(canvas.get());
+        }
+      }, static_cast<uint64_t>(kWindowSize) * kWindowSize * 4);
+  }
+
+  return bench->finish();
+}
@@ -0,0 +1,75 @@
+#include "common.hh"
+
+#include "bench.hh"
+#include "selection.hh"
+#include "url_extract.hh"
+
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+void bench_looks_like_url(Bench& bench, std::string name, std::string str) {
+  bench.run("looks_like_url/" + name, [&str] (uint64_t iterations) {
+      for (uint64_t i = 0; i < iterations; ++i) {
+        do_not_optimize(str);
+        bool ret = looks_like_url(str);
+        do_not_optimize(ret);
+      }
+    }, str.size());
+}
+
+void bench_extract_urls(Bench& bench, std::string name, std::string str) {
+  std::vector<std::string_view> urls;
+  urls.reserve(16);
+  bench.run("extract_urls/" + name, [&str, &urls] (uint64_t iterations) {
+      for (uint64_t i = 0; i < iterations; ++i) {
+        do_not_optimize(str);
+        urls.clear();
+        extract_urls(str, 16, &urls);
+        do_not_optimize(urls);
+      }
+    }, str.size());
+}
+
+// Log-like text of about size bytes, with a URL every url_every lines.
+std::string make_log(size_t size, size_t url_every) {
+  std::string log;
+  log.reserve(size + 256);
+  for (size_t line = 0; log.size() < size; ++line) {
+    log += "2024-01-01 12:00:00 worker[";
+    log += std::to_string(line % 64);
+    log += "] processed request, status ok: took 12 ms";
+    if (url_every && line % url_every == 0) {
+      log += " see https://example.org/item/";
+      log += std::to_string(line % 8);
+    }
+    log += '\n';
+  }
+  return log;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto bench = Bench::create(argc, argv, "bench_url");
+  if (!bench)
+    return EXIT_FAILURE;
+
+  bench_looks_like_url(*bench, "short", "https://example.org/");
+  bench_looks_like_url(
+      *bench, "long",
+      "https://www.example.org/some/rather/long/path/index.html"
+      "?utm_source=newsletter&utm_medium=email&id=1234567890#section-3");
+  bench_looks_like_url(*bench, "word", "selection");
+  bench_looks_like_url(*bench, "text",
+                       std::string(1024, 'x') + " is not a url");
+  bench_looks_like_url(*bench, "space", "http://a b");
+
+  bench_extract_urls(*bench, "none-8MB", make_log(8 << 20, 0));
+  bench_extract_urls(*bench, "sparse-8MB", make_log(8 << 20, 1000));
+  bench_extract_urls(*bench, "dense-1MB", make_log(1 << 20, 1));
+
+  return bench->finish();
+}
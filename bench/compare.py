@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Compares benchmark results against a stored baseline.
+
+Reads the JSON files written by the bench_* programs and reports every
+benchmark whose time per iteration grew by more than the threshold compared
+to the baseline. With --save the results are written as the new baseline
+instead. Without a baseline the results are only listed.
+"""
+
+import argparse
+import json
+import os
+import sys
+
+
+def load_results(paths):
+    results = {}
+    for path in paths:
+        if not os.path.exists(path):
+            print(f'{path}: missing, run `meson test --benchmark` first',
+                  file=sys.stderr)
+            sys.exit(1)
+        with open(path) as f:
+            data = json.load(f)
+        for bench in data['benchmarks']:
+            results[bench['name']] = bench['ns_per_iteration']
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--baseline', required=True,
+                        help='baseline JSON file')
+    parser.add_argument('--threshold', type=float, default=10.0,
+                        help='allowed slowdown in percent, default 10')
+    parser.add_argument('--save', action='store_true',
+                        help='write results as the new baseline')
+    parser.add_argument('results', nargs='+',
+                        help='result JSON files from the bench programs')
+    args = parser.parse_args()
+
+    results = load_results(args.results)
+
+    if args.save:
+        with open(args.baseline, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+            f.write('\n')
+        print(f'Saved {len(results)} results to {args.baseline}')
+        return 0
+
+    # Timings only compare on the same machine, so no baseline is
+    # committed. Without one there is nothing to regress against.
+    if not os.path.exists(args.baseline):
+        print(f'{args.baseline}: no baseline, nothing to compare against.'
+              ' Create one with --save, or `ninja bench-baseline`.')
+        for name in sorted(results):
+            print(f'{name:32} {results[name]:14.1f} ns')
+        return 0
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+
+    regressions = 0
+    for name in sorted(results):
+        current = results[name]
+        if name not in baseline:
+            print(f'{name:32} {current:14.1f} ns  (new)')
+            continue
+        old = baseline[name]
+        change = (current - old) / old * 100.0 if old > 0 else 0.0
+        flag = ''
+        if change > args.threshold:
+            flag = '  REGRESSION'
+            regressions += 1
+        print(f'{name:32} {current:14.1f} ns  {change:+7.1f}%{flag}')
+    for name in sorted(set(baseline) - set(results)):
+        print(f'{name:32} {"":14} --  (missing)')
+
+    if regressions:
+        print(f'{regressions} benchmark(s) slower than {args.threshold}%'
+              ' over baseline', file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
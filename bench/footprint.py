@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""Measures startup time and memory of one or more qrwnd binaries.
+
+Starts each binary in its own Xvfb several times. Reports the wall time
+from exec until startup is done, first paint included, the part of that
+spent before main() going by --timing, and the RSS, PSS and number of
+shared objects mapped once started. Pass the qrwnd of a default build and
+of a -Dcairo=false build to compare the two.
+"""
+
+import argparse
+import os
+import statistics
+import subprocess
+import sys
+import time
+
+
+def start_xvfb(xvfb):
+    read_fd, write_fd = os.pipe()
+    proc = subprocess.Popen([xvfb, '-displayfd', str(write_fd),
+                             '-nolisten', 'tcp', '-screen', '0',
+                             '1024x768x24'],
+                            pass_fds=[write_fd])
+    os.close(write_fd)
+    number = b''
+    with os.fdopen(read_fd, 'rb') as f:
+        while not number.endswith(b'\n'):
+            chunk = f.read(1)
+            if not chunk:
+                proc.terminate()
+                sys.exit(f'{xvfb}: failed to start')
+            number += chunk
+    return proc, ':' + number.decode().strip()
+
+
+def read_status_kb(path, key):
+    try:
+        with open(path) as f:
+            for line in f:
+                if line.startswith(key + ':'):
+                    return int(line.split()[1])
+    except OSError:
+        pass
+    return None
+
+
+def count_shared_objects(pid):
+    objects = set()
+    with open(f'/proc/{pid}/maps') as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) >= 6 and '.so' in fields[5]:
+                objects.add(fields[5])
+    return len(objects)
+
+
+def run_once(qrwnd, display):
+    start = time.monotonic()
+    proc = subprocess.Popen([qrwnd, '--display', display, '--timing',
+                             '--no-snapshot', '--no-rewrite'],
+                            stderr=subprocess.PIPE, text=True)
+    painted = None
+    in_main_ms = None
+    for line in proc.stderr:
+        line = line.strip()
+        if line.startswith('Startup timing:'):
+            painted = time.monotonic()
+        elif painted is not None and line.endswith(' ms)'):
+            # "keyboard: 1.2 ms (12.3 ms)", the last is since main().
+            in_main_ms = float(line.split('(')[1].split()[0])
+        elif line.startswith('round trips:'):
+            break
+    if painted is None or in_main_ms is None:
+        proc.kill()
+        proc.wait()
+        sys.exit(f'{qrwnd}: never reported its startup timing')
+    # Let it settle before looking at memory.
+    time.sleep(0.5)
+    pid = proc.pid
+    sample = {
+        'wall_ms': (painted - start) * 1000,
+        'pre_main_ms': (painted - start) * 1000 - in_main_ms,
+        'rss_kb': read_status_kb(f'/proc/{pid}/status', 'VmRSS'),
+        'pss_kb': read_status_kb(f'/proc/{pid}/smaps_rollup', 'Pss'),
+        'shared_objects': count_shared_objects(pid),
+    }
+    proc.terminate()
+    proc.wait()
+    return sample
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--xvfb', default='Xvfb',
+                        help='Xvfb binary, default is Xvfb in PATH')
+    parser.add_argument('--runs', type=int, default=10,
+                        help='runs per binary, default 10')
+    parser.add_argument('qrwnd', nargs='+', help='qrwnd binaries to measure')
+    args = parser.parse_args()
+
+    print(f'{"binary":40} {"wall ms":>9} {"pre-main ms":>12} '
+          f'{"RSS kB":>8} {"PSS kB":>8} {"libs":>5}')
+    for qrwnd in args.qrwnd:
+        xvfb, display = start_xvfb(args.xvfb)
+        try:
+            samples = [run_once(qrwnd, display) for _ in range(args.runs)]
+        finally:
+            xvfb.terminate()
+            xvfb.wait()
+
+        def median(key):
+            values = [s[key] for s in samples if s[key] is not None]
+            return statistics.median(values) if values else float('nan')
+
+        print(f'{qrwnd[-40:]:40} {median("wall_ms"):9.1f} '
+              f'{median("pre_main_ms"):12.1f} {median("rss_kb"):8.0f} '
+              f'{median("pss_kb"):8.0f} {median("shared_objects"):5.0f}')
+
+
+if __name__ == '__main__':
+    main()
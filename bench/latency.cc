@@ -0,0 +1,281 @@
+#include "common.hh"
+
+#include "args.hh"
+#include "owner.hh"
+#include "snapshot.hh"
+#include "xcb_connection.hh"
+#include "xvfb.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <stdlib.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Measures the time from SetSelectionOwner until qrwnd has painted the code
+// for the new selection. Starts its own Xvfb and qrwnd, acts as selection
+// owner and uses qrwnd --paint-trace to know when the code is drawn.
+
+namespace {
+
+constexpr int kDefaultSamples = 50;
+constexpr int kDefaultSlowMs = 50;
+// Samples thrown away at the start of each scenario.
+constexpr int kWarmupSamples = 3;
+constexpr auto kStartupTimeout = std::chrono::seconds(10);
+constexpr auto kSampleTimeout = std::chrono::seconds(5);
+// How long to wait for qrwnd to ask the owner that never replies.
+constexpr auto kNeverTimeout = std::chrono::seconds(1);
+
+constexpr size_t kShortContent = 100;
+// Just below the capacity of a version 40 code, so never streamed.
+constexpr size_t kLongContent = 2900;
+
+enum class Owner {
+  // Replies as soon as asked.
+  IMMEDIATE,
+  // Replies after --slow milliseconds.
+  SLOW,
+  // Replies using the INCR protocol, chunk_size bytes at the time.
+  INCR,
+  // Replies immediately, but only after another owner, that never
+  // replies, has been asked.
+  NEVER,
+};
+
+struct Scenario {
+  char const* name;
+  Owner owner;
+  size_t content_size;
+  size_t chunk_size;
+};
+
+constexpr Scenario kScenarios[] = {
+  { "immediate", Owner::IMMEDIATE, kShortContent, 0 },
+  { "immediate-long", Owner::IMMEDIATE, kLongContent, 0 },
+  { "slow", Owner::SLOW, kShortContent, 0 },
+  { "incr-64", Owner::INCR, kLongContent, 64 },
+  { "incr-512", Owner::INCR, kLongContent, 512 },
+  { "incr-2048", Owner::INCR, kLongContent, 2048 },
+  { "never", Owner::NEVER, kShortContent, 0 },
+};
+
+struct Result {
+  std::string name;
+  std::vector<Clock::duration> latency;
+  int timeouts = 0;
+};
+
+class Harness {
+public:
+  Harness(xcb::shared_conn conn, xcb_screen_t* screen, int slow_ms)
+    : owner_(conn, screen), slow_(std::chrono::milliseconds(slow_ms)) {}
+
+  bool setup() {
+    return owner_.setup();
+  }
+
+  // Waits for qrwnd to do its first paint.
+  bool wait_for_startup() {
+    owner_.expect(std::nullopt);
+    return owner_.wait_for_paint(Clock::now() + kStartupTimeout);
+  }
+
+  void sample(Scenario const& scenario, uint64_t index, Result* result) {
+    auto& content = owner_.content();
+    content = "https://example.org/latency/" + std::to_string(index) + "/";
+    while (content.size() < scenario.content_size)
+      content.push_back('a' + content.size() % 26);
+    owner_.expect(Snapshot::hash(content));
+    switch (scenario.owner) {
+    case Owner::IMMEDIATE:
+    case Owner::NEVER:
+      owner_.set_mode(SelectionOwner::Mode::DIRECT);
+      break;
+    case Owner::SLOW:
+      owner_.set_mode(SelectionOwner::Mode::DIRECT, 0, slow_);
+      break;
+    case Owner::INCR:
+      owner_.set_mode(SelectionOwner::Mode::INCR, scenario.chunk_size);
+      break;
+    }
+
+    if (scenario.owner == Owner::NEVER) {
+      auto const asked = owner_.own(false);
+      owner_.wait_for_request(asked + kNeverTimeout);
+    }
+
+    auto const start = owner_.own(true);
+    if (owner_.wait_for_paint(start + kSampleTimeout)) {
+      result->latency.push_back(owner_.painted_time() - start);
+    } else {
+      ++result->timeouts;
+    }
+    // Anything left belongs to a timed out sample.
+    owner_.cancel();
+  }
+
+private:
+  SelectionOwner owner_;
+  Clock::duration const slow_;
+};
+
+void print_results(std::vector<Result> const& results, std::ostream& out) {
+  out << "scenario          samples  timeouts    p50 ms    p99 ms    max ms\n";
+  for (auto const& result : results) {
+    char line[128];
+    if (result.latency.empty()) {
+      snprintf(line, sizeof(line), "%-16s %8d %9d %9s %9s %9s\n",
+               result.name.c_str(), 0, result.timeouts, "-", "-", "-");
+    } else {
+      snprintf(line, sizeof(line), "%-16s %8zu %9d %9.2f %9.2f %9.2f\n",
+               result.name.c_str(), result.latency.size(), result.timeouts,
+               to_ms(percentile(result.latency, 0.5)),
+               to_ms(percentile(result.latency, 0.99)),
+               to_ms(result.latency.back()));
+    }
+    out << line;
+  }
+  out.flush();
+}
+
+// Same format as the Bench results, so bench/compare.py works for both.
+bool write_json(std::vector<Result> const& results, std::string const& path) {
+  std::ofstream out(path);
+  out << "{\n  \"program\": \"latency\",\n  \"benchmarks\": [";
+  bool first = true;
+  for (auto const& result : results) {
+    if (result.latency.empty())
+      continue;
+    for (auto p : { 0.5, 0.99 }) {
+      out << (first ? "\n" : ",\n");
+      first = false;
+      std::chrono::duration<double, std::nano> ns =
+        percentile(result.latency, p);
+      out << "    {\"name\": \"latency/" << result.name << "/p"
+          << static_cast<int>(p * 100) << "\", "
+          << "\"iterations\": " << result.latency.size() << ", "
+          << "\"ns_per_iteration\": " << ns.count() << ", "
+          << "\"bytes_per_second\": 0}";
+    }
+  }
+  out << "\n  ]\n}" << std::endl;
+  out.close();
+  return !out.fail();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto args = Args::create();
+  auto* help = args->add_option('h', "help", "display this text and exit.");
+  auto* qrwnd_opt = args->add_option_with_arg(
+      'q', "qrwnd", "qrwnd binary to measure, required.", "PATH");
+  auto* xvfb_opt = args->add_option_with_arg(
+      'x', "xvfb", "Xvfb binary, default is Xvfb in PATH.", "PATH");
+  auto* samples_opt = args->add_option_with_arg(
+      'n', "samples", "samples per scenario, default 50.", "N");
+  auto* slow_opt = args->add_option_with_arg(
+      '\0', "slow", "reply delay of the slow owner, default 50.", "MS");
+  auto* filter = args->add_option_with_arg(
+      'f', "filter", "only run scenarios with names containing STR.", "STR");
+  auto* json = args->add_option_with_arg(
+      'j', "json", "also write results to FILE.", "FILE");
+  std::vector<std::string> arguments;
+  if (!args->run(argc, argv, "latency", std::cerr, &arguments)) {
+    std::cerr << "Try `latency --help` for usage." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (help->is_set()) {
+    std::cout << "Usage: `latency --qrwnd PATH [OPTIONS]`\n"
+              << "Measures selection to pixels latency of qrwnd in Xvfb.\n"
+              << "\n";
+    args->print_descriptions(std::cout, 80);
+    return EXIT_SUCCESS;
+  }
+  if (!arguments.empty() || !qrwnd_opt->is_set()) {
+    std::cerr << "Expected --qrwnd and no arguments.\n"
+              << "Try `latency --help` for usage." << std::endl;
+    return EXIT_FAILURE;
+  }
+  int samples = kDefaultSamples;
+  if (samples_opt->is_set()) {
+    samples = atoi(samples_opt->arg().c_str());
+    if (samples <= 0) {
+      std::cerr << "Invalid argument to --samples." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  int slow_ms = kDefaultSlowMs;
+  if (slow_opt->is_set()) {
+    slow_ms = atoi(slow_opt->arg().c_str());
+    if (slow_ms <= 0) {
+      std::cerr << "Invalid argument to --slow." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::string display;
+  auto xvfb = start_xvfb(xvfb_opt->is_set() ? xvfb_opt->arg() : "Xvfb",
+                         &display);
+  if (xvfb < 0)
+    return EXIT_FAILURE;
+
+  int ret = EXIT_FAILURE;
+  pid_t qrwnd = -1;
+  {
+    int screen_index = 0;
+    auto conn = xcb::make_shared_conn(xcb_connect(display.c_str(),
+                                                  &screen_index));
+    if (xcb_connection_has_error(conn.get())) {
+      std::cerr << "Unable to connect to " << display << std::endl;
+      stop(xvfb);
+      return EXIT_FAILURE;
+    }
+    Harness harness(conn, xcb::get_screen(conn.get(), screen_index),
+                    slow_ms);
+    if (harness.setup()) {
+      qrwnd = spawn({ qrwnd_opt->arg(), "--display", display,
+                      "--paint-trace", "--no-rewrite", "--no-snapshot" });
+    } else {
+      std::cerr << "Failed to get X atoms." << std::endl;
+    }
+
+    if (qrwnd > 0 && harness.wait_for_startup()) {
+      std::vector<Result> results;
+      uint64_t index = 0;
+      for (auto const& scenario : kScenarios) {
+        if (filter->is_set() &&
+            std::string_view(scenario.name).find(filter->arg()) ==
+            std::string_view::npos)
+          continue;
+        Result warmup;
+        for (int i = 0; i < kWarmupSamples; ++i)
+          harness.sample(scenario, index++, &warmup);
+        Result result;
+        result.name = scenario.name;
+        for (int i = 0; i < samples; ++i)
+          harness.sample(scenario, index++, &result);
+        std::sort(result.latency.begin(), result.latency.end());
+        results.push_back(std::move(result));
+      }
+      print_results(results, std::cout);
+      ret = EXIT_SUCCESS;
+      if (json->is_set() && !write_json(results, json->arg())) {
+        std::cerr << json->arg() << ": Unable to write results"
+                  << std::endl;
+        ret = EXIT_FAILURE;
+      }
+    } else if (qrwnd > 0) {
+      std::cerr << "qrwnd never painted." << std::endl;
+    }
+  }
+
+  stop(qrwnd);
+  stop(xvfb);
+  return ret;
+}
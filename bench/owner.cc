@@ -0,0 +1,218 @@
+#include "common.hh"
+
+#include "owner.hh"
+#include "xcb_event.hh"
+
+#include <algorithm>
+#include <iostream>
+#include <poll.h>
+#include <string.h>
+
+Clock::duration percentile(std::vector<Clock::duration> const& latency,
+                           double p) {
+  if (latency.empty())
+    return Clock::duration::zero();
+  auto index = static_cast<size_t>(p * latency.size());
+  return latency[std::min(index, latency.size() - 1)];
+}
+
+double to_ms(Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+SelectionOwner::SelectionOwner(xcb::shared_conn conn, xcb_screen_t* screen)
+  : conn_(conn), screen_(screen), atoms_(conn, kAtomNames),
+    owner_(xcb::make_unique_wnd(conn)),
+    never_owner_(xcb::make_unique_wnd(conn)) {
+  uint32_t value = XCB_EVENT_MASK_PROPERTY_CHANGE;
+  xcb_change_window_attributes(conn_.get(), screen_->root,
+                               XCB_CW_EVENT_MASK, &value);
+  for (auto* wnd : { owner_.get(), never_owner_.get() }) {
+    xcb_create_window(conn_.get(), XCB_COPY_FROM_PARENT, wnd->id(),
+                      screen_->root, 0, 0, 1, 1, 0,
+                      XCB_WINDOW_CLASS_INPUT_ONLY, screen_->root_visual,
+                      0, nullptr);
+  }
+}
+
+bool SelectionOwner::setup() {
+  return atoms_.sync();
+}
+
+void SelectionOwner::set_mode(Mode mode, size_t chunk_size,
+                              Clock::duration delay) {
+  mode_ = mode;
+  chunk_size_ = chunk_size;
+  delay_ = delay;
+}
+
+void SelectionOwner::expect(std::optional<uint64_t> hash) {
+  expected_hash_ = hash;
+  painted_ = false;
+}
+
+Clock::time_point SelectionOwner::own(bool answers) {
+  painted_ = false;
+  asked_ = false;
+  auto const now = Clock::now();
+  xcb_set_selection_owner(conn_.get(),
+                          answers ? owner_->id() : never_owner_->id(),
+                          XCB_ATOM_PRIMARY, XCB_CURRENT_TIME);
+  xcb_flush(conn_.get());
+  return now;
+}
+
+bool SelectionOwner::wait_for_paint(Clock::time_point deadline) {
+  return run_until([this] { return painted_; }, deadline);
+}
+
+bool SelectionOwner::wait_for_request(Clock::time_point deadline) {
+  return run_until([this] { return asked_; }, deadline);
+}
+
+void SelectionOwner::wait(Clock::time_point deadline) {
+  run_until([] { return false; }, deadline);
+}
+
+void SelectionOwner::cancel() {
+  pending_.clear();
+  transfers_.clear();
+}
+
+bool SelectionOwner::run_until(std::function<bool()> const& done,
+                               Clock::time_point deadline) {
+  while (true) {
+    while (true) {
+      xcb::generic_event event(xcb_poll_for_event(conn_.get()));
+      if (!event)
+        break;
+      handle(event.get());
+    }
+    auto now = Clock::now();
+    auto wakeup = deadline;
+    for (auto it = pending_.begin(); it != pending_.end();) {
+      if (it->due <= now) {
+        reply(it->request);
+        it = pending_.erase(it);
+      } else {
+        wakeup = std::min(wakeup, it->due);
+        ++it;
+      }
+    }
+    xcb_flush(conn_.get());
+    if (done())
+      return true;
+    if (xcb_connection_has_error(conn_.get())) {
+      std::cerr << "X connection lost." << std::endl;
+      return false;
+    }
+    if (now >= deadline)
+      return false;
+    auto timeout = std::chrono::ceil<std::chrono::milliseconds>(
+        wakeup - now);
+    struct pollfd pfd;
+    pfd.fd = xcb_get_file_descriptor(conn_.get());
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    poll(&pfd, 1, std::max<int>(0, timeout.count()));
+  }
+}
+
+void SelectionOwner::handle(xcb_generic_event_t* event) {
+  auto response_type = XCB_EVENT_RESPONSE_TYPE(event);
+  if (response_type == XCB_SELECTION_REQUEST) {
+    auto* e = reinterpret_cast<xcb_selection_request_event_t*>(event);
+    asked_ = true;
+    if (e->owner == never_owner_->id())
+      return;
+    if (delay_ > Clock::duration::zero()) {
+      pending_.push_back({ *e, Clock::now() + delay_ });
+    } else {
+      reply(*e);
+    }
+  } else if (response_type == XCB_PROPERTY_NOTIFY) {
+    auto* e = reinterpret_cast<xcb_property_notify_event_t*>(event);
+    if (e->window == screen_->root && e->atom == atoms_[Atom::QRWND_PAINT]
+        && e->state == XCB_PROPERTY_NEW_VALUE) {
+      // Take the time before the round trip to read the value.
+      auto now = Clock::now();
+      if (read_paint_hash()) {
+        painted_ = true;
+        painted_time_ = now;
+      }
+    } else if (e->state == XCB_PROPERTY_DELETE) {
+      for (auto it = transfers_.begin(); it != transfers_.end(); ++it) {
+        if (it->requestor == e->window && it->property == e->atom) {
+          if (send_chunk(*it))
+            transfers_.erase(it);
+          break;
+        }
+      }
+    }
+  } else if (response_type == 0) {
+    auto* e = reinterpret_cast<xcb_generic_error_t*>(event);
+    std::cerr << "X error: " << xcb_event_get_error_label(e->error_code)
+              << std::endl;
+  }
+}
+
+bool SelectionOwner::read_paint_hash() {
+  auto cookie = xcb_get_property(conn_.get(), 0, screen_->root,
+                                 atoms_[Atom::QRWND_PAINT],
+                                 XCB_ATOM_CARDINAL, 0, 2);
+  xcb::reply<xcb_get_property_reply_t> reply(
+      xcb_get_property_reply(conn_.get(), cookie, nullptr));
+  if (!reply || reply->format != 32 ||
+      xcb_get_property_value_length(reply.get()) != 8)
+    return false;
+  if (!expected_hash_)
+    return true;
+  auto* value = reinterpret_cast<uint32_t*>(
+      xcb_get_property_value(reply.get()));
+  uint64_t hash = (static_cast<uint64_t>(value[0]) << 32) | value[1];
+  return hash == *expected_hash_;
+}
+
+void SelectionOwner::reply(xcb_selection_request_event_t const& request) {
+  auto const utf8_string = atoms_[Atom::UTF8_STRING];
+  // Obsolete clients use None as property.
+  auto property = request.property ? request.property : request.target;
+  if (request.target != utf8_string && request.target != XCB_ATOM_STRING) {
+    property = XCB_NONE;
+  } else if (mode_ == Mode::INCR || mode_ == Mode::INCR_ABANDONED) {
+    uint32_t value = XCB_EVENT_MASK_PROPERTY_CHANGE;
+    xcb_change_window_attributes(conn_.get(), request.requestor,
+                                 XCB_CW_EVENT_MASK, &value);
+    uint32_t size = content_.size();
+    xcb_change_property(conn_.get(), XCB_PROP_MODE_REPLACE,
+                        request.requestor, property, atoms_[Atom::INCR],
+                        32, 1, &size);
+    if (mode_ == Mode::INCR)
+      transfers_.push_back({ request.requestor, property, 0 });
+  } else {
+    xcb_change_property(conn_.get(), XCB_PROP_MODE_REPLACE,
+                        request.requestor, property, request.target, 8,
+                        content_.size(), content_.data());
+  }
+
+  xcb_selection_notify_event_t notify;
+  memset(&notify, 0, sizeof(notify));
+  notify.response_type = XCB_SELECTION_NOTIFY;
+  notify.time = request.time;
+  notify.requestor = request.requestor;
+  notify.selection = request.selection;
+  notify.target = request.target;
+  notify.property = property;
+  xcb_send_event(conn_.get(), 0, request.requestor, XCB_EVENT_MASK_NO_EVENT,
+                 reinterpret_cast<char const*>(&notify));
+}
+
+bool SelectionOwner::send_chunk(Transfer& transfer) {
+  auto size = std::min(chunk_size_, content_.size() - transfer.offset);
+  xcb_change_property(conn_.get(), XCB_PROP_MODE_REPLACE,
+                      transfer.requestor, transfer.property,
+                      atoms_[Atom::UTF8_STRING], 8, size,
+                      content_.data() + transfer.offset);
+  transfer.offset += size;
+  return size == 0;
+}
@@ -0,0 +1,141 @@
+#ifndef OWNER_HH
+#define OWNER_HH
+
+#include "xcb_atoms.hh"
+#include "xcb_connection.hh"
+#include "xcb_resource.hh"
+
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <xcb/xcb.h>
+
+// Selection owner and paint watcher shared by the harnesses that run qrwnd
+// in Xvfb. Owns PRIMARY with content(), answering conversions directly or
+// with INCR, and reads the _QRWND_PAINT property qrwnd --paint-trace sets
+// on the root window to know when the expected code was painted.
+
+typedef std::chrono::steady_clock Clock;
+
+// p in [0, 1], latency must be sorted. Zero if latency is empty.
+Clock::duration percentile(std::vector<Clock::duration> const& latency,
+                           double p);
+
+double to_ms(Clock::duration duration);
+
+enum class Atom {
+  UTF8_STRING,
+  INCR,
+  QRWND_PAINT,
+  LAST = QRWND_PAINT,
+};
+
+constexpr xcb::AtomTable<Atom, 3> kAtomNames = {{
+  { Atom::UTF8_STRING, "UTF8_STRING" },
+  { Atom::INCR, "INCR" },
+  { Atom::QRWND_PAINT, "_QRWND_PAINT" },
+}};
+static_assert(xcb::in_order(kAtomNames));
+
+class SelectionOwner {
+public:
+  enum class Mode {
+    // Content in one property.
+    DIRECT,
+    // INCR protocol, chunk_size bytes at the time.
+    INCR,
+    // Starts INCR but never sends any chunk.
+    INCR_ABANDONED,
+  };
+
+  SelectionOwner(xcb::shared_conn conn, xcb_screen_t* screen);
+
+  bool setup();
+
+  // What the following conversions get. Kept between changes so its
+  // capacity can be reused.
+  std::string& content() {
+    return content_;
+  }
+
+  // How, and after what delay, the following conversions are answered.
+  void set_mode(Mode mode, size_t chunk_size = 0,
+                Clock::duration delay = Clock::duration::zero());
+
+  // Only paints with this content hash, see Snapshot::hash(), count from
+  // now on. Any paint counts if there is none.
+  void expect(std::optional<uint64_t> hash);
+
+  // Takes PRIMARY, with a window that never answers if !answers, and
+  // returns when.
+  Clock::time_point own(bool answers);
+
+  // Returns true once the expected paint is seen, false on timeout.
+  bool wait_for_paint(Clock::time_point deadline);
+
+  // Returns true once qrwnd has asked for the selection since own().
+  bool wait_for_request(Clock::time_point deadline);
+
+  // Keeps answering until deadline.
+  void wait(Clock::time_point deadline);
+
+  // When the expected paint was seen.
+  Clock::time_point painted_time() const {
+    return painted_time_;
+  }
+
+  // Drops delayed answers and transfers, left from a change that timed
+  // out.
+  void cancel();
+
+private:
+  struct Pending {
+    xcb_selection_request_event_t request;
+    Clock::time_point due;
+  };
+
+  struct Transfer {
+    xcb_window_t requestor;
+    xcb_atom_t property;
+    size_t offset;
+  };
+
+  // Handles events until done returns true or deadline passes. Returns
+  // false on timeout or connection error.
+  bool run_until(std::function<bool()> const& done,
+                 Clock::time_point deadline);
+
+  void handle(xcb_generic_event_t* event);
+
+  // Returns true if the painted hash is the expected one, any hash matches
+  // if none is expected.
+  bool read_paint_hash();
+
+  void reply(xcb_selection_request_event_t const& request);
+
+  // Sends the next chunk, returns true if it was the final empty one.
+  bool send_chunk(Transfer& transfer);
+
+  xcb::shared_conn conn_;
+  xcb_screen_t* const screen_;
+  xcb::Atoms<Atom, kAtomNames.size()> atoms_;
+  xcb::unique_wnd owner_;
+  xcb::unique_wnd never_owner_;
+
+  std::string content_;
+  Mode mode_ = Mode::DIRECT;
+  size_t chunk_size_ = 0;
+  Clock::duration delay_ = Clock::duration::zero();
+  std::optional<uint64_t> expected_hash_;
+  bool painted_ = false;
+  Clock::time_point painted_time_;
+  bool asked_ = false;
+  std::vector<Pending> pending_;
+  std::vector<Transfer> transfers_;
+};
+
+#endif  // OWNER_HH
@@ -0,0 +1,542 @@
+#include "common.hh"
+
+#include "args.hh"
+#include "owner.hh"
+#include "snapshot.hh"
+#include "xcb_connection.hh"
+#include "xvfb.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <dirent.h>
+#include <errno.h>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <random>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+// Runs qrwnd in Xvfb through millions of selection changes of mixed sizes
+// and owners and fails if its memory, open files, outstanding conversions
+// or per change latency drift. Changes are made one at the time, waiting
+// for qrwnd --paint-trace to report the new code before the next one.
+
+namespace {
+
+constexpr uint64_t kDefaultChanges = 2000000;
+// Samples taken over the whole run.
+constexpr int kSamples = 100;
+// Samples at the start left out of the baseline, and samples at the start
+// and end that the baseline and the final values are taken from.
+constexpr int kWarmupSamples = 10;
+constexpr int kCompareSamples = 10;
+static_assert(kWarmupSamples + 2 * kCompareSamples <= kSamples);
+
+constexpr uint64_t kDefaultMaxRssGrowthKb = 4096;
+constexpr uint64_t kDefaultMaxFdGrowth = 0;
+constexpr double kDefaultMaxLatencyGrowth = 1.5;
+// Added to the allowed latency, p50 is often well below a millisecond.
+constexpr auto kLatencySlack = std::chrono::microseconds(200);
+
+constexpr auto kStartupTimeout = std::chrono::seconds(10);
+constexpr auto kChangeTimeout = std::chrono::seconds(5);
+constexpr auto kNeverTimeout = std::chrono::seconds(1);
+// How long qrwnd waits for an answer before giving up on a conversion,
+// matches the Controller.
+constexpr auto kRequestExpire = std::chrono::seconds(10);
+// Owners that never reply tie up one of qrwnd's target properties each
+// until they expire, keep it well below the ten there are.
+constexpr size_t kMaxNeverPerExpire = 4;
+
+// Just below the capacity of a version 40 code, so never streamed.
+constexpr size_t kMaxCodeContent = 2900;
+constexpr size_t kMaxTextContent = 256 * 1024;
+
+enum class Owner {
+  // Replies with the content in one property.
+  IMMEDIATE,
+  // Replies using the INCR protocol.
+  INCR,
+  // Replies with INCR but never sends any chunk.
+  INCR_ABANDONED,
+  // Never replies at all.
+  NEVER,
+};
+
+struct Change {
+  Owner owner;
+  // Total size, content bigger than a code is text with one URL in it.
+  size_t size;
+  size_t chunk_size;
+};
+
+struct Sample {
+  uint64_t changes;
+  double elapsed_s;
+  uint64_t rss_kb;
+  uint64_t fds;
+  uint64_t active_requests;
+  Clock::duration p50;
+  Clock::duration p99;
+  uint64_t timeouts;
+};
+
+// Returns 0 if the process is gone.
+uint64_t read_rss_kb(pid_t pid) {
+  std::ifstream in("/proc/" + std::to_string(pid) + "/status");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.compare(0, 6, "VmRSS:") == 0)
+      return strtoull(line.c_str() + 6, nullptr, 10);
+  }
+  return 0;
+}
+
+uint64_t count_fds(pid_t pid) {
+  auto path = "/proc/" + std::to_string(pid) + "/fd";
+  auto* dir = opendir(path.c_str());
+  if (!dir)
+    return 0;
+  uint64_t count = 0;
+  while (auto* entry = readdir(dir)) {
+    if (entry->d_name[0] != '.')
+      ++count;
+  }
+  closedir(dir);
+  return count;
+}
+
+// Reads "active_requests" from the qrwnd --stats-socket JSON.
+std::optional<uint64_t> read_active_requests(std::string const& socket_path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path))
+    return std::nullopt;
+  memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return std::nullopt;
+  std::string json;
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+              sizeof(addr)) == 0) {
+    char buf[4096];
+    while (true) {
+      auto got = read(fd, buf, sizeof(buf));
+      if (got < 0 && errno == EINTR)
+        continue;
+      if (got <= 0)
+        break;
+      json.append(buf, got);
+    }
+  }
+  close(fd);
+  std::string_view const key = "\"active_requests\":";
+  auto pos = json.find(key);
+  if (pos == std::string::npos)
+    return std::nullopt;
+  return strtoull(json.c_str() + pos + key.size(), nullptr, 10);
+}
+
+class Soak {
+public:
+  Soak(xcb::shared_conn conn, xcb_screen_t* screen, uint64_t seed)
+    : owner_(conn, screen), random_(seed) {
+    owner_.content().reserve(kMaxTextContent);
+  }
+
+  bool setup() {
+    return owner_.setup();
+  }
+
+  // Waits for qrwnd to do its first paint.
+  bool wait_for_startup() {
+    owner_.expect(std::nullopt);
+    return owner_.wait_for_paint(Clock::now() + kStartupTimeout);
+  }
+
+  // Makes one random change. Adds its latency to latency, if qrwnd was
+  // expected to paint for it, and returns false if it never did.
+  bool change(std::vector<Clock::duration>* latency) {
+    auto next = pick();
+    make_content(next);
+    switch (next.owner) {
+    case Owner::IMMEDIATE:
+    case Owner::NEVER:
+      owner_.set_mode(SelectionOwner::Mode::DIRECT);
+      break;
+    case Owner::INCR:
+      owner_.set_mode(SelectionOwner::Mode::INCR, next.chunk_size);
+      break;
+    case Owner::INCR_ABANDONED:
+      owner_.set_mode(SelectionOwner::Mode::INCR_ABANDONED);
+      break;
+    }
+
+    if (next.owner == Owner::NEVER) {
+      auto const start = owner_.own(false);
+      never_.push_back(start);
+      owner_.wait_for_request(start + kNeverTimeout);
+      return true;
+    }
+    auto const start = owner_.own(true);
+    if (next.owner == Owner::INCR_ABANDONED) {
+      owner_.wait_for_request(start + kNeverTimeout);
+      return true;
+    }
+    bool ok = owner_.wait_for_paint(start + kChangeTimeout);
+    if (ok)
+      latency->push_back(owner_.painted_time() - start);
+    // Anything left belongs to a timed out change.
+    owner_.cancel();
+    return ok;
+  }
+
+  // Lets every conversion qrwnd gave up on expire and makes one change
+  // that makes it notice.
+  bool drain() {
+    owner_.wait(Clock::now() + kRequestExpire + std::chrono::seconds(1));
+    never_.clear();
+    std::vector<Clock::duration> latency;
+    return change(&latency);
+  }
+
+private:
+  Change pick() {
+    auto const now = Clock::now();
+    while (!never_.empty() && never_.front() + kRequestExpire < now)
+      never_.pop_front();
+    auto roll = std::uniform_int_distribution<int>(0, 99)(random_);
+    auto size = [this] (size_t min, size_t max) {
+      return std::uniform_int_distribution<size_t>(min, max)(random_);
+    };
+    if (roll < 3 && never_.size() < kMaxNeverPerExpire)
+      return { Owner::NEVER, size(20, 200), 0 };
+    if (roll < 5)
+      return { Owner::INCR_ABANDONED, size(1000, kMaxTextContent), 0 };
+    if (roll < 25) {
+      auto total = roll < 15 ? size(100, kMaxCodeContent)
+        : size(kMaxCodeContent + 1, kMaxTextContent);
+      return { Owner::INCR, total, size(64, 16 * 1024) };
+    }
+    if (roll < 35) {
+      return { Owner::IMMEDIATE, size(kMaxCodeContent + 1, kMaxTextContent),
+               0 };
+    }
+    return { Owner::IMMEDIATE, size(20, kMaxCodeContent), 0 };
+  }
+
+  // Content up to kMaxCodeContent is a URL, anything longer is text with
+  // one URL in it, which is what gets encoded.
+  void make_content(Change const& change) {
+    auto& content = owner_.content();
+    auto url = "https://example.org/soak/" + std::to_string(index_++) + "/";
+    if (change.size <= kMaxCodeContent) {
+      content = url;
+      while (content.size() < change.size)
+        content.push_back('a' + content.size() % 26);
+      owner_.expect(Snapshot::hash(content));
+    } else {
+      content = "see ";
+      content += url;
+      content += " for details.";
+      static std::string_view const kWords[] = {
+        " lorem", " ipsum", " dolor", " sit", " amet", "\n",
+      };
+      size_t word = 0;
+      while (content.size() < change.size)
+        content += kWords[word++ % std::size(kWords)];
+      owner_.expect(Snapshot::hash(url));
+    }
+  }
+
+  SelectionOwner owner_;
+  std::mt19937_64 random_;
+
+  uint64_t index_ = 0;
+  // When each recent owner that never replies was asked.
+  std::deque<Clock::time_point> never_;
+};
+
+void print_header(std::ostream& out) {
+  out << "   changes  elapsed s    rss kB   fds  active    p50 ms    p99 ms"
+    "  timeouts\n";
+}
+
+void print_sample(Sample const& sample, std::ostream& out) {
+  char line[128];
+  snprintf(line, sizeof(line),
+           "%10llu %10.1f %9llu %5llu %7llu %9.3f %9.3f %9llu\n",
+           static_cast<unsigned long long>(sample.changes), sample.elapsed_s,
+           static_cast<unsigned long long>(sample.rss_kb),
+           static_cast<unsigned long long>(sample.fds),
+           static_cast<unsigned long long>(sample.active_requests),
+           to_ms(sample.p50), to_ms(sample.p99),
+           static_cast<unsigned long long>(sample.timeouts));
+  out << line << std::flush;
+}
+
+bool write_csv(std::vector<Sample> const& samples, std::string const& path) {
+  std::ofstream out(path);
+  out << "changes,elapsed_s,rss_kb,fds,active_requests,p50_ms,p99_ms,"
+    "timeouts\n";
+  for (auto const& sample : samples) {
+    out << sample.changes << ',' << sample.elapsed_s << ','
+        << sample.rss_kb << ',' << sample.fds << ','
+        << sample.active_requests << ',' << to_ms(sample.p50) << ','
+        << to_ms(sample.p99) << ',' << sample.timeouts << '\n';
+  }
+  out.close();
+  return !out.fail();
+}
+
+// Median of value over count samples starting at first.
+template<typename T>
+T median(std::vector<Sample> const& samples, size_t first, size_t count,
+         T Sample::* value) {
+  std::vector<T> values;
+  for (size_t i = first; i < first + count; ++i)
+    values.push_back(samples[i].*value);
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+struct Limits {
+  uint64_t rss_growth_kb;
+  uint64_t fd_growth;
+  double latency_growth;
+};
+
+// Compares the end of the run with the start, after warmup. Returns false
+// if anything grew more than limits allows.
+bool check_drift(std::vector<Sample> const& samples, Limits const& limits,
+                 std::ostream& out) {
+  size_t const base = kWarmupSamples;
+  size_t const last = samples.size() - kCompareSamples;
+  bool ok = true;
+
+  auto rss_base = median(samples, base, kCompareSamples, &Sample::rss_kb);
+  auto rss_last = median(samples, last, kCompareSamples, &Sample::rss_kb);
+  out << "RSS: " << rss_base << " kB -> " << rss_last << " kB";
+  if (rss_last > rss_base + limits.rss_growth_kb) {
+    out << ", grew more than " << limits.rss_growth_kb << " kB";
+    ok = false;
+  }
+  out << '\n';
+
+  auto fds_base = median(samples, base, kCompareSamples, &Sample::fds);
+  auto fds_last = median(samples, last, kCompareSamples, &Sample::fds);
+  out << "Open files: " << fds_base << " -> " << fds_last;
+  if (fds_last > fds_base + limits.fd_growth) {
+    out << ", grew more than " << limits.fd_growth;
+    ok = false;
+  }
+  out << '\n';
+
+  auto active_base = median(samples, base, kCompareSamples,
+                            &Sample::active_requests);
+  auto active_last = median(samples, last, kCompareSamples,
+                            &Sample::active_requests);
+  out << "Active requests: " << active_base << " -> " << active_last;
+  // Owners that never reply keep up to kMaxNeverPerExpire busy at any time.
+  if (active_last > std::max<uint64_t>(active_base, kMaxNeverPerExpire)) {
+    out << ", grew";
+    ok = false;
+  }
+  out << '\n';
+
+  auto p50_base = median(samples, base, kCompareSamples, &Sample::p50);
+  auto p50_last = median(samples, last, kCompareSamples, &Sample::p50);
+  out << "p50 latency: " << to_ms(p50_base) << " ms -> " << to_ms(p50_last)
+      << " ms";
+  if (p50_last > std::chrono::duration_cast<Clock::duration>(
+          p50_base * limits.latency_growth) + kLatencySlack) {
+    out << ", grew more than " << limits.latency_growth << " times";
+    ok = false;
+  }
+  out << '\n' << std::flush;
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto args = Args::create();
+  auto* help = args->add_option('h', "help", "display this text and exit.");
+  auto* qrwnd_opt = args->add_option_with_arg(
+      'q', "qrwnd", "qrwnd binary to soak, required.", "PATH");
+  auto* xvfb_opt = args->add_option_with_arg(
+      'x', "xvfb", "Xvfb binary, default is Xvfb in PATH.", "PATH");
+  auto* changes_opt = args->add_option_with_arg(
+      'n', "changes", "selection changes to make, default 2000000.", "N");
+  auto* seed_opt = args->add_option_with_arg(
+      's', "seed", "seed for the mix of changes, default 1.", "N");
+  auto* rss_opt = args->add_option_with_arg(
+      '\0', "max-rss-growth", "allowed RSS growth, default 4096.", "KB");
+  auto* fd_opt = args->add_option_with_arg(
+      '\0', "max-fd-growth", "allowed growth in open files, default 0.", "N");
+  auto* latency_opt = args->add_option_with_arg(
+      '\0', "max-latency-growth", "allowed factor of p50 latency growth,"
+      " default 1.5.", "F");
+  auto* csv = args->add_option_with_arg(
+      'c', "csv", "also write all samples to FILE.", "FILE");
+  std::vector<std::string> arguments;
+  if (!args->run(argc, argv, "soak", std::cerr, &arguments)) {
+    std::cerr << "Try `soak --help` for usage." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (help->is_set()) {
+    std::cout << "Usage: `soak --qrwnd PATH [OPTIONS]`\n"
+              << "Checks qrwnd in Xvfb for drift in memory, open files,\n"
+              << "outstanding conversions and latency over many selection\n"
+              << "changes.\n"
+              << "\n";
+    args->print_descriptions(std::cout, 80);
+    return EXIT_SUCCESS;
+  }
+  if (!arguments.empty() || !qrwnd_opt->is_set()) {
+    std::cerr << "Expected --qrwnd and no arguments.\n"
+              << "Try `soak --help` for usage." << std::endl;
+    return EXIT_FAILURE;
+  }
+  uint64_t changes = kDefaultChanges;
+  if (changes_opt->is_set()) {
+    changes = strtoull(changes_opt->arg().c_str(), nullptr, 10);
+    if (changes < kSamples) {
+      std::cerr << "Invalid argument to --changes, need at least "
+                << kSamples << "." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  uint64_t seed = 1;
+  if (seed_opt->is_set())
+    seed = strtoull(seed_opt->arg().c_str(), nullptr, 10);
+  Limits limits{ kDefaultMaxRssGrowthKb, kDefaultMaxFdGrowth,
+                 kDefaultMaxLatencyGrowth };
+  if (rss_opt->is_set())
+    limits.rss_growth_kb = strtoull(rss_opt->arg().c_str(), nullptr, 10);
+  if (fd_opt->is_set())
+    limits.fd_growth = strtoull(fd_opt->arg().c_str(), nullptr, 10);
+  if (latency_opt->is_set()) {
+    limits.latency_growth = atof(latency_opt->arg().c_str());
+    if (limits.latency_growth < 1.0) {
+      std::cerr << "Invalid argument to --max-latency-growth." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  char dir[] = "/tmp/qrwnd-soak-XXXXXX";
+  if (!mkdtemp(dir)) {
+    std::cerr << "mkdtemp: " << strerror(errno) << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string const socket_path = std::string(dir) + "/stats";
+
+  std::string display;
+  auto xvfb = start_xvfb(xvfb_opt->is_set() ? xvfb_opt->arg() : "Xvfb",
+                         &display);
+  if (xvfb < 0) {
+    rmdir(dir);
+    return EXIT_FAILURE;
+  }
+
+  int ret = EXIT_FAILURE;
+  pid_t qrwnd = -1;
+  {
+    int screen_index = 0;
+    auto conn = xcb::make_shared_conn(xcb_connect(display.c_str(),
+                                                  &screen_index));
+    if (xcb_connection_has_error(conn.get())) {
+      std::cerr << "Unable to connect to " << display << std::endl;
+      stop(xvfb);
+      rmdir(dir);
+      return EXIT_FAILURE;
+    }
+    Soak soak(conn, xcb::get_screen(conn.get(), screen_index), seed);
+    if (soak.setup()) {
+      qrwnd = spawn({ qrwnd_opt->arg(), "--display", display,
+                      "--paint-trace", "--no-rewrite", "--no-snapshot",
+                      "--stats-socket", socket_path });
+    } else {
+      std::cerr << "Failed to get X atoms." << std::endl;
+    }
+
+    if (qrwnd > 0 && soak.wait_for_startup()) {
+      std::vector<Sample> samples;
+      samples.reserve(kSamples);
+      std::vector<Clock::duration> latency;
+      uint64_t const per_sample = changes / kSamples;
+      latency.reserve(per_sample);
+      uint64_t timeouts = 0;
+      auto const start = Clock::now();
+      print_header(std::cout);
+      for (int i = 0; i < kSamples; ++i) {
+        latency.clear();
+        for (uint64_t j = 0; j < per_sample; ++j) {
+          if (!soak.change(&latency))
+            ++timeouts;
+        }
+        std::sort(latency.begin(), latency.end());
+        Sample sample;
+        sample.changes = (i + 1) * per_sample;
+        sample.elapsed_s = std::chrono::duration<double>(
+            Clock::now() - start).count();
+        sample.rss_kb = read_rss_kb(qrwnd);
+        sample.fds = count_fds(qrwnd);
+        sample.active_requests = read_active_requests(socket_path).value_or(
+            std::numeric_limits<uint64_t>::max());
+        sample.p50 = percentile(latency, 0.5);
+        sample.p99 = percentile(latency, 0.99);
+        sample.timeouts = timeouts;
+        print_sample(sample, std::cout);
+        samples.push_back(sample);
+        if (sample.rss_kb == 0) {
+          std::cerr << "qrwnd is gone." << std::endl;
+          break;
+        }
+      }
+
+      if (samples.size() == kSamples) {
+        ret = EXIT_SUCCESS;
+        if (!check_drift(samples, limits, std::cout))
+          ret = EXIT_FAILURE;
+        if (timeouts) {
+          std::cout << timeouts << " changes were never painted."
+                    << std::endl;
+          ret = EXIT_FAILURE;
+        }
+        // Every conversion must be released once the owners that never
+        // reply have expired.
+        auto active = soak.drain() ? read_active_requests(socket_path)
+          : std::nullopt;
+        if (active != 0u) {
+          std::cout << "Conversions left after all expired: "
+                    << (active ? std::to_string(*active) : "unknown")
+                    << std::endl;
+          ret = EXIT_FAILURE;
+        }
+      }
+      if (csv->is_set() && !write_csv(samples, csv->arg())) {
+        std::cerr << csv->arg() << ": Unable to write samples" << std::endl;
+        ret = EXIT_FAILURE;
+      }
+    } else if (qrwnd > 0) {
+      std::cerr << "qrwnd never painted." << std::endl;
+    }
+  }
+
+  stop(qrwnd);
+  stop(xvfb);
+  unlink(socket_path.c_str());
+  rmdir(dir);
+  return ret;
+}
@@ -0,0 +1,84 @@
+#include "common.hh"
+
+#include "xvfb.hh"
+
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+constexpr auto kStartupTimeout = std::chrono::seconds(10);
+
+}  // namespace
+
+pid_t spawn(std::vector<std::string> const& args, int keep_fd) {
+  auto pid = fork();
+  if (pid != 0)
+    return pid;
+  if (keep_fd >= 0)
+    fcntl(keep_fd, F_SETFD, 0);
+  std::vector<char*> argv;
+  for (auto const& arg : args)
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  argv.push_back(nullptr);
+  execvp(argv[0], argv.data());
+  std::cerr << argv[0] << ": " << strerror(errno) << std::endl;
+  _exit(127);
+}
+
+void stop(pid_t pid) {
+  if (pid <= 0)
+    return;
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+}
+
+pid_t start_xvfb(std::string const& xvfb, std::string* display) {
+  int fd[2];
+  if (pipe2(fd, O_CLOEXEC)) {
+    std::cerr << "pipe: " << strerror(errno) << std::endl;
+    return -1;
+  }
+  auto pid = spawn({ xvfb, "-displayfd", std::to_string(fd[1]),
+                     "-nolisten", "tcp", "-screen", "0", "1024x768x24" },
+                   fd[1]);
+  close(fd[1]);
+  if (pid < 0) {
+    close(fd[0]);
+    return -1;
+  }
+  // Xvfb writes the display number followed by a newline once it's ready.
+  std::string number;
+  auto const deadline = Clock::now() + kStartupTimeout;
+  while (number.empty() || number.back() != '\n') {
+    auto timeout = std::chrono::ceil<std::chrono::milliseconds>(
+        deadline - Clock::now());
+    struct pollfd pfd;
+    pfd.fd = fd[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    char tmp[16];
+    ssize_t got = 0;
+    if (timeout.count() <= 0 || poll(&pfd, 1, timeout.count()) <= 0 ||
+        (got = read(fd[0], tmp, sizeof(tmp))) <= 0) {
+      std::cerr << "Xvfb failed to start." << std::endl;
+      close(fd[0]);
+      stop(pid);
+      return -1;
+    }
+    number.append(tmp, got);
+  }
+  close(fd[0]);
+  number.pop_back();
+  *display = ":" + number;
+  return pid;
+}
@@ -0,0 +1,19 @@
+#ifndef XVFB_HH
+#define XVFB_HH
+
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// Process helpers shared by the harnesses that run qrwnd in Xvfb.
+
+// Returns the pid, or -1 if fork failed. keep_fd is left open in the child.
+pid_t spawn(std::vector<std::string> const& args, int keep_fd = -1);
+
+// Terminates and reaps pid, does nothing if pid isn't positive.
+void stop(pid_t pid);
+
+// Starts Xvfb on the first free display. Returns the pid, or -1 on error.
+pid_t start_xvfb(std::string const& xvfb, std::string* display);
+
+#endif  // XVFB_HH
@@ -0,0 +1,107 @@
+#include "common.hh"
+
+#include "alloc_check.hh"
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+namespace {
+
+std::atomic<uint64_t> g_count;
+thread_local bool t_ignored;
+
+void counted() {
+  if (!t_ignored)
+    g_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void* allocate(size_t size) {
+  counted();
+  return malloc(size ? size : 1);
+}
+
+void* allocate(size_t size, std::align_val_t align) {
+  counted();
+  auto alignment = static_cast<size_t>(align);
+  // aligned_alloc needs size to be a multiple of alignment
+  size = (size + alignment - 1) / alignment * alignment;
+  return aligned_alloc(alignment, size ? size : alignment);
+}
+
+void* allocate_or_abort(void* ptr) {
+  // Built with -fno-exceptions, so no std::bad_alloc
+  if (!ptr)
+    abort();
+  return ptr;
+}
+
+}  // namespace
+
+namespace alloc_check {
+
+uint64_t count() {
+  return g_count.load(std::memory_order_relaxed);
+}
+
+void ignore_thread() {
+  t_ignored = true;
+}
+
+}  // namespace alloc_check
+
+void* operator new(size_t size) {
+  return allocate_or_abort(allocate(size));
+}
+
+void* operator new[](size_t size) {
+  return allocate_or_abort(allocate(size));
+}
+
+void* operator new(size_t size, std::nothrow_t const&) noexcept {
+  return allocate(size);
+}
+
+void* operator new[](size_t size, std::nothrow_t const&) noexcept {
+  return allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+  return allocate_or_abort(allocate(size, align));
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+  return allocate_or_abort(allocate(size, align));
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+  free(ptr);
+}
@@ -0,0 +1,21 @@
+#ifndef ALLOC_CHECK_HH
+#define ALLOC_CHECK_HH
+
+#include <stdint.h>
+
+// Only available when built with the alloc_check option, which replaces the
+// global operator new with one that counts allocations. Only C++ heap
+// allocations are seen, malloc() by libc, libxcb or libqrencode is not.
+
+namespace alloc_check {
+
+// Number of calls to operator new so far, by threads not ignored.
+uint64_t count();
+
+// Allocations by the calling thread aren't counted from now on. For
+// threads with nothing to do with selection changes, like the stats one.
+void ignore_thread();
+
+}  // namespace alloc_check
+
+#endif  // ALLOC_CHECK_HH
@@ -0,0 +1,821 @@
+#include "common.hh"
+
+#ifdef QRWND_ALLOC_CHECK
+#include "alloc_check.hh"
+#endif
+#include "controller.hh"
+#include "event_source.hh"
+#include "fountain.hh"
+#include "probes.hh"
+#include "qr_capacity.hh"
+#include "qr_encode.hh"
+#include "render.hh"
+#include "roundtrip.hh"
+#include "shared_cache.hh"
+#include "snapshot.hh"
+#include "stats.hh"
+#include "trace.hh"
+#include "url_extract.hh"
+#include "url_rewrite.hh"
+
+#include <algorithm>
+#include <errno.h>
+#include <iostream>
+#include <limits>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <xcb/xcb_event.h>
+#include <xcb/xfixes.h>
+
+namespace {
+
+// Capacity of a version 40 code, rounded up.
+constexpr size_t kPreallocatedData = 4096;
+
+#ifdef QRWND_ALLOC_CHECK
+// Selection changes allowed to allocate while caches and pools fill up.
+constexpr uint64_t kAllocCheckWarmup = 3;
+#endif
+
+constexpr xcb_atom_t kSelection = XCB_ATOM_PRIMARY;
+
+// Most URLs shown at once when the selection contains several.
+constexpr size_t kMaxGridCodes = 16;
+// Must fit all codes shown at once.
+constexpr size_t kCodeCacheSize = 32;
+static_assert(kCodeCacheSize >= kMaxGridCodes);
+// Damaged rectangles tracked before repainting everything instead.
+constexpr size_t kMaxDamage = 8;
+
+// Content too large for one code, shown as a sequence of fountain coded
+// frames.
+struct Stream {
+  std::unique_ptr<FountainEncoder> encoder;
+  std::vector<uint8_t> frame;
+  uint32_t seq;
+  uint64_t frames;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point next_frame;
+};
+
+// A code from the encoder or the shared cache, valid until the next
+// encode.
+struct Code {
+  int version;
+  int width;
+  uint8_t const* modules;
+};
+
+void print_stream_stats(Stream const& stream,
+                        std::chrono::steady_clock::time_point now,
+                        std::ostream& out) {
+  std::chrono::duration<double> elapsed = now - stream.start;
+  auto bytes = stream.frames * stream.encoder->block_size();
+  out << "Streamed " << stream.frames << " frames in " << elapsed.count()
+      << " s, " << stream.frames / elapsed.count() << " fps, "
+      << bytes / elapsed.count() << " bytes/s" << std::endl;
+}
+
+class ControllerImpl : public Controller {
+public:
+  ControllerImpl(EventSource* source, Window const& window,
+                 Atoms const& atoms, Options const& options, Canvas* canvas,
+                 Stats* stats, UrlRewriter* rewriter, Snapshot* snapshot,
+                 SharedCache* shared_cache, std::ostream* debug)
+    : source_(source), wnd_(window), atoms_(atoms), options_(options),
+      canvas_(canvas), stats_(stats), rewriter_(rewriter),
+      snapshot_(snapshot), shared_cache_(shared_cache),
+      dbg_(debug ? debug->rdbuf() : nullptr),
+      frame_interval_(std::chrono::duration_cast<
+                      std::chrono::steady_clock::duration>(
+                          std::chrono::seconds(1)) / options.fps),
+      request_type_(atoms.utf8_string),
+      incr_reader_(kPreallocatedData),
+      code_cache_(kCodeCacheSize) {
+    active_request_.set_properties(atoms_.target_property);
+    // Preallocate room for anything that fits in a code, so that the
+    // buffers doesn't have to grow for each selection change.
+    current_data_.reserve(kPreallocatedData);
+    encode_data_.reserve(kPreallocatedData);
+    urls_.reserve(kMaxGridCodes);
+    grid_.reserve(kMaxGridCodes);
+    damage_.reserve(kMaxDamage);
+    if (shared_cache_)
+      shared_modules_.resize(SharedCache::kMaxModules);
+
+    if (snapshot_ && snapshot_->valid()) {
+      // Show the last code until we know what the selection contains.
+      current_ = rasterize(surface_pool_, snapshot_->width(),
+                           snapshot_->data());
+      current_hash_ = snapshot_->payload_hash();
+    }
+  }
+
+  void run() override {
+    bool flush = false;
+    bool const viewable = mapped_ && !obscured_ && !hidden_;
+    if (viewable && selection_dirty_) {
+#ifdef QRWND_ALLOC_CHECK
+      if (!alloc_check_pending_) {
+        alloc_check_pending_ = true;
+        alloc_check_start_ = alloc_check::count();
+      }
+#endif
+      selection_dirty_ = false;
+      request_queued_ = true;
+      request_time_ = dirty_time_;
+      request_type_ = atoms_.utf8_string;
+    }
+
+    if (request_queued_) {
+      // Remove all expired busy_target_properties
+      auto now = source_->now();
+      if (auto expired = active_request_.expire(now)) {
+        stats_->conversion_timeouts += expired;
+#ifndef NDEBUG
+        dbg_ << "Old request timed out" << std::endl;
+#endif
+      }
+      if (!active_request_.full()) {
+#ifndef NDEBUG
+        dbg_ << "Start queued request " << request_type_ << " "
+             << request_time_ << std::endl;
+#endif
+        request_queued_ = false;
+        auto target = active_request_.acquire(now + std::chrono::seconds(10));
+        source_->convert_selection(wnd_.id, kSelection, request_type_,
+                                   target, request_time_);
+        QRWND_PROBE3(convert_selection_issued, target, request_type_,
+                     request_time_);
+        ++stats_->conversions;
+        request_stalled_ = false;
+        flush = true;
+      } else {
+        if (!request_stalled_) {
+          request_stalled_ = true;
+          ++stats_->stalls;
+        }
+#ifndef NDEBUG
+        dbg_ << "All properties are already waiting" << std::endl;
+#endif
+      }
+    }
+
+    if (read_property_)
+      read_property();
+
+    if (update_code_ && viewable)
+      update_code();
+
+    if (stream_.encoder && viewable &&
+        source_->now() >= stream_.next_frame)
+      next_frame();
+
+    if ((damage_all_ || !damage_.empty()) && viewable) {
+      if (damage_all_) {
+        damage_all_ = false;
+        damage_.assign(1, { 0, 0, wnd_.width, wnd_.height });
+        if (current_) {
+          layout_ = layout_code(image_width(current_),
+                                wnd_.width, wnd_.height);
+        }
+      }
+      {
+        auto start = trace::now_ns();
+        uint64_t pixels = 0;
+        for (auto const& rect : damage_) {
+          QRWND_PROBE4(paint_start, rect.x, rect.y, rect.width, rect.height);
+          if (grid_.empty()) {
+            paint(canvas_, current_, layout_, rect, wnd_.width, wnd_.height);
+          } else {
+            paint_grid(canvas_, grid_.data(), grid_.size(), rect, wnd_.width,
+                       wnd_.height);
+          }
+          QRWND_PROBE4(paint_end, rect.x, rect.y, rect.width, rect.height);
+          pixels += static_cast<uint64_t>(rect.width) * rect.height;
+        }
+        flush_canvas(canvas_);
+        auto duration = trace::now_ns() - start;
+        trace::record("paint", start, duration, pixels);
+        stats_->paint_ns.record(duration);
+        if (resizing_) {
+          ++stats_->resize_paints;
+          stats_->resize_paint_pixels.record(pixels);
+        }
+        damage_.clear();
+      }
+      if (options_.paint_trace) {
+        // Sent after the paint requests, so once anyone sees the property
+        // change the server has drawn the code.
+        uint64_t const hash = shown_hash();
+        uint32_t const value[2] = {
+          static_cast<uint32_t>(hash >> 32),
+          static_cast<uint32_t>(hash),
+        };
+        source_->change_property(XCB_PROP_MODE_REPLACE, wnd_.root,
+                                 atoms_.qrwnd_paint, XCB_ATOM_CARDINAL, 32,
+                                 2, value);
+      }
+      painted_ = true;
+      flush = true;
+    }
+
+    stats_->active_requests.store(active_request_.size(),
+                                  std::memory_order_relaxed);
+
+    if (flush) {
+      trace::Span span("flush");
+      source_->flush();
+    }
+
+#ifdef QRWND_ALLOC_CHECK
+    // The selection change is done when there is nothing left to do for it.
+    if (alloc_check_pending_ && !request_queued_ && !read_property_ &&
+        !incr_reader_.active() && !update_code_ && !damage_all_ &&
+        damage_.empty() &&
+        active_request_.size() == 0) {
+      alloc_check_pending_ = false;
+      auto allocations = alloc_check::count() - alloc_check_start_;
+      if (++alloc_check_changes_ > kAllocCheckWarmup && allocations > 0) {
+        std::cerr << "Selection change " << alloc_check_changes_ << " made "
+                  << allocations << " C++ heap allocations." << std::endl;
+        abort();
+      }
+    }
+#endif
+  }
+
+  bool handle(xcb_generic_event_t const* event) override {
+    auto response_type = XCB_EVENT_RESPONSE_TYPE(event);
+    if (response_type == XCB_SELECTION_NOTIFY) {
+      auto* e = reinterpret_cast<xcb_selection_notify_event_t const*>(event);
+      if (e->selection == kSelection && e->requestor == wnd_.id &&
+          e->time == request_time_) {
+#ifndef NDEBUG
+        dbg_ << "Selection Notify " << e->time << std::endl;
+#endif
+        QRWND_PROBE2(convert_selection_answered, e->property, e->target);
+        auto* request = active_request_.find(e->property);
+        if (request) {
+          auto now = trace::now_ns();
+          trace::record("convert-selection", request->sent_ns,
+                        now - request->sent_ns, active_request_.size());
+          stats_->conversion_ns.record(now - request->sent_ns);
+          if (request->property_notify) {
+            // Already handled by XCB_PROPERTY_NOTIFY
+          } else {
+            assert(!read_property_);
+            read_property_ = e->property;
+            property_wnd_ = e->requestor;
+          }
+          active_request_.release(request);
+        } else if (e->property) {
+          assert(!read_property_);
+          read_property_ = e->property;
+          property_wnd_ = e->requestor;
+        } else {
+          // Target format not supported, try with STRING if using UTF8_STRING
+#ifndef NDEBUG
+          dbg_ << "Format not supported (tried " << e->target << ")"
+               << std::endl;
+#endif
+          if (e->target == atoms_.utf8_string) {
+            request_queued_ = true;
+            request_time_ = e->time;
+            request_type_ = XCB_ATOM_STRING;
+          }
+        }
+      }
+      return true;
+    } else if (response_type == XCB_PROPERTY_NOTIFY) {
+      auto* e = reinterpret_cast<xcb_property_notify_event_t const*>(event);
+#ifndef NDEBUG
+      dbg_ << "Property Notify " << static_cast<int>(e->state)
+           << " " << e->time << std::endl;
+#endif
+      if (e->window == wnd_.id && incr_reader_.active() &&
+          e->atom == incr_reader_.property()) {
+        if (e->state == XCB_PROPERTY_NEW_VALUE)
+          read_incr_chunk();
+      } else if (e->window == wnd_.id && e->atom == atoms_.net_wm_state) {
+        hidden_ = false;
+        if (e->state == XCB_PROPERTY_NEW_VALUE) {
+          auto reply = source_->get_property(
+              false, wnd_.id, atoms_.net_wm_state, XCB_ATOM_ATOM,
+              std::numeric_limits<uint32_t>::max() / 4, nullptr);
+          if (reply && reply->format == 32) {
+            auto* state = reinterpret_cast<xcb_atom_t*>(
+                xcb_get_property_value(reply.get()));
+            auto count = xcb_get_property_value_length(reply.get()) / 4;
+            hidden_ = std::find(state, state + count,
+                                atoms_.net_wm_state_hidden) != state + count;
+          }
+        }
+#ifndef NDEBUG
+        dbg_ << "Hidden " << hidden_ << std::endl;
+#endif
+      } else if (e->window == wnd_.id &&
+                 e->state == XCB_PROPERTY_NEW_VALUE) {
+        auto* request = active_request_.find(e->atom);
+        if (request) {
+          // Some clients never reply with a SelectionNotify but they do
+          // update the property. So read it as soon as it changes.
+          assert(!read_property_);
+          read_property_ = e->atom;
+          property_wnd_ = e->window;
+          request->property_notify = true;
+        }
+      }
+      return true;
+    } else if (response_type ==
+               atoms_.xfixes_first_event + XCB_XFIXES_SELECTION_NOTIFY) {
+      auto* e = reinterpret_cast<xcb_xfixes_selection_notify_event_t const*>(
+          event);
+      if (e->selection == kSelection) {
+#ifndef NDEBUG
+        dbg_ << "Xfixes selection notify" << std::endl;
+#endif
+        QRWND_PROBE2(selection_owner_change, e->owner, e->timestamp);
+        ++stats_->selection_changes;
+        selection_dirty_ = true;
+        dirty_time_ = e->timestamp;
+      }
+      return true;
+    } else if (response_type == XCB_EXPOSE) {
+      auto* e = reinterpret_cast<xcb_expose_event_t const*>(event);
+      if (e->window == wnd_.id)
+        invalidate({ static_cast<int16_t>(e->x), static_cast<int16_t>(e->y),
+                     e->width, e->height });
+      return true;
+    } else if (response_type == XCB_CONFIGURE_NOTIFY) {
+      auto* e = reinterpret_cast<xcb_configure_notify_event_t const*>(event);
+      if (e->window == wnd_.id &&
+          (e->width != wnd_.width || e->height != wnd_.height)) {
+        resize(e->width, e->height);
+      }
+      return true;
+    } else if (response_type == XCB_REPARENT_NOTIFY) {
+      // Ignored, part of XCB_EVENT_MASK_STRUCTURE_NOTIFY
+      return true;
+    } else if (response_type == XCB_MAP_NOTIFY) {
+      auto* e = reinterpret_cast<xcb_map_notify_event_t const*>(event);
+      if (e->window == wnd_.id)
+        mapped_ = true;
+      return true;
+    } else if (response_type == XCB_UNMAP_NOTIFY) {
+      auto* e = reinterpret_cast<xcb_unmap_notify_event_t const*>(event);
+      if (e->window == wnd_.id)
+        mapped_ = false;
+      return true;
+    } else if (response_type == XCB_VISIBILITY_NOTIFY) {
+      auto* e = reinterpret_cast<xcb_visibility_notify_event_t const*>(event);
+      if (e->window == wnd_.id) {
+        obscured_ = e->state == XCB_VISIBILITY_FULLY_OBSCURED;
+#ifndef NDEBUG
+        dbg_ << "Obscured " << obscured_ << std::endl;
+#endif
+      }
+      return true;
+    }
+    return false;
+  }
+
+  void refresh(xcb_timestamp_t time) override {
+    selection_dirty_ = true;
+    dirty_time_ = time;
+  }
+
+  std::optional<std::chrono::steady_clock::time_point>
+  wakeup() const override {
+    if (stream_.encoder && mapped_ && !obscured_ && !hidden_)
+      return stream_.next_frame;
+    return std::nullopt;
+  }
+
+  bool painted() const override {
+    return painted_;
+  }
+
+  uint64_t shown_hash() const override {
+    return (current_ || !grid_.empty()) && !stream_.encoder ? current_hash_
+      : 0;
+  }
+
+  void print_stats(std::ostream& out) const override {
+    if (stream_.encoder)
+      print_stream_stats(stream_, source_->now(), out);
+    if (code_cache_.hits() || code_cache_.misses()) {
+      out << "Code cache: " << code_cache_.hits() << " hits, "
+          << code_cache_.misses() << " misses" << std::endl;
+    }
+    if (shared_cache_) {
+      out << "Shared cache, all instances: " << shared_cache_->total_hits()
+          << " hits, " << shared_cache_->total_misses() << " misses"
+          << std::endl;
+    }
+  }
+
+private:
+  void read_property() {
+    trace::Span span("property-read");
+    roundtrip::Scope scope(roundtrip::Op::SELECTION_CHANGE);
+    xcb_generic_error_t* err = nullptr;
+    auto reply = source_->get_property(
+        true, property_wnd_, read_property_, XCB_GET_PROPERTY_TYPE_ANY,
+        std::numeric_limits<uint32_t>::max() / 4, &err);
+    if (reply) {
+      if (reply->type == atoms_.utf8_string ||
+          reply->type == XCB_ATOM_STRING) {
+        std::string_view data(
+            reinterpret_cast<char*>(xcb_get_property_value(reply.get())),
+            xcb_get_property_value_length(reply.get()));
+        span.set_arg(data.size());
+        QRWND_PROBE2(property_read, read_property_, data.size());
+        stats_->property_bytes.record(data.size());
+        if (data != current_data_) {
+          current_data_ = data;
+          update_code_ = true;
+        }
+      } else if (reply->type == atoms_.incr) {
+        auto len = xcb_get_property_value_length(reply.get());
+#ifndef NDEBUG
+        dbg_ << "INCR " << read_property_ << " " << len << std::endl;
+#endif
+        size_t size = 0;
+        if (len == 4) {
+          size = *reinterpret_cast<uint32_t*>(
+              xcb_get_property_value(reply.get()));
+        }
+        QRWND_PROBE2(incr_start, read_property_, size);
+        incr_reader_.start(read_property_, size);
+      } else {
+        std::cerr << "Unsupported selection property type: "
+                  << reply->type << std::endl;
+      }
+    } else if (err) {
+      std::cerr << "Error getting property: " <<
+        xcb_event_get_error_label(err->error_code) << std::endl;
+      free(err);
+    }
+    read_property_ = XCB_NONE;
+  }
+
+  void read_incr_chunk() {
+    trace::Span span("incr-chunk");
+    roundtrip::Scope scope(roundtrip::Op::INCR_CHUNK);
+    xcb_generic_error_t* err = nullptr;
+    auto reply = source_->get_property(
+        true, wnd_.id, incr_reader_.property(), XCB_GET_PROPERTY_TYPE_ANY,
+        std::numeric_limits<uint32_t>::max() / 4, &err);
+    if (reply) {
+      auto len = xcb_get_property_value_length(reply.get());
+      span.set_arg(len);
+      QRWND_PROBE2(property_read, incr_reader_.property(), len);
+      stats_->property_bytes.record(len);
+#ifndef NDEBUG
+      dbg_ << "Incr got " << len << std::endl;
+#endif
+      if (len == 0) {
+        QRWND_PROBE2(incr_end, incr_reader_.property(), incr_reader_.size());
+        ++stats_->incr_transfers;
+        stats_->incr_chunks.record(incr_reader_.chunks());
+        if (incr_reader_.finish(current_data_))
+          update_code_ = true;
+      } else {
+        if (reply->type == atoms_.utf8_string ||
+            reply->type == XCB_ATOM_STRING) {
+          incr_reader_.append(std::string_view(
+              reinterpret_cast<char*>(
+                  xcb_get_property_value(reply.get())), len));
+        } else {
+          std::cerr << "Unsupported property notify type: "
+                    << reply->type << std::endl;
+          // Even if we don't understand the type we need to continue
+          // to delete the property or the owner will hang waiting for
+          // us.
+        }
+      }
+    } else if (err) {
+      std::cerr << "Error getting property: " <<
+        xcb_event_get_error_label(err->error_code) << std::endl;
+      free(err);
+    }
+  }
+
+  void update_code() {
+#ifndef NDEBUG
+    dbg_ << "Update code " << current_data_ << std::endl;
+#endif
+    update_code_ = false;
+    if (stream_.encoder) {
+      print_stream_stats(stream_, source_->now(), std::cerr);
+      stream_.encoder.reset();
+      current_ = nullptr;
+    }
+    grid_.clear();
+    urls_.clear();
+    bool is_url = looks_like_url(current_data_);
+    if (!options_.everything && !is_url)
+      extract_urls(current_data_, kMaxGridCodes, &urls_);
+    if (urls_.size() > 1) {
+      show_grid();
+    } else if (options_.everything || is_url || !urls_.empty()) {
+      if (urls_.empty()) {
+        encode_data_ = current_data_;
+      } else {
+        encode_data_ = urls_.front();
+        is_url = true;
+      }
+      if (is_url && rewriter_ && rewriter_->rewrite(encode_data_)) {
+#ifndef NDEBUG
+        dbg_ << "Rewritten to " << encode_data_ << std::endl;
+#endif
+      }
+      if (options_.stream &&
+          encode_data_.size() > qr_capacity_8bit(kQRMaxVersion)) {
+        start_stream();
+      } else {
+        auto hash = Snapshot::hash(encode_data_);
+        // No need to encode if already showing the code, most likely
+        // restored from the snapshot.
+        if (!current_ || hash != current_hash_) {
+          Code code;
+          if (encode(hash, &code)) {
+            {
+              trace::Span span("rasterize", code.version);
+              current_ = rasterize(surface_pool_, code.width, code.modules);
+            }
+            current_hash_ = hash;
+            if (snapshot_) {
+              snapshot_->store(hash, encode_data_.size(), code.version,
+                               code.width, code.modules);
+            }
+          } else {
+            std::cerr << "Failed to generate QR code: "
+                      << strerror(errno) << std::endl;
+            current_ = nullptr;
+          }
+        }
+      }
+    } else {
+      current_ = nullptr;
+    }
+
+    invalidate_all();
+  }
+
+  // Shows all of urls_, reusing codes from the cache when possible.
+  void show_grid() {
+    current_ = nullptr;
+    // Combined hash of all shown payloads, in order.
+    uint64_t grid_hash = 0;
+    for (auto url : urls_) {
+      encode_data_ = url;
+      if (rewriter_)
+        rewriter_->rewrite(encode_data_);
+      auto hash = Snapshot::hash(encode_data_);
+      auto* image = code_cache_.find(hash);
+      Code code;
+      if (!image && encode(hash, &code)) {
+        trace::Span span("rasterize", code.version);
+        image = code_cache_.insert(hash, code.width, code.modules);
+      }
+      if (image) {
+        grid_.push_back(image);
+        grid_hash = (grid_hash ^ hash) * 0x100000001b3ull;
+      }
+    }
+    current_hash_ = grid_hash;
+  }
+
+  void invalidate(xcb_rectangle_t const& rect) {
+    if (damage_all_ || rect.width == 0 || rect.height == 0)
+      return;
+    if (damage_.size() == kMaxDamage) {
+      invalidate_all();
+      return;
+    }
+    damage_.push_back(rect);
+  }
+
+  // Content changed, not just the window size.
+  void invalidate_all() {
+    damage_all_ = true;
+    damage_.clear();
+    resizing_ = false;
+  }
+
+  // The window has background None and center bit gravity so the server
+  // keeps what was painted, moved to stay centered, and only sends Expose
+  // for the newly exposed borders. The code stays where the server moved
+  // it, up to a pixel off center, unless the power-of-two scale changed or
+  // it no longer fits; only then is the code area repainted.
+  void resize(uint16_t width, uint16_t height) {
+    ++stats_->resizes;
+    resizing_ = true;
+    // Same rounding as the server's bit gravity.
+    int const dx = (static_cast<int>(width) - wnd_.width) / 2;
+    int const dy = (static_cast<int>(height) - wnd_.height) / 2;
+    wnd_.width = width;
+    wnd_.height = height;
+    if (damage_all_)
+      return;
+    if (!grid_.empty() || stream_.encoder) {
+      invalidate_all();
+      resizing_ = true;
+      return;
+    }
+    // Pending damage moved with the content.
+    for (auto& rect : damage_) {
+      rect.x += dx;
+      rect.y += dy;
+    }
+    if (!current_)
+      return;
+    auto moved = layout_;
+    moved.x += dx;
+    moved.y += dy;
+    auto centered = layout_code(image_width(current_),
+                                width, height);
+    if (moved.scale == centered.scale && abs(moved.x - centered.x) <= 1 &&
+        abs(moved.y - centered.y) <= 1 && moved.x >= 0 && moved.y >= 0 &&
+        moved.x + moved.size <= width && moved.y + moved.size <= height) {
+      layout_ = moved;
+    } else {
+      layout_ = centered;
+      invalidate(as_rect(moved));
+      invalidate(as_rect(layout_));
+    }
+  }
+
+  static xcb_rectangle_t as_rect(CodeLayout const& layout) {
+    return { static_cast<int16_t>(layout.x), static_cast<int16_t>(layout.y),
+             static_cast<uint16_t>(layout.size),
+             static_cast<uint16_t>(layout.size) };
+  }
+
+  // Encodes encode_data_, unless another instance already did and it's in
+  // the shared cache. Returns false and sets errno on error.
+  bool encode(uint64_t hash, Code* code) {
+    if (shared_cache_) {
+      trace::Span span("shared-cache", encode_data_.size());
+      if (shared_cache_->find(hash, encode_data_, &code->version,
+                              &code->width, shared_modules_.data())) {
+        ++stats_->shared_cache_hits;
+        QRWND_PROBE2(shared_cache_hit, encode_data_.size(), code->version);
+        code->modules = shared_modules_.data();
+        return true;
+      }
+      ++stats_->shared_cache_misses;
+    }
+    auto start = trace::now_ns();
+    QRWND_PROBE1(encode_start, encode_data_.size());
+    qrcode_ = qr_encode(encode_data_);
+    QRWND_PROBE2(encode_end, encode_data_.size(),
+                 qrcode_ ? qrcode_->version : 0);
+    record_encode(start, encode_data_.size(), qrcode_.get());
+    if (!qrcode_)
+      return false;
+    *code = { qrcode_->version, qrcode_->width, qrcode_->data };
+    if (shared_cache_) {
+      shared_cache_->store(hash, encode_data_, code->version, code->width,
+                           code->modules);
+    }
+    return true;
+  }
+
+  void record_encode(uint64_t start, size_t size, QRcode const* qrcode) {
+    auto duration = trace::now_ns() - start;
+    trace::record("encode", start, duration, size);
+    if (qrcode)
+      stats_->encode_ns[qrcode->version - 1].record(duration);
+  }
+
+  void start_stream() {
+    stream_.encoder = FountainEncoder::create(
+        encode_data_, qr_capacity_8bit(options_.frame_version));
+    if (stream_.encoder) {
+      stream_.frame.resize(stream_.encoder->frame_size());
+      stream_.seq = 0;
+      stream_.frames = 0;
+      stream_.start = source_->now();
+      stream_.next_frame = stream_.start;
+      std::cerr << "Streaming " << encode_data_.size() << " bytes as "
+                << stream_.encoder->blocks() << " blocks of "
+                << stream_.encoder->block_size() << " bytes, version "
+                << options_.frame_version << " at " << options_.fps
+                << " fps, " << stream_.encoder->block_size() * options_.fps
+                << " bytes/s" << std::endl;
+    } else {
+      std::cerr << "Too much data to stream: " << encode_data_.size()
+                << " bytes" << std::endl;
+    }
+    current_ = nullptr;
+  }
+
+  void next_frame() {
+    auto start = trace::now_ns();
+    QRWND_PROBE1(encode_start, stream_.frame.size());
+    stream_.encoder->frame(stream_.seq++, stream_.frame.data());
+    auto qrcode = qr_encode(stream_.frame.data(), stream_.frame.size(),
+                            options_.frame_version);
+    QRWND_PROBE2(encode_end, stream_.frame.size(),
+                 qrcode ? qrcode->version : 0);
+    record_encode(start, stream_.frame.size(), qrcode.get());
+    if (qrcode) {
+      trace::Span span("rasterize", qrcode->version);
+      current_ = rasterize(surface_pool_, qrcode->width, qrcode->data);
+      ++stream_.frames;
+    } else {
+      std::cerr << "Failed to generate QR code frame: "
+                << strerror(errno) << std::endl;
+    }
+    stream_.next_frame += frame_interval_;
+    auto now = source_->now();
+    if (stream_.next_frame < now) {
+      // Running behind, skip instead of trying to catch up
+      stream_.next_frame = now + frame_interval_;
+    }
+    invalidate_all();
+  }
+
+  EventSource* const source_;
+  Window wnd_;
+  Atoms const atoms_;
+  Options const options_;
+  Canvas* const canvas_;
+  Stats* const stats_;
+  UrlRewriter* const rewriter_;
+  Snapshot* const snapshot_;
+  SharedCache* const shared_cache_;
+  // Has no buffer, so writes nothing, without a debug stream.
+  std::ostream dbg_;
+  std::chrono::steady_clock::duration const frame_interval_;
+
+  // Nothing is fetched, encoded or painted while the window isn't viewable,
+  // selection changes only mark the selection as dirty.
+  bool mapped_ = false;
+  bool obscured_ = false;
+  bool hidden_ = false;
+  bool selection_dirty_ = true;
+  xcb_timestamp_t dirty_time_ = XCB_CURRENT_TIME;
+
+  bool request_queued_ = false;
+  // Counted once per queued request in Stats::stalls.
+  bool request_stalled_ = false;
+  xcb_timestamp_t request_time_ = XCB_CURRENT_TIME;
+  xcb_atom_t request_type_;
+  RequestTable active_request_;
+
+  xcb_window_t property_wnd_ = XCB_NONE;
+  xcb_atom_t read_property_ = XCB_NONE;
+
+  bool update_code_ = false;
+  std::string current_data_;
+  std::string encode_data_;
+  // The last code from encode(), whichever of these it came from.
+  unique_qrcode qrcode_;
+  std::vector<uint8_t> shared_modules_;
+  IncrReader incr_reader_;
+  SurfacePool surface_pool_;
+  CodeImage* current_ = nullptr;
+  // Snapshot::hash() of the payload encoded in current_, or the combined
+  // hash of all codes in grid_, if any.
+  uint64_t current_hash_ = 0;
+  // URLs found in a selection that isn't one, pointing into current_data_.
+  std::vector<std::string_view> urls_;
+  CodeCache code_cache_;
+  // Owned by code_cache_, shown instead of current_ when not empty.
+  std::vector<CodeImage*> grid_;
+  Stream stream_;
+
+  // Everything needs repainting, damage_ is empty.
+  bool damage_all_ = true;
+  // In window coordinates, never more than kMaxDamage.
+  std::vector<xcb_rectangle_t> damage_;
+  // Where current_ is painted, moved along on resize.
+  CodeLayout layout_{};
+  // No content change since the last resize, paints are counted as
+  // resize repaints.
+  bool resizing_ = false;
+  bool painted_ = false;
+
+#ifdef QRWND_ALLOC_CHECK
+  bool alloc_check_pending_ = false;
+  uint64_t alloc_check_start_ = 0;
+  uint64_t alloc_check_changes_ = 0;
+#endif
+};
+
+}  // namespace
+
+std::unique_ptr<Controller> Controller::create(
+    EventSource* source, Window const& window, Atoms const& atoms,
+    Options const& options, Canvas* canvas, Stats* stats,
+    UrlRewriter* rewriter, Snapshot* snapshot, SharedCache* shared_cache,
+    std::ostream* debug) {
+  return std::make_unique<ControllerImpl>(source, window, atoms, options,
+                                          canvas, stats, rewriter, snapshot,
+                                          shared_cache, debug);
+}
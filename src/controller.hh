@@ -0,0 +1,97 @@
+#ifndef CONTROLLER_HH
+#define CONTROLLER_HH
+
+#include "selection.hh"
+
+#include <array>
+#include <chrono>
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <stdint.h>
+#include <xcb/xproto.h>
+
+struct Canvas;
+class EventSource;
+class SharedCache;
+class Snapshot;
+struct Stats;
+class UrlRewriter;
+
+// Everything qrwnd does in response to events: tracking the selection,
+// fetching its content, encoding and painting the code. Only talks to the
+// X server through EventSource, so it can be driven by a recording.
+class Controller {
+public:
+  struct Window {
+    xcb_window_t id;
+    xcb_window_t root;
+    uint16_t width;
+    uint16_t height;
+  };
+
+  // For Atoms::xfixes_first_event when XFixes isn't used. No event
+  // response type, with the sent bit masked off, matches it.
+  static constexpr uint8_t kNoXFixes = 0x80;
+
+  struct Atoms {
+    xcb_atom_t utf8_string;
+    xcb_atom_t incr;
+    xcb_atom_t net_wm_state;
+    xcb_atom_t net_wm_state_hidden;
+    xcb_atom_t qrwnd_paint;
+    std::array<xcb_atom_t, kTargetProperties> target_property;
+    uint8_t xfixes_first_event;
+  };
+
+  struct Options {
+    bool everything;
+    bool stream;
+    bool paint_trace;
+    int32_t fps;
+    int32_t frame_version;
+  };
+
+  virtual ~Controller() = default;
+
+  // canvas paints the window, the caller keeps its size in sync with
+  // ConfigureNotify. Counters and histograms are added to stats, which
+  // must outlive the controller. Codes are looked up in shared_cache
+  // before encoding them. rewriter, snapshot, shared_cache and debug may be
+  // null.
+  static std::unique_ptr<Controller> create(
+      EventSource* source, Window const& window, Atoms const& atoms,
+      Options const& options, Canvas* canvas, Stats* stats,
+      UrlRewriter* rewriter, Snapshot* snapshot, SharedCache* shared_cache,
+      std::ostream* debug);
+
+  // Does all pending work, then flushes. Call before each wait for the
+  // next event.
+  virtual void run() = 0;
+
+  // Returns false if the event isn't one the controller handles.
+  virtual bool handle(xcb_generic_event_t const* event) = 0;
+
+  // Fetches the selection again, as if its owner changed at time, once the
+  // window is viewable. For when selection changes aren't monitored.
+  virtual void refresh(xcb_timestamp_t time) = 0;
+
+  // Time when run() needs to be called even if no event arrives, if any.
+  virtual std::optional<std::chrono::steady_clock::time_point>
+  wakeup() const = 0;
+
+  // True once the window has been painted the first time.
+  virtual bool painted() const = 0;
+
+  // Snapshot::hash() of the content of the shown code, zero if none.
+  virtual uint64_t shown_hash() const = 0;
+
+  virtual void print_stats(std::ostream& out) const = 0;
+
+protected:
+  Controller() = default;
+  Controller(Controller const&) = delete;
+  Controller& operator=(Controller const&) = delete;
+};
+
+#endif  // CONTROLLER_HH
@@ -0,0 +1,274 @@
+#include "common.hh"
+
+#include "event_record.hh"
+#include "roundtrip.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+constexpr char kMagic[8] = { 'Q', 'R', 'W', 'N', 'D', 'R', 'C', '1' };
+
+static_assert(std::is_trivially_copyable_v<RecordHeader>);
+
+struct FileHeader {
+  char magic[8];
+  RecordHeader header;
+};
+
+enum class Type : uint8_t {
+  // An event returned by next_event().
+  EVENT = 1,
+  // next_event() returned nullptr.
+  TIMEOUT = 2,
+  // A reply returned by get_property().
+  REPLY = 3,
+  // get_property() returned nullptr, with the error if there was one.
+  ERROR = 4,
+};
+
+struct Entry {
+  // Since the recording started.
+  int64_t time_ns;
+  uint32_t size;
+  Type type;
+  uint8_t reserved[3];
+};
+
+class EventRecorderImpl : public EventSource {
+public:
+  EventRecorderImpl(std::unique_ptr<EventSource> source, std::ofstream out)
+    : source_(std::move(source)), out_(std::move(out)),
+      start_(source_->now()) {}
+
+  Clock::time_point now() override {
+    return source_->now();
+  }
+
+  xcb::generic_event next_event(
+      std::optional<Clock::time_point> deadline) override {
+    auto event = source_->next_event(deadline);
+    if (event) {
+      // Only the fixed part, extensions with longer events aren't used.
+      write(Type::EVENT, event.get(), 32);
+    } else {
+      write(Type::TIMEOUT, nullptr, 0);
+    }
+    return event;
+  }
+
+  xcb::reply<xcb_get_property_reply_t> get_property(
+      bool del, xcb_window_t window, xcb_atom_t property, xcb_atom_t type,
+      uint32_t long_length, xcb_generic_error_t** err) override {
+    auto reply = source_->get_property(del, window, property, type,
+                                       long_length, err);
+    if (reply) {
+      write(Type::REPLY, reply.get(), 32 + reply->length * 4);
+    } else if (err && *err) {
+      write(Type::ERROR, *err, sizeof(xcb_generic_error_t));
+    } else {
+      write(Type::ERROR, nullptr, 0);
+    }
+    return reply;
+  }
+
+  void convert_selection(xcb_window_t requestor, xcb_atom_t selection,
+                         xcb_atom_t target, xcb_atom_t property,
+                         xcb_timestamp_t time) override {
+    source_->convert_selection(requestor, selection, target, property, time);
+  }
+
+  void change_property(uint8_t mode, xcb_window_t window,
+                       xcb_atom_t property, xcb_atom_t type, uint8_t format,
+                       uint32_t data_len, void const* data) override {
+    source_->change_property(mode, window, property, type, format, data_len,
+                             data);
+  }
+
+  void flush() override {
+    source_->flush();
+  }
+
+private:
+  void write(Type type, void const* data, uint32_t size) {
+    Entry entry;
+    entry.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        source_->now() - start_).count();
+    entry.size = size;
+    entry.type = type;
+    memset(entry.reserved, 0, sizeof(entry.reserved));
+    out_.write(reinterpret_cast<char const*>(&entry), sizeof(entry));
+    if (size)
+      out_.write(reinterpret_cast<char const*>(data), size);
+  }
+
+  std::unique_ptr<EventSource> const source_;
+  std::ofstream out_;
+  Clock::time_point const start_;
+};
+
+class EventReplayerImpl : public EventReplayer {
+public:
+  EventReplayerImpl(std::vector<char> data, bool original_timing)
+    : data_(std::move(data)), original_timing_(original_timing),
+      pos_(sizeof(FileHeader)), start_(Clock::now()), now_(start_) {
+    memcpy(&header_, data_.data(), sizeof(FileHeader));
+  }
+
+  Clock::time_point now() override {
+    return now_;
+  }
+
+  xcb::generic_event next_event(
+      std::optional<Clock::time_point> deadline) override {
+    Entry entry;
+    char const* data = next(&entry);
+    if (!data)
+      return nullptr;
+    if (entry.type == Type::EVENT) {
+      // xcb allocates room for full_sequence after the event.
+      auto size = std::max<size_t>(entry.size, sizeof(xcb_generic_event_t));
+      auto* event = reinterpret_cast<xcb_generic_event_t*>(calloc(1, size));
+      memcpy(event, data, entry.size);
+      ++events_;
+      return xcb::generic_event(event);
+    }
+    if (entry.type != Type::TIMEOUT || !deadline)
+      diverged_ = done_ = true;
+    return nullptr;
+  }
+
+  xcb::reply<xcb_get_property_reply_t> get_property(
+      bool, xcb_window_t, xcb_atom_t, xcb_atom_t, uint32_t,
+      xcb_generic_error_t** err) override {
+    Entry entry;
+    char const* data = next(&entry);
+    if (!data)
+      return nullptr;
+    if (entry.type == Type::REPLY && entry.size >= 32) {
+      auto* reply = malloc(entry.size);
+      memcpy(reply, data, entry.size);
+      ++replies_;
+      // Each recorded reply was a round trip, but took no time now.
+      roundtrip::account(0);
+      return xcb::reply<xcb_get_property_reply_t>(
+          reinterpret_cast<xcb_get_property_reply_t*>(reply));
+    }
+    if (entry.type == Type::ERROR) {
+      if (err && entry.size == sizeof(xcb_generic_error_t)) {
+        *err = reinterpret_cast<xcb_generic_error_t*>(malloc(entry.size));
+        memcpy(*err, data, entry.size);
+      }
+      ++replies_;
+      roundtrip::account(0);
+    } else {
+      diverged_ = done_ = true;
+    }
+    return nullptr;
+  }
+
+  void convert_selection(xcb_window_t, xcb_atom_t, xcb_atom_t, xcb_atom_t,
+                         xcb_timestamp_t) override {}
+
+  void change_property(uint8_t, xcb_window_t, xcb_atom_t, xcb_atom_t,
+                       uint8_t, uint32_t, void const*) override {}
+
+  void flush() override {}
+
+  RecordHeader const& header() const override {
+    return header_.header;
+  }
+
+  bool done() const override {
+    return done_;
+  }
+
+  bool diverged() const override {
+    return diverged_;
+  }
+
+  uint64_t events() const override {
+    return events_;
+  }
+
+  uint64_t replies() const override {
+    return replies_;
+  }
+
+private:
+  // Returns the data of the next entry, or nullptr if there are none left.
+  char const* next(Entry* entry) {
+    if (done_ || data_.size() - pos_ < sizeof(Entry)) {
+      done_ = true;
+      return nullptr;
+    }
+    memcpy(entry, data_.data() + pos_, sizeof(Entry));
+    if (data_.size() - pos_ - sizeof(Entry) < entry->size) {
+      // Truncated, most likely qrwnd was killed while recording.
+      done_ = true;
+      return nullptr;
+    }
+    char const* data = data_.data() + pos_ + sizeof(Entry);
+    pos_ += sizeof(Entry) + entry->size;
+    now_ = start_ + std::chrono::nanoseconds(entry->time_ns);
+    if (original_timing_)
+      std::this_thread::sleep_until(now_);
+    return data;
+  }
+
+  std::vector<char> const data_;
+  bool const original_timing_;
+  size_t pos_;
+  FileHeader header_;
+  Clock::time_point const start_;
+  Clock::time_point now_;
+  bool done_ = false;
+  bool diverged_ = false;
+  uint64_t events_ = 0;
+  uint64_t replies_ = 0;
+};
+
+}  // namespace
+
+std::unique_ptr<EventSource> EventRecorder::create(
+    std::unique_ptr<EventSource> source, std::string const& path,
+    RecordHeader const& header, std::ostream& err) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  FileHeader file_header;
+  memcpy(file_header.magic, kMagic, sizeof(kMagic));
+  file_header.header = header;
+  out.write(reinterpret_cast<char const*>(&file_header), sizeof(file_header));
+  if (!out) {
+    err << path << ": Unable to write recording" << std::endl;
+    return nullptr;
+  }
+  return std::make_unique<EventRecorderImpl>(std::move(source),
+                                             std::move(out));
+}
+
+std::unique_ptr<EventReplayer> EventReplayer::open(std::string const& path,
+                                                   bool original_timing,
+                                                   std::ostream& err) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    err << path << ": Unable to open recording" << std::endl;
+    return nullptr;
+  }
+  std::vector<char> data{std::istreambuf_iterator<char>(in),
+                         std::istreambuf_iterator<char>()};
+  if (data.size() < sizeof(FileHeader) ||
+      memcmp(data.data(), kMagic, sizeof(kMagic)) != 0) {
+    err << path << ": Not a recording" << std::endl;
+    return nullptr;
+  }
+  return std::make_unique<EventReplayerImpl>(std::move(data),
+                                             original_timing);
+}
@@ -0,0 +1,61 @@
+#ifndef EVENT_RECORD_HH
+#define EVENT_RECORD_HH
+
+#include "controller.hh"
+#include "event_source.hh"
+
+#include <iosfwd>
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+// Recordings of everything an EventSource returned to Controller, events,
+// property replies and timeouts, each with the time it was returned.
+// Written in native byte order and struct layout, so only replay them with
+// the same build.
+struct RecordHeader {
+  Controller::Window window;
+  Controller::Atoms atoms;
+  Controller::Options options;
+};
+
+class EventRecorder {
+public:
+  // Returns a source that forwards to source and writes everything it
+  // returns to path. Returns nullptr if path can't be written.
+  static std::unique_ptr<EventSource> create(
+      std::unique_ptr<EventSource> source, std::string const& path,
+      RecordHeader const& header, std::ostream& err);
+
+private:
+  EventRecorder() = delete;
+};
+
+// Plays back a recording. Requests are dropped and replies come from the
+// recording, so no X server is needed. now() follows the recorded time.
+class EventReplayer : public EventSource {
+public:
+  // If original_timing is true, events are returned at the same pace as
+  // they were recorded, otherwise as fast as possible.
+  static std::unique_ptr<EventReplayer> open(std::string const& path,
+                                             bool original_timing,
+                                             std::ostream& err);
+
+  virtual RecordHeader const& header() const = 0;
+
+  // True when all records have been returned.
+  virtual bool done() const = 0;
+
+  // True if asked for something else than what was recorded next, the
+  // replay no longer matches the recording. Implies done().
+  virtual bool diverged() const = 0;
+
+  virtual uint64_t events() const = 0;
+
+  virtual uint64_t replies() const = 0;
+
+protected:
+  EventReplayer() = default;
+};
+
+#endif  // EVENT_RECORD_HH
@@ -0,0 +1,76 @@
+#include "common.hh"
+
+#include "event_source.hh"
+#include "roundtrip.hh"
+
+#include <poll.h>
+
+namespace {
+
+class EventSourceImpl : public EventSource {
+public:
+  explicit EventSourceImpl(xcb::shared_conn conn)
+    : conn_(std::move(conn)) {}
+
+  Clock::time_point now() override {
+    return Clock::now();
+  }
+
+  xcb::generic_event next_event(
+      std::optional<Clock::time_point> deadline) override {
+    xcb::generic_event event(xcb_poll_for_event(conn_.get()));
+    if (event)
+      return event;
+    if (!deadline) {
+      event.reset(xcb_wait_for_event(conn_.get()));
+      return event;
+    }
+    auto timeout = std::chrono::ceil<std::chrono::milliseconds>(
+        *deadline - Clock::now());
+    if (timeout.count() > 0) {
+      struct pollfd pfd;
+      pfd.fd = xcb_get_file_descriptor(conn_.get());
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      poll(&pfd, 1, timeout.count());
+      event.reset(xcb_poll_for_event(conn_.get()));
+    }
+    return event;
+  }
+
+  xcb::reply<xcb_get_property_reply_t> get_property(
+      bool del, xcb_window_t window, xcb_atom_t property, xcb_atom_t type,
+      uint32_t long_length, xcb_generic_error_t** err) override {
+    auto cookie = xcb_get_property(conn_.get(), del ? 1 : 0, window,
+                                   property, type, 0, long_length);
+    return roundtrip::wait_reply<xcb_get_property_reply_t>(conn_.get(),
+                                                          cookie, err);
+  }
+
+  void convert_selection(xcb_window_t requestor, xcb_atom_t selection,
+                         xcb_atom_t target, xcb_atom_t property,
+                         xcb_timestamp_t time) override {
+    xcb_convert_selection(conn_.get(), requestor, selection, target,
+                          property, time);
+  }
+
+  void change_property(uint8_t mode, xcb_window_t window,
+                       xcb_atom_t property, xcb_atom_t type, uint8_t format,
+                       uint32_t data_len, void const* data) override {
+    xcb_change_property(conn_.get(), mode, window, property, type, format,
+                        data_len, data);
+  }
+
+  void flush() override {
+    xcb_flush(conn_.get());
+  }
+
+private:
+  xcb::shared_conn const conn_;
+};
+
+}  // namespace
+
+std::unique_ptr<EventSource> EventSource::create(xcb::shared_conn conn) {
+  return std::make_unique<EventSourceImpl>(std::move(conn));
+}
@@ -0,0 +1,54 @@
+#ifndef EVENT_SOURCE_HH
+#define EVENT_SOURCE_HH
+
+#include "xcb_connection.hh"
+#include "xcb_event.hh"
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <stdint.h>
+#include <xcb/xproto.h>
+
+// Everything Controller needs from the X server. Implemented by a live
+// connection, by EventRecorder wrapping one and by EventReplayer.
+class EventSource {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  virtual ~EventSource() = default;
+
+  // Live source, conn must stay valid.
+  static std::unique_ptr<EventSource> create(xcb::shared_conn conn);
+
+  virtual Clock::time_point now() = 0;
+
+  // Returns the next event. With a deadline, returns nullptr once it has
+  // passed without an event. Also returns nullptr on error.
+  virtual xcb::generic_event next_event(
+      std::optional<Clock::time_point> deadline) = 0;
+
+  // Same as xcb_get_property() followed by xcb_get_property_reply().
+  virtual xcb::reply<xcb_get_property_reply_t> get_property(
+      bool del, xcb_window_t window, xcb_atom_t property, xcb_atom_t type,
+      uint32_t long_length, xcb_generic_error_t** err) = 0;
+
+  virtual void convert_selection(xcb_window_t requestor,
+                                 xcb_atom_t selection, xcb_atom_t target,
+                                 xcb_atom_t property,
+                                 xcb_timestamp_t time) = 0;
+
+  virtual void change_property(uint8_t mode, xcb_window_t window,
+                               xcb_atom_t property, xcb_atom_t type,
+                               uint8_t format, uint32_t data_len,
+                               void const* data) = 0;
+
+  virtual void flush() = 0;
+
+protected:
+  EventSource() = default;
+  EventSource(EventSource const&) = delete;
+  EventSource& operator=(EventSource const&) = delete;
+};
+
+#endif  // EVENT_SOURCE_HH
@@ -0,0 +1,346 @@
+#include "common.hh"
+
+#include "fountain.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+#include <vector>
+
+namespace {
+
+constexpr double kSolitonC = 0.1;
+constexpr double kSolitonDelta = 0.05;
+
+void write_u16(uint8_t* out, uint16_t value) {
+  out[0] = value >> 8;
+  out[1] = value;
+}
+
+void write_u32(uint8_t* out, uint32_t value) {
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+uint16_t read_u16(uint8_t const* in) {
+  return (static_cast<uint16_t>(in[0]) << 8) | in[1];
+}
+
+uint32_t read_u32(uint8_t const* in) {
+  return (static_cast<uint32_t>(in[0]) << 24) |
+    (static_cast<uint32_t>(in[1]) << 16) |
+    (static_cast<uint32_t>(in[2]) << 8) | in[3];
+}
+
+uint64_t splitmix64(uint64_t& state) {
+  uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+// Uniform value in [0, 1)
+double next_double(uint64_t& state) {
+  return static_cast<double>(splitmix64(state) >> 11) * 0x1.0p-53;
+}
+
+// Cumulative robust soliton distribution, cdf[d - 1] is P(degree <= d).
+std::vector<double> const& robust_soliton(uint16_t k) {
+  static uint16_t cached_k = 0;
+  static std::vector<double> cdf;
+  if (cached_k == k)
+    return cdf;
+
+  double const r = kSolitonC * std::log(k / kSolitonDelta) * std::sqrt(k);
+  auto const spike = std::max<size_t>(
+      1, std::min<size_t>(k, static_cast<size_t>(std::round(k / r))));
+  std::vector<double> mu(k);
+  double sum = 0.0;
+  for (size_t d = 1; d <= k; ++d) {
+    double p = d == 1 ? 1.0 / k : 1.0 / (d * (d - 1.0));
+    if (d < spike) {
+      p += r / (d * static_cast<double>(k));
+    } else if (d == spike) {
+      p += r * std::log(r / kSolitonDelta) / k;
+    }
+    mu[d - 1] = p;
+    sum += p;
+  }
+  cdf.resize(k);
+  double acc = 0.0;
+  for (size_t d = 0; d < k; ++d) {
+    acc += mu[d] / sum;
+    cdf[d] = acc;
+  }
+  cdf.back() = 1.0;
+  cached_k = k;
+  return cdf;
+}
+
+class FountainEncoderImpl : public FountainEncoder {
+public:
+  FountainEncoderImpl(std::string_view data, size_t block_size, uint16_t k)
+    : block_size_(block_size), k_(k), length_(data.size()),
+      crc_(fountain_crc32(reinterpret_cast<uint8_t const*>(data.data()),
+                          data.size())),
+      data_(block_size * k, 0), indexes_(k) {
+    std::copy(data.begin(), data.end(), data_.begin());
+  }
+
+  size_t blocks() const override { return k_; }
+
+  size_t block_size() const override { return block_size_; }
+
+  size_t frame_size() const override {
+    return kFountainHeaderSize + block_size_;
+  }
+
+  void frame(uint32_t seq, uint8_t* out) const override {
+    out[0] = kFountainMagic;
+    write_u32(out + 1, length_);
+    write_u16(out + 5, k_);
+    write_u32(out + 7, seq);
+    write_u32(out + 11, crc_);
+    auto* payload = out + kFountainHeaderSize;
+    auto count = fountain_blocks(seq, k_, indexes_.data());
+    std::copy_n(data_.data() + indexes_[0] * block_size_, block_size_,
+                payload);
+    for (size_t i = 1; i < count; ++i) {
+      auto const* block = data_.data() + indexes_[i] * block_size_;
+      for (size_t j = 0; j < block_size_; ++j)
+        payload[j] ^= block[j];
+    }
+  }
+
+private:
+  size_t const block_size_;
+  uint16_t const k_;
+  uint32_t const length_;
+  uint32_t const crc_;
+  std::vector<uint8_t> data_;
+  mutable std::vector<uint16_t> indexes_;
+};
+
+class FountainDecoderImpl : public FountainDecoder {
+public:
+  FountainDecoderImpl() = default;
+
+  bool add(uint8_t const* frame, size_t size) override {
+    if (size <= kFountainHeaderSize || frame[0] != kFountainMagic)
+      return false;
+    auto length = read_u32(frame + 1);
+    auto k = read_u16(frame + 5);
+    auto seq = read_u32(frame + 7);
+    auto crc = read_u32(frame + 11);
+    auto block_size = size - kFountainHeaderSize;
+    if (k == 0 || static_cast<uint64_t>(k) * block_size < length)
+      return false;
+    if (k_ == 0) {
+      length_ = length;
+      k_ = k;
+      crc_ = crc;
+      block_size_ = block_size;
+      data_.assign(block_size_ * k_, 0);
+      known_.assign(k_, false);
+      missing_ = k_;
+    } else if (length != length_ || k != k_ || crc != crc_ ||
+               block_size != block_size_) {
+      return false;
+    }
+    if (missing_ == 0)
+      return true;
+
+    Pending pending;
+    pending.indexes.resize(k_);
+    pending.indexes.resize(fountain_blocks(seq, k_, pending.indexes.data()));
+    pending.data.assign(frame + kFountainHeaderSize, frame + size);
+    pending_.push_back(std::move(pending));
+    peel();
+    if (missing_ > 0 && pending_.size() >= missing_)
+      eliminate();
+
+    if (missing_ == 0) {
+      result_.assign(data_.begin(), data_.begin() + length_);
+      if (fountain_crc32(reinterpret_cast<uint8_t const*>(result_.data()),
+                         result_.size()) != crc_) {
+        result_.clear();
+        k_ = 0;
+        pending_.clear();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool done() const override {
+    return k_ != 0 && missing_ == 0;
+  }
+
+  std::string const& data() const override {
+    return result_;
+  }
+
+private:
+  struct Pending {
+    std::vector<uint16_t> indexes;
+    std::vector<uint8_t> data;
+  };
+
+  void peel() {
+    bool progress = true;
+    while (progress && missing_ > 0) {
+      progress = false;
+      auto it = pending_.begin();
+      while (it != pending_.end()) {
+        reduce(*it);
+        if (it->indexes.size() == 1) {
+          auto index = it->indexes[0];
+          std::copy(it->data.begin(), it->data.end(),
+                    data_.begin() + index * block_size_);
+          known_[index] = true;
+          --missing_;
+          progress = true;
+        }
+        if (it->indexes.size() <= 1) {
+          it = pending_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+  }
+
+  // Solves the pending frames as XOR equations over the missing blocks, for
+  // when peeling stalls. With few blocks it often does, unless many more
+  // than K frames are read. Leaves everything as is if there isn't a
+  // unique solution yet.
+  void eliminate() {
+    std::vector<size_t> column(k_, SIZE_MAX);
+    std::vector<uint16_t> unknowns;
+    for (size_t i = 0; i < k_; ++i) {
+      if (!known_[i]) {
+        column[i] = unknowns.size();
+        unknowns.push_back(i);
+      }
+    }
+    size_t const words = (unknowns.size() + 63) / 64;
+    std::vector<std::vector<uint64_t>> rows;
+    std::vector<std::vector<uint8_t>> data;
+    rows.reserve(pending_.size());
+    data.reserve(pending_.size());
+    for (auto const& pending : pending_) {
+      rows.emplace_back(words, 0);
+      for (auto index : pending.indexes)
+        rows.back()[column[index] / 64] ^= 1ull << (column[index] % 64);
+      data.push_back(pending.data);
+    }
+
+    for (size_t c = 0; c < unknowns.size(); ++c) {
+      auto const word = c / 64;
+      auto const bit = 1ull << (c % 64);
+      size_t pivot = c;
+      while (pivot < rows.size() && !(rows[pivot][word] & bit))
+        ++pivot;
+      if (pivot == rows.size())
+        return;
+      std::swap(rows[pivot], rows[c]);
+      std::swap(data[pivot], data[c]);
+      for (size_t r = 0; r < rows.size(); ++r) {
+        if (r == c || !(rows[r][word] & bit))
+          continue;
+        for (size_t w = 0; w < words; ++w)
+          rows[r][w] ^= rows[c][w];
+        for (size_t j = 0; j < block_size_; ++j)
+          data[r][j] ^= data[c][j];
+      }
+    }
+
+    // Row c now holds unknowns[c] alone.
+    for (size_t c = 0; c < unknowns.size(); ++c) {
+      std::copy(data[c].begin(), data[c].end(),
+                data_.begin() + unknowns[c] * block_size_);
+      known_[unknowns[c]] = true;
+    }
+    missing_ = 0;
+    pending_.clear();
+  }
+
+  void reduce(Pending& pending) {
+    auto it = pending.indexes.begin();
+    while (it != pending.indexes.end()) {
+      if (known_[*it]) {
+        auto const* block = data_.data() + *it * block_size_;
+        for (size_t j = 0; j < block_size_; ++j)
+          pending.data[j] ^= block[j];
+        it = pending.indexes.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  uint32_t length_ = 0;
+  uint16_t k_ = 0;
+  uint32_t crc_ = 0;
+  size_t block_size_ = 0;
+  size_t missing_ = 0;
+  std::vector<uint8_t> data_;
+  std::vector<bool> known_;
+  std::vector<Pending> pending_;
+  std::string result_;
+};
+
+}  // namespace
+
+std::unique_ptr<FountainEncoder> FountainEncoder::create(std::string_view data,
+                                                         size_t frame_size) {
+  if (frame_size <= kFountainHeaderSize || data.size() > UINT32_MAX)
+    return nullptr;
+  auto block_size = frame_size - kFountainHeaderSize;
+  auto k = std::max<size_t>(1, (data.size() + block_size - 1) / block_size);
+  if (k > UINT16_MAX)
+    return nullptr;
+  return std::make_unique<FountainEncoderImpl>(data, block_size, k);
+}
+
+std::unique_ptr<FountainDecoder> FountainDecoder::create() {
+  return std::make_unique<FountainDecoderImpl>();
+}
+
+size_t fountain_blocks(uint32_t seq, uint16_t k, uint16_t* out) {
+  assert(k > 0);
+  if (seq < k) {
+    out[0] = seq;
+    return 1;
+  }
+  uint64_t state = seq;
+  auto const& cdf = robust_soliton(k);
+  auto degree = 1 + (std::lower_bound(cdf.begin(), cdf.end(),
+                                      next_double(state)) - cdf.begin());
+  degree = std::min<size_t>(degree, k);
+  size_t count = 0;
+  while (count < static_cast<size_t>(degree)) {
+    auto index = static_cast<uint16_t>(splitmix64(state) % k);
+    if (std::find(out, out + count, index) == out + count)
+      out[count++] = index;
+  }
+  return count;
+}
+
+uint32_t fountain_crc32(uint8_t const* data, size_t size) {
+  static uint32_t table[256];
+  if (table[1] == 0) {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int j = 0; j < 8; ++j)
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+  }
+  uint32_t crc = 0xffffffffu;
+  for (size_t i = 0; i < size; ++i)
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return crc ^ 0xffffffffu;
+}
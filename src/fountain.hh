@@ -0,0 +1,81 @@
+#ifndef FOUNTAIN_HH
+#define FOUNTAIN_HH
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+// Rateless (LT) fountain code used to move data that doesn't fit in a single
+// QR code as an endless sequence of frames. A receiver can reconstruct the
+// data from any set of distinct frames, on average slightly more than
+// blocks() of them.
+//
+// Frame layout, all integers are big endian:
+//   u8  magic, always kFountainMagic
+//   u32 length of data
+//   u16 number of blocks, K
+//   u32 sequence number
+//   u32 CRC-32 (IEEE) of data
+//   ... block_size bytes of payload
+//
+// The data is split into K blocks of block_size bytes, the last one zero
+// padded. Frames with sequence number less than K carry block number
+// sequence as is. Later frames carry the XOR of a set of blocks, selected
+// using fountain_blocks() which both sides must implement identically.
+
+constexpr uint8_t kFountainMagic = 0xf1;
+constexpr size_t kFountainHeaderSize = 15;
+
+class FountainEncoder {
+public:
+  virtual ~FountainEncoder() = default;
+
+  // Returns nullptr if frame_size is too small or data needs too many blocks.
+  static std::unique_ptr<FountainEncoder> create(std::string_view data,
+                                                 size_t frame_size);
+
+  virtual size_t blocks() const = 0;
+
+  virtual size_t block_size() const = 0;
+
+  virtual size_t frame_size() const = 0;
+
+  // Writes frame_size() bytes to out.
+  virtual void frame(uint32_t seq, uint8_t* out) const = 0;
+
+protected:
+  FountainEncoder() = default;
+  FountainEncoder(FountainEncoder const&) = delete;
+  FountainEncoder& operator=(FountainEncoder const&) = delete;
+};
+
+class FountainDecoder {
+public:
+  virtual ~FountainDecoder() = default;
+
+  static std::unique_ptr<FountainDecoder> create();
+
+  // Returns false if the frame is invalid or belongs to other data than
+  // previously added frames.
+  virtual bool add(uint8_t const* frame, size_t size) = 0;
+
+  virtual bool done() const = 0;
+
+  // Only valid when done() returns true.
+  virtual std::string const& data() const = 0;
+
+protected:
+  FountainDecoder() = default;
+  FountainDecoder(FountainDecoder const&) = delete;
+  FountainDecoder& operator=(FountainDecoder const&) = delete;
+};
+
+// Writes the blocks combined in frame seq out of k blocks to out, which must
+// have room for k values. Returns the number of blocks written.
+size_t fountain_blocks(uint32_t seq, uint16_t k, uint16_t* out);
+
+uint32_t fountain_crc32(uint8_t const* data, size_t size);
+
+#endif  // FOUNTAIN_HH
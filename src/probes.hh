@@ -0,0 +1,33 @@
+#ifndef PROBES_HH
+#define PROBES_HH
+
+// USDT probes in the qrwnd provider, for bpftrace and friends. Only
+// compiled in with the usdt meson option, see data/bpftrace for examples.
+// Probes and arguments:
+//   selection_owner_change(owner, timestamp)
+//   convert_selection_issued(property, target, timestamp)
+//   convert_selection_answered(property, target)
+//   property_read(property, bytes)
+//   incr_start(property, size_hint)
+//   incr_end(property, bytes)
+//   encode_start(bytes)
+//   encode_end(bytes, version), version is zero on failure
+//   shared_cache_hit(bytes, version), found instead of encoded
+//   paint_start(x, y, width, height)
+//   paint_end(x, y, width, height)
+
+#ifdef QRWND_USDT
+#include <sys/sdt.h>
+
+#define QRWND_PROBE1(name, a) DTRACE_PROBE1(qrwnd, name, a)
+#define QRWND_PROBE2(name, a, b) DTRACE_PROBE2(qrwnd, name, a, b)
+#define QRWND_PROBE3(name, a, b, c) DTRACE_PROBE3(qrwnd, name, a, b, c)
+#define QRWND_PROBE4(name, a, b, c, d) DTRACE_PROBE4(qrwnd, name, a, b, c, d)
+#else
+#define QRWND_PROBE1(name, a) do {} while (false)
+#define QRWND_PROBE2(name, a, b) do {} while (false)
+#define QRWND_PROBE3(name, a, b, c) do {} while (false)
+#define QRWND_PROBE4(name, a, b, c, d) do {} while (false)
+#endif
+
+#endif  // PROBES_HH
@@ -0,0 +1,31 @@
+#include "common.hh"
+
+#include "qr_capacity.hh"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+constexpr size_t kCapacity[kQRMaxVersion] = {
+  17, 32, 53, 78, 106, 134, 154, 192, 230, 271,
+  321, 367, 425, 458, 520, 586, 644, 718, 792, 858,
+  929, 1003, 1091, 1171, 1273, 1367, 1465, 1528, 1628, 1732,
+  1840, 1952, 2068, 2188, 2303, 2431, 2563, 2699, 2809, 2953,
+};
+
+}  // namespace
+
+size_t qr_capacity_8bit(int version) {
+  if (version < kQRMinVersion || version > kQRMaxVersion)
+    return 0;
+  return kCapacity[version - 1];
+}
+
+int qr_min_version_8bit(size_t bytes) {
+  auto it = std::lower_bound(std::begin(kCapacity), std::end(kCapacity),
+                             bytes);
+  if (it == std::end(kCapacity))
+    return 0;
+  return kQRMinVersion + (it - std::begin(kCapacity));
+}
@@ -0,0 +1,18 @@
+#ifndef QR_CAPACITY_HH
+#define QR_CAPACITY_HH
+
+#include <stddef.h>
+
+// Capacity tables for 8bit mode using error correction level L, which is
+// what qrwnd always encodes with.
+
+constexpr int kQRMinVersion = 1;
+constexpr int kQRMaxVersion = 40;
+
+// Returns the number of bytes that fit in a code of the given version.
+size_t qr_capacity_8bit(int version);
+
+// Returns the smallest version that can fit bytes, or zero if nothing fits.
+int qr_min_version_8bit(size_t bytes);
+
+#endif  // QR_CAPACITY_HH
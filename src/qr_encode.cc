@@ -0,0 +1,13 @@
+#include "common.hh"
+
+#include "qr_encode.hh"
+
+unique_qrcode qr_encode(std::string const& str) {
+  return unique_qrcode(QRcode_encodeString8bit(str.c_str(),
+                                               0 /* autoselect version */,
+                                               QR_ECLEVEL_L));
+}
+
+unique_qrcode qr_encode(uint8_t const* data, size_t size, int version) {
+  return unique_qrcode(QRcode_encodeData(size, data, version, QR_ECLEVEL_L));
+}
@@ -0,0 +1,26 @@
+#ifndef QR_ENCODE_HH
+#define QR_ENCODE_HH
+
+#include <memory>
+#include <qrencode.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+struct QRcodeDeleter {
+  void operator() (QRcode* qrcode) const {
+    QRcode_free(qrcode);
+  }
+};
+
+typedef std::unique_ptr<QRcode, QRcodeDeleter> unique_qrcode;
+
+// Encodes str, up to the first NUL, using the smallest version it fits in.
+// Error correction is always low as the code is only shown on screen.
+// Returns nullptr and sets errno on error.
+unique_qrcode qr_encode(std::string const& str);
+
+// Encodes size bytes of data using exactly version, if it fits.
+unique_qrcode qr_encode(uint8_t const* data, size_t size, int version);
+
+#endif  // QR_ENCODE_HH
@@ -1,79 +1,114 @@
 #include "common.hh"
 
 #include "args.hh"
-#include "xcb_atoms.hh"
+#include "controller.hh"
+#include "event_record.hh"
+#include "event_source.hh"
+#include "qr_capacity.hh"
+#include "render.hh"
+#include "roundtrip.hh"
+#include "shared_cache.hh"
+#include "snapshot.hh"
+#include "startup.hh"
+#include "stats.hh"
+#include "trace.hh"
+#include "url_rewrite.hh"
 #include "xcb_connection.hh"
 #include "xcb_event.hh"
-#include "xcb_resource.hh"
 #include "xcb_xkb.hh"
 
-#include <algorithm>
-#include <cairo-xcb.h>
 #include <chrono>
 #include <errno.h>
 #include <fstream>
 #include <iostream>
-#include <limits>
-#include <map>
 #include <optional>
-#include <qrencode.h>
+#include <stdlib.h>
 #include <string.h>
-#include <xcb/xcb_icccm.h>
-#include <xcb/xfixes.h>
 
 #ifndef VERSION
 # warning No version defined
 # define VERSION
 #endif
 
+#ifndef DATADIR
+# define DATADIR "/usr/share"
+#endif
+
 namespace {
 
-constexpr char const kTitle[] = "QRwnd";
-constexpr char const kClass[] = "org.the_jk.qrwnd";
+constexpr int kDefaultStreamFps = 5;
+constexpr int kDefaultStreamVersion = 12;
 
-struct QRcodeDeleter {
-  void operator() (QRcode* qrcode) const {
-    QRcode_free(qrcode);
-  }
-};
+bool parse_int(std::string const& str, int min, int max, int* out) {
+  char* end = nullptr;
+  errno = 0;
+  auto value = strtol(str.c_str(), &end, 10);
+  if (errno || end == str.c_str() || *end || value < min || value > max)
+    return false;
+  *out = value;
+  return true;
+}
 
-struct CairoDeleter {
-  void operator() (cairo_t* cr) const {
-    cairo_destroy(cr);
+// Returns the first of $XDG_CONFIG_HOME/qrwnd/rewrite.rules and
+// DATADIR/qrwnd/rewrite.rules that exists, or an empty string.
+std::string find_rewrite_rules() {
+  std::string path;
+  auto* config_home = getenv("XDG_CONFIG_HOME");
+  if (config_home && *config_home) {
+    path = config_home;
+  } else {
+    auto* home = getenv("HOME");
+    if (home && *home)
+      path = std::string(home) + "/.config";
   }
-};
-
-struct CairoSurfaceDeleter {
-  void operator() (cairo_surface_t* surface) const {
-    cairo_surface_destroy(surface);
+  if (!path.empty()) {
+    path.append("/qrwnd/rewrite.rules");
+    if (std::ifstream(path).good())
+      return path;
   }
-};
-
-bool looks_like_url(std::string_view str) {
-  if (str.empty())
-    return false;
-  if (str.find(' ') != std::string::npos)
-    return false;
-  return str.find("://") != std::string::npos;
+  path = DATADIR "/qrwnd/rewrite.rules";
+  if (std::ifstream(path).good())
+    return path;
+  return std::string();
 }
 
-xcb_visualtype_t *find_visual(xcb_screen_t* screen, xcb_visualid_t visual) {
-  auto depth_iter = xcb_screen_allowed_depths_iterator(screen);
-  for (; depth_iter.rem; xcb_depth_next(&depth_iter)) {
-    auto visual_iter = xcb_depth_visuals_iterator(depth_iter.data);
-    for (; visual_iter.rem; xcb_visualtype_next(&visual_iter))
-      if (visual == visual_iter.data->visual_id)
-        return visual_iter.data;
+// Time spent in each startup phase, reported with --timing.
+class StartupTiming {
+public:
+  explicit StartupTiming(bool enabled)
+    : enabled_(enabled), start_(std::chrono::steady_clock::now()),
+      last_(start_) {}
+
+  void phase(char const* name) {
+    if (!enabled_)
+      return;
+    auto now = std::chrono::steady_clock::now();
+    phases_.emplace_back(name, now - last_);
+    last_ = now;
   }
-  return nullptr;
-}
 
-struct Request {
-  std::chrono::steady_clock::time_point expire;
-  bool property_notify;
+  void print(std::ostream& out) const {
+    if (!enabled_)
+      return;
+    out << "Startup timing:\n";
+    std::chrono::duration<double, std::milli> total{0};
+    for (auto const& phase : phases_) {
+      std::chrono::duration<double, std::milli> ms = phase.second;
+      total += ms;
+      out << "  " << phase.first << ": " << ms.count() << " ms ("
+          << total.count() << " ms)\n";
+    }
+    auto trips = roundtrip::get(roundtrip::Op::STARTUP);
+    out << "  round trips: " << trips.count << " ("
+        << trips.blocked_ns / 1e6 << " ms blocked)" << std::endl;
+  }
 
-  explicit Request(std::chrono::steady_clock::time_point expire)
-    : expire(expire), property_notify(false) {}
+private:
+  bool const enabled_;
+  std::chrono::steady_clock::time_point const start_;
+  std::chrono::steady_clock::time_point last_;
+  std::vector<std::pair<char const*,
+                        std::chrono::steady_clock::duration>> phases_;
 };
 
 }  // namespace
@@ -87,6 +122,55 @@ int main(int argc, char** argv) {
       "show QR code for all selection content, not just URLs.");
   auto* display = args->add_option_with_arg(
       'D', "display", "connect to DISPLAY instead of default.", "DISPLAY");
+  auto* rewrite_rules = args->add_option_with_arg(
+      '\0', "rewrite-rules",
+      "strip URL tracking parameters using rules in FILE instead of"
+      " the default rules.", "FILE");
+  auto* no_rewrite = args->add_option(
+      '\0', "no-rewrite", "encode URLs as is, without stripping or"
+      " normalizing them.");
+  auto* rewrite_stats = args->add_option(
+      '\0', "rewrite-stats", "print URL rewrite statistics at exit.");
+  auto* stream_opt = args->add_option(
+      'S', "stream", "show content too large for one QR code as an animated"
+      " sequence of fountain coded frames.");
+  auto* fps_opt = args->add_option_with_arg(
+      '\0', "fps", "frames per second when streaming, default 5.", "N");
+  auto* frame_version_opt = args->add_option_with_arg(
+      '\0', "frame-version", "QR version (2-40) of each frame when"
+      " streaming, default 12.", "VERSION");
+  auto* timing_opt = args->add_option(
+      '\0', "timing", "print the time spent in each startup phase.");
+  auto* no_snapshot = args->add_option(
+      '\0', "no-snapshot", "don't show, or save, the last code in"
+      " $XDG_RUNTIME_DIR/qrwnd.snapshot.");
+  auto* shared_cache_opt = args->add_option_with_arg(
+      '\0', "shared-cache", "share encoded codes with other instances"
+      " using the same PATH, created if missing. Only share PATH with users"
+      " you trust, anyone who can write it decides what codes you see.",
+      "PATH");
+  auto* paint_trace = args->add_option(
+      '\0', "paint-trace", "after each repaint, set _QRWND_PAINT on the"
+      " root window to the hash of the shown content. Used by the latency"
+      " harness.");
+  auto* trace_opt = args->add_option_with_arg(
+      '\0', "trace", "write a Chrome trace of recent activity to FILE at"
+      " exit and on SIGUSR1. Without it SIGUSR1 writes to"
+      " $XDG_RUNTIME_DIR/qrwnd-trace.json, if XDG_RUNTIME_DIR is set.",
+      "FILE");
+  auto* stats_opt = args->add_option(
+      '\0', "stats", "print counters and latency histograms at exit. They"
+      " are also printed on SIGUSR2.");
+  auto* stats_socket = args->add_option_with_arg(
+      '\0', "stats-socket", "serve counters and latency histograms as JSON"
+      " to anyone connecting to the unix socket PATH.", "PATH");
+  auto* popup = args->add_option_with_arg(
+      '\0', "popup", "stay hidden until KEY, like Super+q, is pressed, then"
+      " show the code for the current selection. q or Escape hides the"
+      " window again. Nothing is fetched while hidden.", "KEY");
+  auto* record = args->add_option_with_arg(
+      '\0', "record", "record all events and replies to FILE, for"
+      " qrwnd-replay. Not with --popup.", "FILE");
 #ifndef NDEBUG
   auto* debug = args->add_option_with_arg('D', "debug",
                                           "write debug info to FILE", "FILE");
@@ -114,13 +198,67 @@ int main(int argc, char** argv) {
               << "Try `qrwnd --help` for usage." << std::endl;
     return EXIT_FAILURE;
   }
+  // Popup mode drives Controller with refresh(), which isn't an event and
+  // so isn't recorded. A replay would never fetch the selection.
+  if (record->is_set() && popup->is_set()) {
+    std::cerr << "--record can't be used with --popup.\n"
+              << "Try `qrwnd --help` for usage." << std::endl;
+    return EXIT_FAILURE;
+  }
+  int fps = kDefaultStreamFps;
+  if (fps_opt->is_set() && !parse_int(fps_opt->arg(), 1, 60, &fps)) {
+    std::cerr << "Invalid argument to --fps, expected 1-60.\n"
+              << "Try `qrwnd --help` for usage." << std::endl;
+    return EXIT_FAILURE;
+  }
+  int frame_version = kDefaultStreamVersion;
+  if (frame_version_opt->is_set() &&
+      !parse_int(frame_version_opt->arg(), 2, kQRMaxVersion,
+                 &frame_version)) {
+    std::cerr << "Invalid argument to --frame-version, expected 2-40.\n"
+              << "Try `qrwnd --help` for usage." << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::ostream* debug_out = nullptr;
 #ifndef NDEBUG
   std::ofstream out_dbg(nullptr);
   if (debug->is_set()) {
     out_dbg = std::ofstream(debug->arg());
+    debug_out = &out_dbg;
   }
 #endif
 
+  std::unique_ptr<UrlRewriter> rewriter;
+  if (!no_rewrite->is_set()) {
+    rewriter = UrlRewriter::create();
+    auto rules = rewrite_rules->is_set() ? rewrite_rules->arg()
+      : find_rewrite_rules();
+    if (!rules.empty() && !rewriter->load(rules, std::cerr))
+      return EXIT_FAILURE;
+  }
+
+  StartupTiming timing(timing_opt->is_set());
+
+  if (!trace_opt->is_set() && trace::default_path().empty()) {
+    std::cerr << "XDG_RUNTIME_DIR isn't set, SIGUSR1 traces need --trace."
+              << std::endl;
+  } else if (!trace::dump_on_signal(trace_opt->is_set() ? trace_opt->arg()
+                                    : std::string())) {
+    std::cerr << "Unable to install trace signal handler." << std::endl;
+  }
+
+  auto stats = std::make_unique<Stats>();
+  // Started before anything else can start a thread, see create().
+  auto stats_server = StatsServer::create(
+      stats.get(), stats_socket->is_set() ? stats_socket->arg()
+      : std::string(), std::cerr);
+  if (!stats_server && stats_socket->is_set())
+    return EXIT_FAILURE;
+
+  // Until the keyboard is setup after the first paint.
+  std::optional<roundtrip::Scope> startup_scope(std::in_place,
+                                                roundtrip::Op::STARTUP);
+
   xcb::shared_conn conn;
   int screen_index = 0;
   if (display->is_set()) {
@@ -138,290 +276,141 @@ int main(int argc, char** argv) {
     }
   }
 
-  auto atoms = xcb::Atoms::create(conn);
-  auto primary = atoms->get("PRIMARY");
-  std::vector<xcb::Atoms::Reference> target_property;
-  for (int i = 0; i < 10; ++i) {
-    char tmp[15];
-    snprintf(tmp, sizeof(tmp), "QRWND_DATA%d", i);
-    target_property.push_back(atoms->get(tmp));
-  }
-  auto utf8_string = atoms->get("UTF8_STRING");
-  auto string_atom = atoms->get("STRING");
-  auto incr = atoms->get("INCR");
-  auto wm_protocols = atoms->get("WM_PROTOCOLS");
-  auto wm_delete_window = atoms->get("WM_DELETE_WINDOW");
-  xcb_prefetch_extension_data(conn.get(), &xcb_xfixes_id);
+  timing.phase("connect");
 
   auto* screen = xcb::get_screen(conn.get(), screen_index);
   assert(screen);
 
-  if (!atoms->sync()) {
-    std::cerr << "Failed to get X atoms." << std::endl;
-    return EXIT_FAILURE;
-  }
-
-  auto* xfixes_reply = xcb_get_extension_data(conn.get(), &xcb_xfixes_id);
-  if (!xfixes_reply->present) {
-    std::cerr << "No XFixes extension, needed to monitor selection."
-              << std::endl;
-    return EXIT_FAILURE;
-  }
-
+  // Queue the extension queries and atoms without waiting for any reply,
+  // then create and map the window before collecting the replies. The
+  // extension queries go first, so their replies are in along with the
+  // atoms. Extension requests block on their query, so none is sent
+  // before the window is mapped.
   auto keyboard = xcb::Keyboard::create(conn.get());
   if (!keyboard) {
     std::cerr << "Failed to initialize XKB." << std::endl;
     return EXIT_FAILURE;
   }
+  auto startup = Startup::create(conn, screen, popup->is_set());
 
-  auto selection = primary.get();
-
-  xcb_xfixes_query_version(conn.get(), XCB_XFIXES_MAJOR_VERSION,
-                           XCB_XFIXES_MINOR_VERSION);
-
-  xcb_xfixes_select_selection_input(
-      conn.get(),
-      screen->root,
-      selection,
-      XCB_XFIXES_SELECTION_EVENT_MASK_SET_SELECTION_OWNER);
-
-  auto wnd = xcb::make_unique_wnd(conn);
-
-  uint16_t wnd_width = 175;
-  uint16_t wnd_height = 175;
-
-  uint32_t value_list[3];
-  uint32_t value_mask = 0;
-  value_mask |= XCB_CW_BACK_PIXEL;
-  value_list[0] = screen->white_pixel;
-  value_mask |= XCB_CW_EVENT_MASK;
-  value_list[1] = XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_KEY_PRESS |
-    XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_PROPERTY_CHANGE;
-  xcb_create_window(conn.get(), XCB_COPY_FROM_PARENT, wnd->id(), screen->root,
-                    0, 0, wnd_width, wnd_height, 0,
-                    XCB_WINDOW_CLASS_INPUT_OUTPUT,
-                    screen->root_visual, value_mask, value_list);
-
-  auto* visual = find_visual(screen, screen->root_visual);
-  if (!visual) {
-    std::cerr << "Unable to find a matching visual." << std::endl;
+  if (!startup->map_window(std::cerr))
     return EXIT_FAILURE;
-  }
-
-  xcb_icccm_set_wm_name(conn.get(), wnd->id(), string_atom.get(),
-                        8, sizeof(kTitle) - 1, kTitle);
-  xcb_icccm_set_wm_class(conn.get(), wnd->id(), sizeof(kClass) - 1, kClass);
-  xcb_atom_t atom_list[1];
-  atom_list[0] = wm_delete_window.get();
-  xcb_icccm_set_wm_protocols(conn.get(), wnd->id(),
-                             wm_protocols.get(), 1, atom_list);
-
-  std::unique_ptr<cairo_surface_t, CairoSurfaceDeleter> surface(
-      cairo_xcb_surface_create(conn.get(), wnd->id(), visual,
-                               wnd_width, wnd_height));
-  std::unique_ptr<cairo_t, CairoDeleter> cr(cairo_create(surface.get()));
-
-  xcb_map_window(conn.get(), wnd->id());
-  // No xcb_flush needed here as request_queued and invalidate will xcb_flush
-
-  bool request_queued = true;
-  xcb_timestamp_t request_time = XCB_CURRENT_TIME;
-  xcb_atom_t incr_property = XCB_NONE;
-  auto request_type = utf8_string.get();
-  std::map<xcb_atom_t, Request> active_request;
-
-  xcb_window_t property_wnd = XCB_NONE;
-  xcb_atom_t read_property = XCB_NONE;
+  auto const& window = startup->window();
+  timing.phase("map window");
 
-  bool update_code = false;
-  std::string current_data;
-  std::string incr_data;
-  std::unique_ptr<cairo_surface_t, CairoSurfaceDeleter> current;
+  auto canvas = make_window_canvas(conn.get(), screen, window.id,
+                                   window.width, window.height);
+  if (!canvas) {
+    std::cerr << "Unable to paint the window." << std::endl;
+    return EXIT_FAILURE;
+  }
 
-  bool invalidate = true;
-  xcb_rectangle_t invalidate_rect{0, 0, wnd_width, wnd_height};
+  if (!startup->sync_atoms(std::cerr))
+    return EXIT_FAILURE;
+  timing.phase("atoms");
 
-  while (true) {
-    bool flush = false;
-    if (request_queued) {
-      // Remove all expired busy_target_properties
-      auto now = std::chrono::steady_clock::now();
-      auto it = active_request.begin();
-      while (it != active_request.end()) {
-        if (it->second.expire <= now) {
-          if (!it->second.property_notify) {
-#ifndef NDEBUG
-            out_dbg << "Old request timed out" << std::endl;
-#endif
-          }
-          it = active_request.erase(it);
-        } else {
-          ++it;
-        }
-      }
-      if (active_request.size() < target_property.size()) {
-#ifndef NDEBUG
-        out_dbg << "Start queued request " << request_type << " "
-                << request_time << std::endl;
-#endif
-        request_queued = false;
-        auto expire = now + std::chrono::seconds(10);
-        xcb_atom_t target;
-        for (auto& property : target_property) {
-          target = property.get();
-          if (active_request.emplace(target, expire).second)
-            break;
-        }
-        xcb_convert_selection(conn.get(), wnd->id(), selection,
-                              request_type, target, request_time);
-        flush = true;
-      } else {
-#ifndef NDEBUG
-        out_dbg << "All properties are already waiting" << std::endl;
-#endif
-      }
-    }
+  if (!startup->select_input(std::cerr))
+    return EXIT_FAILURE;
+  timing.phase("extensions");
 
-    if (read_property) {
-      auto cookie = xcb_get_property(
-          conn.get(), 1 /* delete */, property_wnd, read_property,
-          XCB_GET_PROPERTY_TYPE_ANY,
-          0, std::numeric_limits<uint32_t>::max() / 4);
-      xcb_generic_error_t* err = nullptr;
-      xcb::reply<xcb_get_property_reply_t> reply(
-          xcb_get_property_reply(conn.get(), cookie, &err));
-      if (reply) {
-        if (reply->type == utf8_string.get() ||
-            reply->type == string_atom.get()) {
-          std::string_view data(
-              reinterpret_cast<char*>(xcb_get_property_value(reply.get())),
-              xcb_get_property_value_length(reply.get()));
-          if (data != current_data) {
-            current_data = data;
-            update_code = true;
-          }
-        } else if (reply->type == incr.get()) {
-          incr_property = read_property;
-          auto len = xcb_get_property_value_length(reply.get());
-#ifndef NDEBUG
-          out_dbg << "INCR " << incr_property << " " << len << std::endl;
-#endif
-          if (len == 4) {
-            auto size = *reinterpret_cast<int32_t*>(
-                xcb_get_property_value(reply.get()));
-            incr_data.reserve(size);
-          }
-          incr_data.clear();
-        } else {
-          std::cerr << "Unsupported selection property type: "
-                    << reply->type << std::endl;
-        }
-      } else {
-        std::cerr << "Error getting property: " <<
-          xcb_event_get_error_label(err->error_code) << std::endl;
-        free(err);
-      }
-      read_property = XCB_NONE;
+  std::unique_ptr<Snapshot> snapshot;
+  if (!no_snapshot->is_set()) {
+    auto path = Snapshot::default_path();
+    if (!path.empty())
+      snapshot = Snapshot::open(path);
+  }
+  std::unique_ptr<SharedCache> shared_cache;
+  if (shared_cache_opt->is_set()) {
+    shared_cache = SharedCache::open(shared_cache_opt->arg());
+    if (!shared_cache) {
+      std::cerr << "Not sharing codes, unable to use "
+                << shared_cache_opt->arg() << std::endl;
     }
+  }
 
-    if (update_code) {
-#ifndef NDEBUG
-      out_dbg << "Update code " << current_data << std::endl;
-#endif
-      update_code = false;
-      if (everything->is_set() || looks_like_url(current_data)) {
-        auto qrcode = std::unique_ptr<QRcode, QRcodeDeleter>(
-            QRcode_encodeString8bit(
-                current_data.c_str(),
-                0 /* autoselect version */,
-                /* showing on screen so low ec */
-                QR_ECLEVEL_L));
-        if (qrcode) {
-          current.reset(cairo_image_surface_create(
-                            CAIRO_FORMAT_RGB24,
-                            qrcode->width,
-                            qrcode->width));
-          auto stride = cairo_image_surface_get_stride(current.get());
-          cairo_surface_flush(current.get());
-          auto* data = cairo_image_surface_get_data(current.get());
-          if (data) {
-            for (int y = 0; y < qrcode->width; ++y) {
-              auto* out_row = data + y * stride;
-              auto* in_row = qrcode->data + y * qrcode->width;
-              for (int x = 0; x < qrcode->width; ++x) {
-                auto c = (*in_row & 1) ? 0 : 0xff;
-                std::fill_n(out_row, 4, c);
-                ++in_row;
-                out_row += 4;
-              }
-            }
-          }
-          cairo_surface_mark_dirty(current.get());
-        } else {
-          std::cerr << "Failed to generate QR code: "
-                    << strerror(errno) << std::endl;
-          current.reset();
-        }
-      } else {
-        current.reset();
-      }
+  auto const& controller_atoms = startup->atoms();
+  Controller::Options options;
+  options.everything = everything->is_set();
+  options.stream = stream_opt->is_set();
+  options.paint_trace = paint_trace->is_set();
+  options.fps = fps;
+  options.frame_version = frame_version;
+
+  auto source = EventSource::create(conn);
+  if (record->is_set()) {
+    source = EventRecorder::create(
+        std::move(source), record->arg(),
+        RecordHeader{ window, controller_atoms, options }, std::cerr);
+    if (!source)
+      return EXIT_FAILURE;
+  }
 
-      invalidate = true;
-      // Force redraw of all
-      invalidate_rect = { 0, 0, wnd_width, wnd_height };
+  auto controller = Controller::create(
+      source.get(), window, controller_atoms, options, canvas.get(),
+      stats.get(), rewriter.get(), snapshot.get(), shared_cache.get(),
+      debug_out);
+  if (snapshot)
+    timing.phase("snapshot");
+
+  bool first_paint = true;
+  // Only used in popup mode.
+  bool shown = false;
+  xcb_timestamp_t shown_time = XCB_CURRENT_TIME;
+  auto hide = [&]() {
+    shown = false;
+    xcb_unmap_window(conn.get(), window.id);
+    // ICCCM 4.1.4, lets a reparenting window manager know the window is
+    // withdrawn.
+    xcb_unmap_notify_event_t unmap{};
+    unmap.response_type = XCB_UNMAP_NOTIFY;
+    unmap.event = screen->root;
+    unmap.window = window.id;
+    xcb_send_event(conn.get(), 0, screen->root,
+                   XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT |
+                   XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY,
+                   reinterpret_cast<char const*>(&unmap));
+    xcb_flush(conn.get());
+  };
+
+  if (popup->is_set()) {
+    // The grab needs the keymap, so no point in delaying the setup.
+    if (!keyboard->setup()) {
+      std::cerr << "Failed to initialize XKB." << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (!keyboard->grab_key(screen->root, popup->arg())) {
+      std::cerr << "Unable to grab " << popup->arg() << ", unknown key or"
+                << " already grabbed by another client." << std::endl;
+      return EXIT_FAILURE;
     }
+    first_paint = false;
+    timing.phase("grab key");
+    startup_scope.reset();
+    timing.print(std::cerr);
+  }
 
-    if (invalidate) {
-      invalidate = false;
-      cairo_rectangle(cr.get(), invalidate_rect.x, invalidate_rect.y,
-                      invalidate_rect.width, invalidate_rect.height);
-      if (current) {
-        cairo_save(cr.get());
-        cairo_clip(cr.get());
-        auto org_w = cairo_image_surface_get_width(current.get());
-        auto org_h = cairo_image_surface_get_height(current.get());
-        auto w = org_w;
-        auto h = org_h;
-        while (true) {
-          if (w * 2 > wnd_width || h * 2 > wnd_height)
-            break;
-          w *= 2;
-          h *= 2;
-        }
-        auto x = (wnd_width - w) / 2;
-        auto y = (wnd_height - h) / 2;
-        if (x > 0) {
-          cairo_rectangle(cr.get(), 0, 0, x, wnd_height);
-          cairo_rectangle(cr.get(), x + w, 0, wnd_width - (x + w), wnd_height);
-        }
-        if (y > 0) {
-          cairo_rectangle(cr.get(), x, 0, w, y);
-          cairo_rectangle(cr.get(), x, y + h, w, wnd_height - (y + h));
-        }
-        cairo_set_source_rgb(cr.get(), 1.0, 1.0, 1.0);
-        cairo_fill(cr.get());
-        cairo_translate(cr.get(), x, y);
-        cairo_scale(cr.get(), static_cast<double>(w) / org_w,
-                    static_cast<double>(h) / org_h);
-        cairo_set_source_surface(cr.get(), current.get(), 0, 0);
-        cairo_pattern_set_filter(cairo_get_source(cr.get()),
-                                 CAIRO_FILTER_NEAREST);
-        cairo_paint(cr.get());
-        cairo_restore(cr.get());
-      } else {
-        cairo_set_source_rgb(cr.get(), 1.0, 1.0, 1.0);
-        cairo_fill(cr.get());
+  while (true) {
+    controller->run();
+
+    if (first_paint && controller->painted()) {
+      first_paint = false;
+      timing.phase("first paint");
+      // Keymap isn't needed for the first frame, so wait until now.
+      if (!keyboard->setup()) {
+        std::cerr << "Failed to initialize XKB." << std::endl;
+        return EXIT_FAILURE;
       }
-      cairo_surface_flush(surface.get());
-      flush = true;
+      timing.phase("keyboard");
+      startup_scope.reset();
+      timing.print(std::cerr);
     }
 
-    if (flush)
-      xcb_flush(conn.get());
-
-    xcb::generic_event event(xcb_wait_for_event(conn.get()));
+    auto wakeup = controller->wakeup();
+    auto event = source->next_event(wakeup);
     if (!event) {
       auto err = xcb_connection_has_error(conn.get());
+      if (wakeup && !err)
+        continue;
       if (err) {
         std::cerr << "X connection had fatal error: " << err << std::endl;
       } else {
@@ -430,128 +419,27 @@ int main(int argc, char** argv) {
       return EXIT_FAILURE;
     }
     auto response_type = XCB_EVENT_RESPONSE_TYPE(event.get());
-    if (response_type == XCB_SELECTION_NOTIFY) {
-      auto* e = reinterpret_cast<xcb_selection_notify_event_t*>(event.get());
-      if (e->selection == selection && e->requestor == wnd->id() &&
-          e->time == request_time) {
-#ifndef NDEBUG
-        out_dbg << "Selection Notify " << e->time << std::endl;
-#endif
-        auto it = active_request.find(e->property);
-        if (it != active_request.end()) {
-          if (it->second.property_notify) {
-            // Already handled by XCB_PROPERTY_NOTIFY
-          } else {
-            assert(!read_property);
-            read_property = e->property;
-            property_wnd = e->requestor;
-          }
-          active_request.erase(it);
-        } else if (e->property) {
-          assert(!read_property);
-          read_property = e->property;
-          property_wnd = e->requestor;
+    if (response_type == XCB_KEY_PRESS) {
+      auto* e = reinterpret_cast<xcb_key_press_event_t*>(event.get());
+      if (popup->is_set() && keyboard->is_grabbed(e)) {
+        if (shown) {
+          hide();
         } else {
-          // Target format not supported, try with STRING if using UTF8_STRING
-#ifndef NDEBUG
-          out_dbg << "Format not supported (tried " << e->target << ")"
-                  << std::endl;
-#endif
-          if (e->target == utf8_string.get()) {
-            request_queued = true;
-            request_time = e->time;
-            request_type = string_atom.get();
-          }
-        }
-      }
-      continue;
-    } else if (response_type == XCB_PROPERTY_NOTIFY) {
-      auto* e = reinterpret_cast<xcb_property_notify_event_t*>(event.get());
-#ifndef NDEBUG
-      out_dbg << "Property Notify " << static_cast<int>(e->state)
-              << " " << e->time << std::endl;
-#endif
-      if (e->window == wnd->id() && e->atom == incr_property) {
-        if (e->state == XCB_PROPERTY_NEW_VALUE) {
-          auto cookie = xcb_get_property(
-              conn.get(), 1 /* delete */, wnd->id(), incr_property,
-              XCB_GET_PROPERTY_TYPE_ANY,
-              0, std::numeric_limits<uint32_t>::max() / 4);
-          xcb_generic_error_t* err = nullptr;
-          xcb::reply<xcb_get_property_reply_t> reply(
-              xcb_get_property_reply(conn.get(), cookie, &err));
-          if (reply) {
-            auto len = xcb_get_property_value_length(reply.get());
-#ifndef NDEBUG
-            out_dbg << "Incr got " << len << std::endl;
-#endif
-            if (len == 0) {
-              if (incr_data != current_data) {
-                current_data = incr_data;
-                update_code = true;
-              }
-              incr_data.clear();
-              incr_property = XCB_NONE;
-            } else {
-              if (reply->type == utf8_string.get() ||
-                  reply->type == string_atom.get()) {
-                incr_data.append(reinterpret_cast<char*>(
-                                     xcb_get_property_value(reply.get())),
-                                 len);
-              } else {
-                std::cerr << "Unsupported property notify type: "
-                          << reply->type << std::endl;
-                // Even if we don't understand the type we need to continue
-                // to delete the property or the owner will hang waiting for
-                // us.
-              }
-            }
-          } else {
-            std::cerr << "Error getting property: " <<
-              xcb_event_get_error_label(err->error_code) << std::endl;
-            free(err);
-          }
-        }
-      } else if (e->window == wnd->id() && e->state == XCB_PROPERTY_NEW_VALUE) {
-        auto it = active_request.find(e->atom);
-        if (it != active_request.end()) {
-          // Some clients never reply with a SelectionNotify but they do
-          // update the property. So read it as soon as it changes.
-          assert(!read_property);
-          read_property = e->atom;
-          property_wnd = e->window;
-          it->second.property_notify = true;
+          shown = true;
+          shown_time = e->time;
+          controller->refresh(e->time);
+          xcb_map_window(conn.get(), window.id);
+          xcb_flush(conn.get());
         }
+        continue;
       }
-      continue;
-    } else if (response_type ==
-               xfixes_reply->first_event + XCB_XFIXES_SELECTION_NOTIFY) {
-      auto* e = reinterpret_cast<xcb_xfixes_selection_notify_event_t*>(
-          event.get());
-      if (e->selection == selection) {
-#ifndef NDEBUG
-        out_dbg << "Xfixes selection notify" << std::endl;
-#endif
-        request_queued = true;
-        request_time = e->timestamp;
-        request_type = utf8_string.get();
-      }
-      continue;
-    } else if (response_type == XCB_EXPOSE) {
-      auto* e = reinterpret_cast<xcb_expose_event_t*>(event.get());
-      if (e->window == wnd->id()) {
-        invalidate = true;
-        invalidate_rect.x = e->x;
-        invalidate_rect.y = e->y;
-        invalidate_rect.width = e->width;
-        invalidate_rect.height = e->height;
-      }
-      continue;
-    } else if (response_type == XCB_KEY_PRESS) {
-      auto* e = reinterpret_cast<xcb_key_press_event_t*>(event.get());
-      if (e->event == wnd->id()) {
+      if (e->event == window.id) {
         auto str = keyboard->get_utf8(e);
         if (str == "q" || str == "\x1b" /* Escape */) {
+          if (popup->is_set()) {
+            hide();
+            continue;
+          }
           // Quit
           break;
         }
@@ -559,25 +447,28 @@ int main(int argc, char** argv) {
       continue;
     } else if (response_type == XCB_CONFIGURE_NOTIFY) {
       auto* e = reinterpret_cast<xcb_configure_notify_event_t*>(event.get());
-      if (e->window == wnd->id()) {
-        wnd_width = e->width;
-        wnd_height = e->height;
-        cairo_xcb_surface_set_size(surface.get(), e->width, e->height);
+      if (e->window == window.id)
+        resize_canvas(canvas.get(), e->width, e->height);
+      // Controller also needs to know the size.
+    } else if (response_type == XCB_MAP_NOTIFY && popup->is_set()) {
+      auto* e = reinterpret_cast<xcb_map_notify_event_t*>(event.get());
+      // Needs focus for q and Escape to reach the window.
+      if (e->window == window.id && shown) {
+        xcb_set_input_focus(conn.get(), XCB_INPUT_FOCUS_PARENT, window.id,
+                            shown_time);
       }
-      continue;
-    } else if (response_type == XCB_REPARENT_NOTIFY) {
-      // Ignored, part of XCB_EVENT_MASK_STRUCTURE_NOTIFY
-      continue;
-    } else if (response_type == XCB_MAP_NOTIFY) {
-      // Ignored, part of XCB_EVENT_MASK_STRUCTURE_NOTIFY
-      continue;
+      // Controller also needs to know the window is mapped.
     } else if (keyboard->handle_event(conn.get(), event.get())) {
       continue;
     } else if (response_type == XCB_CLIENT_MESSAGE) {
       auto* e = reinterpret_cast<xcb_client_message_event_t*>(event.get());
-      if (e->window == wnd->id() && e->type == wm_protocols.get() &&
+      if (e->window == window.id && e->type == startup->wm_protocols() &&
           e->format == 32) {
-        if (e->data.data32[0] == wm_delete_window.get()) {
+        if (e->data.data32[0] == startup->wm_delete_window()) {
+          if (popup->is_set()) {
+            hide();
+            continue;
+          }
           // Quit
           break;
         }
@@ -585,6 +476,9 @@ int main(int argc, char** argv) {
       continue;
     }
 
+    if (controller->handle(event.get()))
+      continue;
+
 #ifndef NDEBUG
     if (response_type == 0) {
       auto* e = reinterpret_cast<xcb_generic_error_t*>(event.get());
@@ -597,5 +491,13 @@ int main(int argc, char** argv) {
 #endif
   }
 
+  if (rewrite_stats->is_set() && rewriter)
+    rewriter->print_stats(std::cerr);
+  controller->print_stats(std::cerr);
+  if (stats_opt->is_set())
+    stats->print(std::cerr);
+  if (trace_opt->is_set() && !trace::dump(trace_opt->arg().c_str()))
+    std::cerr << trace_opt->arg() << ": Unable to write trace" << std::endl;
+
   return EXIT_SUCCESS;
 }
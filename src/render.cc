@@ -0,0 +1,162 @@
+#include "common.hh"
+
+#include "render.hh"
+#include "render_backend.hh"
+
+#include <algorithm>
+#include <math.h>
+
+namespace {
+
+// Width of version 1 and 40 codes
+constexpr int kMinWidth = 21;
+constexpr int kMaxWidth = 177;
+
+// Modules of white around each code in a grid, as required by the spec.
+constexpr int kQuietZone = 4;
+
+bool valid_width(int width) {
+  return width >= kMinWidth && width <= kMaxWidth &&
+    (width - kMinWidth) % 4 == 0;
+}
+
+CodeLayout layout_cell(int code_width, int x, int y, int width, int height,
+                       int margin) {
+  int scale = 1;
+  while ((code_width + 2 * margin) * scale * 2 <= width &&
+         (code_width + 2 * margin) * scale * 2 <= height)
+    scale *= 2;
+  auto size = code_width * scale;
+  return { scale, x + (width - size) / 2, y + (height - size) / 2, size };
+}
+
+// Returns false if a and b don't overlap.
+bool intersect(xcb_rectangle_t const& a, xcb_rectangle_t const& b,
+               xcb_rectangle_t* out) {
+  int x1 = std::max<int>(a.x, b.x);
+  int y1 = std::max<int>(a.y, b.y);
+  int x2 = std::min<int>(a.x + a.width, b.x + b.width);
+  int y2 = std::min<int>(a.y + a.height, b.y + b.height);
+  if (x1 >= x2 || y1 >= y2)
+    return false;
+  *out = { static_cast<int16_t>(x1), static_cast<int16_t>(y1),
+           static_cast<uint16_t>(x2 - x1), static_cast<uint16_t>(y2 - y1) };
+  return true;
+}
+
+}  // namespace
+
+CodeImage* SurfacePool::get(int width) {
+  if (!valid_width(width))
+    return nullptr;
+  auto& image = image_[(width - kMinWidth) / 4];
+  if (!image)
+    image = create_image(width);
+  return image.get();
+}
+
+CodeImage* rasterize(SurfacePool& pool, int width, uint8_t const* modules) {
+  auto* ret = pool.get(width);
+  if (ret)
+    rasterize_into(ret, width, modules);
+  return ret;
+}
+
+CodeCache::CodeCache(size_t capacity)
+  : capacity_(capacity) {
+  entry_.reserve(capacity);
+}
+
+CodeImage* CodeCache::find(uint64_t hash) {
+  for (auto& entry : entry_) {
+    if (entry.hash == hash) {
+      entry.used = ++clock_;
+      ++hits_;
+      return entry.image.get();
+    }
+  }
+  ++misses_;
+  return nullptr;
+}
+
+CodeImage* CodeCache::insert(uint64_t hash, int width,
+                             uint8_t const* modules) {
+  if (!valid_width(width))
+    return nullptr;
+  Entry* entry;
+  if (entry_.size() < capacity_) {
+    entry = &entry_.emplace_back();
+  } else {
+    entry = &*std::min_element(
+        entry_.begin(), entry_.end(), [] (auto const& a, auto const& b) {
+          return a.used < b.used;
+        });
+    // Images are the same size for codes of the same version.
+    if (image_width(entry->image.get()) != width)
+      entry->image.reset();
+  }
+  if (!entry->image)
+    entry->image = create_image(width);
+  entry->hash = hash;
+  entry->used = ++clock_;
+  rasterize_into(entry->image.get(), width, modules);
+  return entry->image.get();
+}
+
+CodeLayout layout_code(int code_width, uint16_t width, uint16_t height) {
+  return layout_cell(code_width, 0, 0, width, height, 0);
+}
+
+void paint(Canvas* canvas, CodeImage const* code,
+           xcb_rectangle_t const& area, uint16_t width, uint16_t height) {
+  if (code) {
+    paint(canvas, code, layout_code(image_width(code), width, height), area,
+          width, height);
+  } else {
+    paint_white(canvas, area);
+  }
+}
+
+void paint(Canvas* canvas, CodeImage const* code, CodeLayout const& layout,
+           xcb_rectangle_t const& area, uint16_t width, uint16_t height) {
+  xcb_rectangle_t const window{ 0, 0, width, height };
+  xcb_rectangle_t clip;
+  if (!intersect(area, window, &clip))
+    return;
+  if (code) {
+    paint_cell(canvas, code, layout, window, clip);
+  } else {
+    paint_white(canvas, clip);
+  }
+}
+
+void paint_grid(Canvas* canvas, CodeImage const* const* codes,
+                size_t count, xcb_rectangle_t const& area, uint16_t width,
+                uint16_t height) {
+  // As square as possible, wider than high if it can't be square.
+  int const columns = std::max<int>(1, ceil(sqrt(count)));
+  int const rows = std::max<int>(1, (count + columns - 1) / columns);
+  for (int row = 0; row < rows; ++row) {
+    int const y = row * height / rows;
+    int const cell_height = (row + 1) * height / rows - y;
+    for (int column = 0; column < columns; ++column) {
+      int const x = column * width / columns;
+      int const cell_width = (column + 1) * width / columns - x;
+      xcb_rectangle_t const cell{
+        static_cast<int16_t>(x), static_cast<int16_t>(y),
+        static_cast<uint16_t>(cell_width), static_cast<uint16_t>(cell_height)
+      };
+      xcb_rectangle_t clip;
+      if (!intersect(cell, area, &clip))
+        continue;
+      size_t const i = row * columns + column;
+      if (i < count && codes[i]) {
+        auto layout = layout_cell(image_width(codes[i]), x, y, cell_width,
+                                  cell_height, kQuietZone);
+        paint_cell(canvas, codes[i], layout, cell, clip);
+      } else {
+        paint_white(canvas, clip);
+      }
+    }
+  }
+}
@@ -0,0 +1,128 @@
+#ifndef RENDER_HH
+#define RENDER_HH
+
+#include "qr_capacity.hh"
+
+#include <array>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <xcb/xcb.h>
+
+// Painting goes through cairo, or through plain xcb requests when built
+// with -Dcairo=false, see render_cairo.cc and render_xcb.cc.
+
+// A code rasterized for painting.
+struct CodeImage;
+// What paint() draws on, a window or an image in memory.
+struct Canvas;
+
+struct CodeImageDeleter {
+  void operator() (CodeImage* image) const;
+};
+
+struct CanvasDeleter {
+  void operator() (Canvas* canvas) const;
+};
+
+typedef std::unique_ptr<CodeImage, CodeImageDeleter> unique_image;
+typedef std::unique_ptr<Canvas, CanvasDeleter> unique_canvas;
+
+// Paints window, created with the root visual of screen. Returns nullptr
+// on error.
+unique_canvas make_window_canvas(xcb_connection_t* conn,
+                                 xcb_screen_t const* screen,
+                                 xcb_window_t window, uint16_t width,
+                                 uint16_t height);
+
+// Not shown anywhere, for replays, tests and benchmarks.
+unique_canvas make_memory_canvas(uint16_t width, uint16_t height);
+
+// Must be called when the window size changes.
+void resize_canvas(Canvas* canvas, uint16_t width, uint16_t height);
+
+// Hands everything painted to the X connection, which the caller flushes.
+void flush_canvas(Canvas* canvas);
+
+// Width of image in modules.
+int image_width(CodeImage const* image);
+
+// One image per code width, reused for every code of that size.
+class SurfacePool {
+public:
+  // Returns nullptr if width isn't the width of any QR code version.
+  CodeImage* get(int width);
+
+private:
+  std::array<unique_image, kQRMaxVersion> image_;
+};
+
+// Rasterized codes by Snapshot::hash() of their payload, the least
+// recently used is replaced when full. Unlike SurfacePool each code has an
+// image of its own, so several can be shown at once.
+class CodeCache {
+public:
+  explicit CodeCache(size_t capacity);
+
+  // Returns nullptr if hash isn't cached.
+  CodeImage* find(uint64_t hash);
+
+  // See rasterize(). Returns nullptr if width isn't the width of any QR
+  // code version.
+  CodeImage* insert(uint64_t hash, int width, uint8_t const* modules);
+
+  uint64_t hits() const {
+    return hits_;
+  }
+
+  uint64_t misses() const {
+    return misses_;
+  }
+
+private:
+  struct Entry {
+    uint64_t hash;
+    uint64_t used;
+    unique_image image;
+  };
+
+  size_t const capacity_;
+  std::vector<Entry> entry_;
+  uint64_t clock_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+// modules is width * width bytes, bit 0 set for dark modules, same as
+// QRcode::data. Returned image is owned by pool.
+CodeImage* rasterize(SurfacePool& pool, int width, uint8_t const* modules);
+
+// Where paint() puts a code of code_width modules in a width x height
+// window: scaled up by scale and with its top left corner at x, y.
+struct CodeLayout {
+  int scale;
+  int x;
+  int y;
+  int size;
+};
+
+CodeLayout layout_code(int code_width, uint16_t width, uint16_t height);
+
+// Paints area of a width x height window. code, if not null, is scaled up
+// by the largest power of two that fits and centered, everything else is
+// painted white.
+void paint(Canvas* canvas, CodeImage const* code,
+           xcb_rectangle_t const& area, uint16_t width, uint16_t height);
+
+// Same as paint() but with code at layout instead of centered.
+void paint(Canvas* canvas, CodeImage const* code, CodeLayout const& layout,
+           xcb_rectangle_t const& area, uint16_t width, uint16_t height);
+
+// Same as paint() but for count codes laid out in a grid of equally sized
+// cells, each with a quiet zone so they can be scanned one at a time.
+void paint_grid(Canvas* canvas, CodeImage const* const* codes,
+                size_t count, xcb_rectangle_t const& area, uint16_t width,
+                uint16_t height);
+
+#endif  // RENDER_HH
@@ -0,0 +1,23 @@
+#ifndef RENDER_BACKEND_HH
+#define RENDER_BACKEND_HH
+
+#include "render.hh"
+
+// What render.cc needs from render_cairo.cc or render_xcb.cc.
+
+// Image for codes of width modules.
+unique_image create_image(int width);
+
+// modules as for rasterize(), width must be the width image was created
+// with.
+void rasterize_into(CodeImage* image, int width, uint8_t const* modules);
+
+// Paints the part of cell inside clip, with code where layout says and the
+// rest white. clip is inside cell.
+void paint_cell(Canvas* canvas, CodeImage const* code,
+                CodeLayout const& layout, xcb_rectangle_t const& cell,
+                xcb_rectangle_t const& clip);
+
+void paint_white(Canvas* canvas, xcb_rectangle_t const& area);
+
+#endif  // RENDER_BACKEND_HH
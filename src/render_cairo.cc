@@ -0,0 +1,146 @@
+#include "common.hh"
+
+#include "render.hh"
+#include "render_backend.hh"
+
+#include <algorithm>
+#include <cairo-xcb.h>
+
+struct CodeImage {
+  cairo_surface_t* surface;
+};
+
+struct Canvas {
+  cairo_surface_t* surface;
+  cairo_t* cr;
+};
+
+namespace {
+
+xcb_visualtype_t* find_visual(xcb_screen_t const* screen,
+                              xcb_visualid_t visual) {
+  auto depth_iter = xcb_screen_allowed_depths_iterator(screen);
+  for (; depth_iter.rem; xcb_depth_next(&depth_iter)) {
+    auto visual_iter = xcb_depth_visuals_iterator(depth_iter.data);
+    for (; visual_iter.rem; xcb_visualtype_next(&visual_iter))
+      if (visual == visual_iter.data->visual_id)
+        return visual_iter.data;
+  }
+  return nullptr;
+}
+
+unique_canvas make_canvas(cairo_surface_t* surface) {
+  if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy(surface);
+    return nullptr;
+  }
+  return unique_canvas(new Canvas{ surface, cairo_create(surface) });
+}
+
+}  // namespace
+
+void CodeImageDeleter::operator() (CodeImage* image) const {
+  cairo_surface_destroy(image->surface);
+  delete image;
+}
+
+void CanvasDeleter::operator() (Canvas* canvas) const {
+  cairo_destroy(canvas->cr);
+  cairo_surface_destroy(canvas->surface);
+  delete canvas;
+}
+
+unique_canvas make_window_canvas(xcb_connection_t* conn,
+                                 xcb_screen_t const* screen,
+                                 xcb_window_t window, uint16_t width,
+                                 uint16_t height) {
+  auto* visual = find_visual(screen, screen->root_visual);
+  if (!visual)
+    return nullptr;
+  return make_canvas(cairo_xcb_surface_create(conn, window, visual, width,
+                                              height));
+}
+
+unique_canvas make_memory_canvas(uint16_t width, uint16_t height) {
+  return make_canvas(cairo_image_surface_create(CAIRO_FORMAT_RGB24, width,
+                                                height));
+}
+
+void resize_canvas(Canvas* canvas, uint16_t width, uint16_t height) {
+  if (cairo_surface_get_type(canvas->surface) == CAIRO_SURFACE_TYPE_XCB)
+    cairo_xcb_surface_set_size(canvas->surface, width, height);
+}
+
+void flush_canvas(Canvas* canvas) {
+  cairo_surface_flush(canvas->surface);
+}
+
+int image_width(CodeImage const* image) {
+  return cairo_image_surface_get_width(image->surface);
+}
+
+unique_image create_image(int width) {
+  return unique_image(new CodeImage{
+      cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, width) });
+}
+
+void rasterize_into(CodeImage* image, int width, uint8_t const* modules) {
+  auto* surface = image->surface;
+  auto stride = cairo_image_surface_get_stride(surface);
+  cairo_surface_flush(surface);
+  auto* data = cairo_image_surface_get_data(surface);
+  if (data) {
+    for (int y = 0; y < width; ++y) {
+      auto* out_row = data + y * stride;
+      auto* in_row = modules + y * width;
+      for (int x = 0; x < width; ++x) {
+        auto c = (*in_row & 1) ? 0 : 0xff;
+        std::fill_n(out_row, 4, c);
+        ++in_row;
+        out_row += 4;
+      }
+    }
+  }
+  cairo_surface_mark_dirty(surface);
+}
+
+void paint_cell(Canvas* canvas, CodeImage const* code,
+                CodeLayout const& layout, xcb_rectangle_t const& cell,
+                xcb_rectangle_t const& clip) {
+  auto* cr = canvas->cr;
+  int const x = cell.x;
+  int const y = cell.y;
+  int const width = cell.width;
+  int const height = cell.height;
+  auto code_x = layout.x;
+  auto code_y = layout.y;
+  auto size = layout.size;
+  cairo_save(cr);
+  cairo_rectangle(cr, clip.x, clip.y, clip.width, clip.height);
+  cairo_clip(cr);
+  if (code_x > x) {
+    cairo_rectangle(cr, x, y, code_x - x, height);
+    cairo_rectangle(cr, code_x + size, y, x + width - (code_x + size),
+                    height);
+  }
+  if (code_y > y) {
+    cairo_rectangle(cr, code_x, y, size, code_y - y);
+    cairo_rectangle(cr, code_x, code_y + size, size,
+                    y + height - (code_y + size));
+  }
+  cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+  cairo_fill(cr);
+  cairo_translate(cr, code_x, code_y);
+  cairo_scale(cr, layout.scale, layout.scale);
+  cairo_set_source_surface(cr, code->surface, 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+  cairo_paint(cr);
+  cairo_restore(cr);
+}
+
+void paint_white(Canvas* canvas, xcb_rectangle_t const& area) {
+  auto* cr = canvas->cr;
+  cairo_rectangle(cr, area.x, area.y, area.width, area.height);
+  cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+  cairo_fill(cr);
+}
@@ -0,0 +1,197 @@
+#include "common.hh"
+
+#include "render.hh"
+#include "render_backend.hh"
+
+#include <algorithm>
+#include <vector>
+
+// Codes are kept as runs of dark and light modules, one row high, and
+// painted as filled rectangles scaled from those. Only the core protocol
+// is used, so nothing beyond libxcb is needed.
+
+namespace {
+
+// Width of a version 40 code.
+constexpr int kMaxWidth = 177;
+// Most runs of one color in a code of width modules, every other module.
+constexpr size_t max_runs(int width) {
+  return static_cast<size_t>(width) * ((width + 1) / 2);
+}
+// The borders around a code.
+constexpr size_t kMaxBorders = 4;
+
+}  // namespace
+
+struct CodeImage {
+  int width;
+  // In modules, in row order.
+  std::vector<xcb_rectangle_t> dark;
+  std::vector<xcb_rectangle_t> light;
+};
+
+struct Canvas {
+  // Null for a canvas in memory, then requests are built but not sent.
+  xcb_connection_t* conn;
+  xcb_window_t window;
+  xcb_gcontext_t black;
+  xcb_gcontext_t white;
+  // In window coordinates, reused for every paint.
+  std::vector<xcb_rectangle_t> dark;
+  std::vector<xcb_rectangle_t> light;
+};
+
+namespace {
+
+unique_canvas make_canvas(xcb_connection_t* conn, xcb_window_t window) {
+  unique_canvas canvas(new Canvas{ conn, window, XCB_NONE, XCB_NONE, {}, {} });
+  canvas->dark.reserve(max_runs(kMaxWidth));
+  canvas->light.reserve(max_runs(kMaxWidth) + kMaxBorders);
+  return canvas;
+}
+
+xcb_gcontext_t create_gc(xcb_connection_t* conn, xcb_window_t window,
+                         uint32_t pixel) {
+  auto gc = xcb_generate_id(conn);
+  uint32_t const values[] = { pixel, 0 };
+  xcb_create_gc(conn, gc, window,
+                XCB_GC_FOREGROUND | XCB_GC_GRAPHICS_EXPOSURES, values);
+  return gc;
+}
+
+// Adds rect to out if any of it is inside clip.
+void add_clipped(int x, int y, int width, int height,
+                 xcb_rectangle_t const& clip,
+                 std::vector<xcb_rectangle_t>& out) {
+  int x1 = std::max<int>(x, clip.x);
+  int y1 = std::max<int>(y, clip.y);
+  int x2 = std::min<int>(x + width, clip.x + clip.width);
+  int y2 = std::min<int>(y + height, clip.y + clip.height);
+  if (x1 < x2 && y1 < y2) {
+    out.push_back({ static_cast<int16_t>(x1), static_cast<int16_t>(y1),
+                    static_cast<uint16_t>(x2 - x1),
+                    static_cast<uint16_t>(y2 - y1) });
+  }
+}
+
+// Adds the runs of modules inside clip, scaled and moved to layout.
+void add_runs(std::vector<xcb_rectangle_t> const& runs,
+              CodeLayout const& layout, xcb_rectangle_t const& clip,
+              std::vector<xcb_rectangle_t>& out) {
+  auto const scale = layout.scale;
+  for (auto const& run : runs) {
+    int const y = layout.y + run.y * scale;
+    if (y + scale <= clip.y)
+      continue;
+    // Sorted by row, nothing after this is inside clip.
+    if (y >= clip.y + clip.height)
+      break;
+    add_clipped(layout.x + run.x * scale, y, run.width * scale, scale, clip,
+                out);
+  }
+}
+
+void fill(Canvas* canvas, xcb_gcontext_t gc,
+          std::vector<xcb_rectangle_t> const& rects) {
+  if (canvas->conn && !rects.empty()) {
+    xcb_poly_fill_rectangle(canvas->conn, canvas->window, gc, rects.size(),
+                            rects.data());
+  }
+}
+
+}  // namespace
+
+void CodeImageDeleter::operator() (CodeImage* image) const {
+  delete image;
+}
+
+void CanvasDeleter::operator() (Canvas* canvas) const {
+  if (canvas->conn) {
+    xcb_free_gc(canvas->conn, canvas->black);
+    xcb_free_gc(canvas->conn, canvas->white);
+  }
+  delete canvas;
+}
+
+unique_canvas make_window_canvas(xcb_connection_t* conn,
+                                 xcb_screen_t const* screen,
+                                 xcb_window_t window, uint16_t, uint16_t) {
+  auto canvas = make_canvas(conn, window);
+  canvas->black = create_gc(conn, window, screen->black_pixel);
+  canvas->white = create_gc(conn, window, screen->white_pixel);
+  return canvas;
+}
+
+unique_canvas make_memory_canvas(uint16_t, uint16_t) {
+  return make_canvas(nullptr, XCB_NONE);
+}
+
+void resize_canvas(Canvas*, uint16_t, uint16_t) {
+  // Drawing straight to the window, the server knows its size.
+}
+
+void flush_canvas(Canvas*) {
+  // Requests are already in the connection's output buffer.
+}
+
+int image_width(CodeImage const* image) {
+  return image->width;
+}
+
+unique_image create_image(int width) {
+  unique_image image(new CodeImage{ width, {}, {} });
+  image->dark.reserve(max_runs(width));
+  image->light.reserve(max_runs(width));
+  return image;
+}
+
+void rasterize_into(CodeImage* image, int width, uint8_t const* modules) {
+  image->dark.clear();
+  image->light.clear();
+  for (int y = 0; y < width; ++y) {
+    auto const* row = modules + y * width;
+    int x = 0;
+    while (x < width) {
+      bool const dark = row[x] & 1;
+      int end = x + 1;
+      while (end < width && static_cast<bool>(row[end] & 1) == dark)
+        ++end;
+      (dark ? image->dark : image->light).push_back(
+          { static_cast<int16_t>(x), static_cast<int16_t>(y),
+            static_cast<uint16_t>(end - x), 1 });
+      x = end;
+    }
+  }
+}
+
+void paint_cell(Canvas* canvas, CodeImage const* code,
+                CodeLayout const& layout, xcb_rectangle_t const& cell,
+                xcb_rectangle_t const& clip) {
+  canvas->dark.clear();
+  canvas->light.clear();
+  int const x = cell.x;
+  int const y = cell.y;
+  int const code_x = layout.x;
+  int const code_y = layout.y;
+  int const size = layout.size;
+  if (code_x > x) {
+    add_clipped(x, y, code_x - x, cell.height, clip, canvas->light);
+    add_clipped(code_x + size, y, x + cell.width - (code_x + size),
+                cell.height, clip, canvas->light);
+  }
+  if (code_y > y) {
+    add_clipped(code_x, y, size, code_y - y, clip, canvas->light);
+    add_clipped(code_x, code_y + size, size, y + cell.height - (code_y + size),
+                clip, canvas->light);
+  }
+  add_runs(code->light, layout, clip, canvas->light);
+  add_runs(code->dark, layout, clip, canvas->dark);
+  fill(canvas, canvas->white, canvas->light);
+  fill(canvas, canvas->black, canvas->dark);
+}
+
+void paint_white(Canvas* canvas, xcb_rectangle_t const& area) {
+  canvas->light.clear();
+  canvas->light.push_back(area);
+  fill(canvas, canvas->white, canvas->light);
+}
@@ -0,0 +1,107 @@
+#include "common.hh"
+
+#include "args.hh"
+#include "controller.hh"
+#include "event_record.hh"
+#include "render.hh"
+#include "stats.hh"
+#include "trace.hh"
+#include "url_rewrite.hh"
+
+#include <chrono>
+#include <iostream>
+
+// Drives Controller from a recording made with qrwnd --record, without an
+// X server. Painting is done to a canvas in memory.
+
+namespace {
+
+// Window size can change during the recording, the canvas only needs to
+// be large enough to not clip. Pages never painted are never touched.
+constexpr int kSurfaceSize = 4096;
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto args = Args::create();
+  auto* help = args->add_option('h', "help", "display this text and exit.");
+  auto* original_timing = args->add_option(
+      't', "original-timing", "replay at the recorded pace instead of as"
+      " fast as possible.");
+  auto* rewrite_rules = args->add_option_with_arg(
+      '\0', "rewrite-rules",
+      "strip URL tracking parameters using rules in FILE, default is to"
+      " not rewrite.", "FILE");
+  auto* trace_opt = args->add_option_with_arg(
+      '\0', "trace", "write a Chrome trace of the replay to FILE.", "FILE");
+  auto* stats_opt = args->add_option(
+      '\0', "stats", "print counters and latency histograms after the"
+      " replay.");
+  std::vector<std::string> arguments;
+  if (!args->run(argc, argv, "qrwnd-replay", std::cerr, &arguments)) {
+    std::cerr << "Try `qrwnd-replay --help` for usage." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (help->is_set()) {
+    std::cout << "Usage: `qrwnd-replay [OPTIONS] FILE`\n"
+              << "Replays a recording made with qrwnd --record.\n"
+              << "\n";
+    args->print_descriptions(std::cout, 80);
+    return EXIT_SUCCESS;
+  }
+  if (arguments.size() != 1) {
+    std::cerr << "Expected exactly one recording.\n"
+              << "Try `qrwnd-replay --help` for usage." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::unique_ptr<UrlRewriter> rewriter;
+  if (rewrite_rules->is_set()) {
+    rewriter = UrlRewriter::create();
+    if (!rewriter->load(rewrite_rules->arg(), std::cerr))
+      return EXIT_FAILURE;
+  }
+
+  auto replayer = EventReplayer::open(arguments[0], original_timing->is_set(),
+                                      std::cerr);
+  if (!replayer)
+    return EXIT_FAILURE;
+  auto const& header = replayer->header();
+
+  auto canvas = make_memory_canvas(kSurfaceSize, kSurfaceSize);
+
+  Stats stats;
+  auto start = std::chrono::steady_clock::now();
+  // No snapshot, the replay should not depend on what was shown last.
+  auto controller = Controller::create(
+      replayer.get(), header.window, header.atoms, header.options, canvas.get(),
+      &stats, rewriter.get(), nullptr, nullptr, nullptr);
+  while (true) {
+    controller->run();
+    if (replayer->done())
+      break;
+    auto event = replayer->next_event(controller->wakeup());
+    if (event)
+      controller->handle(event.get());
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  std::cout << "Replayed " << replayer->events() << " events and "
+            << replayer->replies() << " replies in " << elapsed.count()
+            << " ms\n"
+            << "Shown code hash: " << std::hex << controller->shown_hash()
+            << std::dec << std::endl;
+  controller->print_stats(std::cout);
+  if (stats_opt->is_set())
+    stats.print(std::cout);
+  if (trace_opt->is_set() && !trace::dump(trace_opt->arg().c_str())) {
+    std::cerr << trace_opt->arg() << ": Unable to write trace" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (replayer->diverged()) {
+    std::cerr << "Replay diverged from the recording." << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
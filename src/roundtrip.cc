@@ -0,0 +1,88 @@
+#include "common.hh"
+
+#include "roundtrip.hh"
+
+#include <array>
+#include <atomic>
+#include <iostream>
+
+namespace roundtrip {
+
+namespace {
+
+// Atomic as the stats thread prints them, updated by the main thread only.
+struct AtomicCounter {
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> blocked_ns{0};
+};
+
+std::array<AtomicCounter, kOps> g_counter;
+Op g_op = Op::OTHER;
+
+}  // namespace
+
+char const* name(Op op) {
+  switch (op) {
+  case Op::OTHER:
+    return "other";
+  case Op::STARTUP:
+    return "startup";
+  case Op::SELECTION_CHANGE:
+    return "selection_change";
+  case Op::INCR_CHUNK:
+    return "incr_chunk";
+  }
+  return "unknown";
+}
+
+Scope::Scope(Op op)
+  : previous_(g_op) {
+  g_op = op;
+}
+
+Scope::~Scope() {
+  g_op = previous_;
+}
+
+void account(uint64_t blocked_ns) {
+  auto& counter = g_counter[static_cast<size_t>(g_op)];
+  counter.count.fetch_add(1, std::memory_order_relaxed);
+  counter.blocked_ns.fetch_add(blocked_ns, std::memory_order_relaxed);
+}
+
+Counter get(Op op) {
+  auto const& counter = g_counter[static_cast<size_t>(op)];
+  return { counter.count.load(std::memory_order_relaxed),
+           counter.blocked_ns.load(std::memory_order_relaxed) };
+}
+
+void reset() {
+  for (auto& counter : g_counter) {
+    counter.count.store(0, std::memory_order_relaxed);
+    counter.blocked_ns.store(0, std::memory_order_relaxed);
+  }
+}
+
+void print(std::ostream& out) {
+  out << "  round trips:";
+  for (size_t i = 0; i < kOps; ++i) {
+    auto op = static_cast<Op>(i);
+    auto counter = get(op);
+    out << (i ? ", " : " ") << name(op) << ' ' << counter.count << " ("
+        << counter.blocked_ns / 1e6 << " ms)";
+  }
+  out << '\n';
+}
+
+void print_json(std::ostream& out) {
+  out << '{';
+  for (size_t i = 0; i < kOps; ++i) {
+    auto op = static_cast<Op>(i);
+    auto counter = get(op);
+    out << (i ? "," : "") << '"' << name(op) << "\":{\"count\":"
+        << counter.count << ",\"blocked_ns\":" << counter.blocked_ns << '}';
+  }
+  out << '}';
+}
+
+}  // namespace roundtrip
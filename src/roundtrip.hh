@@ -0,0 +1,85 @@
+#ifndef ROUNDTRIP_HH
+#define ROUNDTRIP_HH
+
+#include "trace.hh"
+#include "xcb_event.hh"
+
+#include <iosfwd>
+#include <stddef.h>
+#include <stdint.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+
+// Accounting of blocking X round trips, and the time spent blocked in
+// them, per logical operation. Only calls that go through wait_reply() are
+// seen, libraries doing their own requests, like xkbcommon-x11, are not.
+
+namespace roundtrip {
+
+enum class Op : uint8_t {
+  // Anything not inside a Scope.
+  OTHER,
+  STARTUP,
+  SELECTION_CHANGE,
+  INCR_CHUNK,
+};
+
+constexpr size_t kOps = 4;
+
+char const* name(Op op);
+
+struct Counter {
+  uint64_t count;
+  uint64_t blocked_ns;
+};
+
+// Round trips are accounted to op until the scope ends.
+class Scope {
+public:
+  explicit Scope(Op op);
+  ~Scope();
+
+private:
+  Scope(Scope const&) = delete;
+  Scope& operator=(Scope const&) = delete;
+
+  Op const previous_;
+};
+
+// Accounts one round trip to the current operation.
+void account(uint64_t blocked_ns);
+
+Counter get(Op op);
+
+void reset();
+
+void print(std::ostream& out);
+
+// JSON object with a {"count", "blocked_ns"} object per operation.
+void print_json(std::ostream& out);
+
+// Same as xcb_<request>_reply(conn, cookie, err). A reply already read
+// from the connection, like the second of two pipelined requests, isn't
+// counted as a round trip.
+template<typename Reply, typename Cookie>
+xcb::reply<Reply> wait_reply(xcb_connection_t* conn, Cookie cookie,
+                             xcb_generic_error_t** err) {
+  void* reply = nullptr;
+  xcb_generic_error_t* error = nullptr;
+  if (xcb_poll_for_reply(conn, cookie.sequence, &reply, &error)) {
+    if (err) {
+      *err = error;
+    } else {
+      free(error);
+    }
+    return xcb::reply<Reply>(reinterpret_cast<Reply*>(reply));
+  }
+  auto start = trace::now_ns();
+  reply = xcb_wait_for_reply(conn, cookie.sequence, err);
+  account(trace::now_ns() - start);
+  return xcb::reply<Reply>(reinterpret_cast<Reply*>(reply));
+}
+
+}  // namespace roundtrip
+
+#endif  // ROUNDTRIP_HH
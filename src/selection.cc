@@ -0,0 +1,85 @@
+#include "common.hh"
+
+#include "selection.hh"
+#include "trace.hh"
+
+bool looks_like_url(std::string_view str) {
+  if (str.empty())
+    return false;
+  if (str.find(' ') != std::string::npos)
+    return false;
+  return str.find("://") != std::string::npos;
+}
+
+void RequestTable::set_properties(
+    std::array<xcb_atom_t, kTargetProperties> const& properties) {
+  for (size_t i = 0; i < kTargetProperties; ++i)
+    slot_[i].property = properties[i];
+}
+
+xcb_atom_t RequestTable::acquire(
+    std::chrono::steady_clock::time_point expire) {
+  for (auto& request : slot_) {
+    if (!request.active) {
+      request.active = true;
+      request.property_notify = false;
+      request.expire = expire;
+      request.sent_ns = trace::now_ns();
+      ++active_;
+      return request.property;
+    }
+  }
+  assert(false);
+  return XCB_NONE;
+}
+
+RequestTable::Request* RequestTable::find(xcb_atom_t property) {
+  for (auto& request : slot_) {
+    if (request.active && request.property == property)
+      return &request;
+  }
+  return nullptr;
+}
+
+void RequestTable::release(Request* request) {
+  assert(request->active);
+  request->active = false;
+  --active_;
+}
+
+size_t RequestTable::expire(std::chrono::steady_clock::time_point now) {
+  size_t timed_out = 0;
+  for (auto& request : slot_) {
+    if (request.active && request.expire <= now) {
+      if (!request.property_notify)
+        ++timed_out;
+      release(&request);
+    }
+  }
+  return timed_out;
+}
+
+IncrReader::IncrReader(size_t reserve) {
+  data_.reserve(reserve);
+}
+
+void IncrReader::start(xcb_atom_t property, size_t size) {
+  property_ = property;
+  data_.clear();
+  data_.reserve(size);
+  chunks_ = 0;
+}
+
+void IncrReader::append(std::string_view chunk) {
+  data_.append(chunk);
+  ++chunks_;
+}
+
+bool IncrReader::finish(std::string& data) {
+  property_ = XCB_NONE;
+  bool changed = data_ != data;
+  if (changed)
+    data_.swap(data);
+  data_.clear();
+  return changed;
+}
@@ -0,0 +1,96 @@
+#ifndef SELECTION_HH
+#define SELECTION_HH
+
+#include <array>
+#include <chrono>
+#include <stddef.h>
+#include <string>
+#include <string_view>
+#include <xcb/xproto.h>
+
+// Number of properties used to receive selection content, allows for that
+// many outstanding ConvertSelection requests.
+constexpr size_t kTargetProperties = 10;
+
+bool looks_like_url(std::string_view str);
+
+// Outstanding ConvertSelection requests, one fixed slot per target
+// property.
+class RequestTable {
+public:
+  struct Request {
+    xcb_atom_t property = XCB_NONE;
+    bool active = false;
+    bool property_notify = false;
+    std::chrono::steady_clock::time_point expire;
+    // trace::now_ns() when acquired.
+    uint64_t sent_ns = 0;
+  };
+
+  void set_properties(
+      std::array<xcb_atom_t, kTargetProperties> const& properties);
+
+  size_t size() const {
+    return active_;
+  }
+
+  bool full() const {
+    return active_ == kTargetProperties;
+  }
+
+  // Returns the property of the claimed slot, there must be a free one.
+  xcb_atom_t acquire(std::chrono::steady_clock::time_point expire);
+
+  Request* find(xcb_atom_t property);
+
+  void release(Request* request);
+
+  // Releases all expired requests. Returns the number of them that the
+  // owner never even touched the property for.
+  size_t expire(std::chrono::steady_clock::time_point now);
+
+private:
+  std::array<Request, kTargetProperties> slot_;
+  size_t active_ = 0;
+};
+
+// Reassembles selection content sent in chunks using the INCR protocol.
+class IncrReader {
+public:
+  explicit IncrReader(size_t reserve);
+
+  bool active() const {
+    return property_ != XCB_NONE;
+  }
+
+  // XCB_NONE unless active()
+  xcb_atom_t property() const {
+    return property_;
+  }
+
+  // size is the lower bound sent by the owner, zero if unknown.
+  void start(xcb_atom_t property, size_t size);
+
+  void append(std::string_view chunk);
+
+  // Bytes received so far.
+  size_t size() const {
+    return data_.size();
+  }
+
+  // Chunks appended since start().
+  size_t chunks() const {
+    return chunks_;
+  }
+
+  // Ends the transfer. If the content differs from data it's swapped into
+  // data, keeping both buffers allocated. Returns true if data changed.
+  bool finish(std::string& data);
+
+private:
+  xcb_atom_t property_ = XCB_NONE;
+  std::string data_;
+  size_t chunks_ = 0;
+};
+
+#endif  // SELECTION_HH
@@ -0,0 +1,345 @@
+#include "common.hh"
+
+#include "shared_cache.hh"
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char const kMagic[8] = { 'Q', 'R', 'W', 'N', 'D', 'S', 'C', '1' };
+// Width of version 1 and 40 codes
+constexpr uint32_t kMinWidth = 21;
+constexpr uint32_t kMaxWidth = 177;
+static_assert(kMaxWidth * kMaxWidth == SharedCache::kMaxModules);
+// Capacity of a version 40 code, see qr_capacity_8bit().
+constexpr size_t kMaxPayload = 2953;
+constexpr size_t kMaxBits = (SharedCache::kMaxModules + 7) / 8;
+
+constexpr uint32_t kWays = 4;
+constexpr uint32_t kBuckets = 64;
+// A writer holding an entry busy for longer than this is assumed to be
+// stuck, writing an entry takes microseconds.
+constexpr uint64_t kStaleClaimNs = 1000000000;
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+              std::atomic<uint64_t>::is_always_lock_free,
+              "Atomics in shared memory must be lock free");
+
+// seq is odd while the entry is written, readers copy everything and
+// then check that seq didn't change. The rest is only written with seq
+// odd, by the writer that made it odd.
+struct Slot {
+  std::atomic<uint32_t> seq;
+  // Of the writer, zero when seq is even, between making seq odd and
+  // storing claimed_ns, and while a stale claim is taken over.
+  std::atomic<uint32_t> writer_pid;
+  // CLOCK_MONOTONIC when seq was made odd, valid when writer_pid is set.
+  std::atomic<uint64_t> claimed_ns;
+  // Of the last lookup or store, to pick what to replace.
+  std::atomic<uint64_t> used_ns;
+  uint64_t hash;
+  // Of everything below, in case a stuck writer wakes up and writes over
+  // the one that reclaimed the entry.
+  uint64_t checksum;
+  uint32_t payload_size;
+  uint16_t version;
+  uint16_t width;
+  uint8_t payload[kMaxPayload];
+  // One bit per module, row by row.
+  uint8_t bits[kMaxBits];
+};
+
+// Guards against files made by a version with another layout.
+struct Layout {
+  char magic[8];
+  uint32_t buckets;
+  uint32_t ways;
+  uint32_t slot_size;
+  uint32_t reserved;
+};
+
+struct Header {
+  Layout layout;
+  std::atomic<uint64_t> hits;
+  std::atomic<uint64_t> misses;
+};
+
+constexpr size_t kFileSize = sizeof(Header) +
+  sizeof(Slot) * kBuckets * kWays;
+
+uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// FNV-1a, continuing from hash.
+uint64_t checksum(uint64_t hash, void const* data, size_t size) {
+  auto const* ptr = reinterpret_cast<uint8_t const*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= ptr[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+uint64_t slot_checksum(uint64_t hash, uint32_t payload_size, int version,
+                       int width, uint8_t const* payload,
+                       uint8_t const* bits) {
+  uint32_t const meta[3] = {
+    payload_size, static_cast<uint32_t>(version),
+    static_cast<uint32_t>(width)
+  };
+  auto sum = checksum(0xcbf29ce484222325ull, &hash, sizeof(hash));
+  sum = checksum(sum, meta, sizeof(meta));
+  sum = checksum(sum, payload, payload_size);
+  return checksum(sum, bits, (static_cast<size_t>(width) * width + 7) / 8);
+}
+
+bool valid_width(uint32_t width) {
+  return width >= kMinWidth && width <= kMaxWidth &&
+    (width - kMinWidth) % 4 == 0;
+}
+
+class SharedCacheImpl : public SharedCache {
+public:
+  SharedCacheImpl(Header* header, Slot* slots)
+    : header_(header), slots_(slots), pid_(getpid()) {}
+
+  ~SharedCacheImpl() override {
+    munmap(header_, kFileSize);
+  }
+
+  bool find(uint64_t hash, std::string_view payload, int* version,
+            int* width, uint8_t* modules) override {
+    if (payload.size() <= kMaxPayload) {
+      auto* bucket = slots_ + (hash % kBuckets) * kWays;
+      for (uint32_t i = 0; i < kWays; ++i) {
+        if (read(bucket[i], hash, payload, version, width, modules)) {
+          bucket[i].used_ns.store(monotonic_ns(), std::memory_order_relaxed);
+          header_->hits.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        }
+      }
+    }
+    header_->misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  void store(uint64_t hash, std::string_view payload, int version,
+             int width, uint8_t const* modules) override {
+    if (payload.size() > kMaxPayload || !valid_width(width))
+      return;
+    auto* bucket = slots_ + (hash % kBuckets) * kWays;
+    // The entry with the same hash, or else the least recently used.
+    Slot* slot = nullptr;
+    for (uint32_t i = 0; i < kWays; ++i) {
+      if (bucket[i].hash == hash) {
+        slot = &bucket[i];
+        break;
+      }
+      if (!slot || bucket[i].used_ns.load(std::memory_order_relaxed) <
+          slot->used_ns.load(std::memory_order_relaxed))
+        slot = &bucket[i];
+    }
+
+    auto const now = monotonic_ns();
+    uint32_t seq;
+    if (!claim(*slot, now, &seq))
+      return;
+    slot->hash = hash;
+    slot->payload_size = payload.size();
+    slot->version = version;
+    slot->width = width;
+    memcpy(slot->payload, payload.data(), payload.size());
+    pack(width, modules, slot->bits);
+    slot->checksum = slot_checksum(hash, payload.size(), version, width,
+                                   slot->payload, slot->bits);
+    slot->used_ns.store(now, std::memory_order_relaxed);
+    release(*slot, seq);
+  }
+
+  uint64_t total_hits() const override {
+    return header_->hits.load(std::memory_order_relaxed);
+  }
+
+  uint64_t total_misses() const override {
+    return header_->misses.load(std::memory_order_relaxed);
+  }
+
+private:
+  // Copies slot if it holds payload and didn't change while copied.
+  bool read(Slot const& slot, uint64_t hash, std::string_view payload,
+            int* version, int* width, uint8_t* modules) {
+    auto const seq = slot.seq.load(std::memory_order_acquire);
+    if (seq & 1)
+      return false;
+    if (slot.hash != hash || slot.payload_size != payload.size())
+      return false;
+    int const slot_version = slot.version;
+    int const slot_width = slot.width;
+    if (!valid_width(slot_width) ||
+        memcmp(slot.payload, payload.data(), payload.size()) != 0)
+      return false;
+    memcpy(bits_, slot.bits, (slot_width * slot_width + 7) / 8);
+    auto const sum = slot.checksum;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq)
+      return false;
+    if (slot_checksum(hash, payload.size(), slot_version, slot_width,
+                      reinterpret_cast<uint8_t const*>(payload.data()),
+                      bits_) != sum)
+      return false;
+    *version = slot_version;
+    *width = slot_width;
+    unpack(slot_width, bits_, modules);
+    return true;
+  }
+
+  // Makes seq odd, taking the entry over from a writer that died or is
+  // stuck. Returns false if someone else is writing it. seq is set to the
+  // odd value on success.
+  bool claim(Slot& slot, uint64_t now, uint32_t* seq) {
+    auto current = slot.seq.load(std::memory_order_acquire);
+    uint32_t next;
+    // Pid of the writer the entry is taken over from, if any.
+    uint32_t stale = 0;
+    if (current & 1) {
+      // Zero if the writer hasn't stored it yet, so only just claimed the
+      // entry. Pairs with the release store below, a set pid comes with
+      // the claimed_ns of that claim. A writer dying in between leaves the
+      // entry busy for good, but that's a window of two stores.
+      auto const writer = slot.writer_pid.load(std::memory_order_acquire);
+      auto const claimed = slot.claimed_ns.load(std::memory_order_relaxed);
+      if (!writer || !claimed)
+        return false;
+      bool const dead = kill(writer, 0) != 0 && errno == ESRCH;
+      if (!dead && now - claimed < kStaleClaimNs)
+        return false;
+      // Only one contender gets to clear the stale pid, the others then
+      // see a claim in progress. Also keeps the old writer from releasing.
+      stale = writer;
+      if (!slot.writer_pid.compare_exchange_strong(
+              stale, 0, std::memory_order_acquire,
+              std::memory_order_relaxed))
+        return false;
+      // Stays odd, readers must not see what the old writer left.
+      next = current + 2;
+    } else {
+      next = current + 1;
+    }
+    if (!slot.seq.compare_exchange_strong(current, next,
+                                          std::memory_order_acquire,
+                                          std::memory_order_relaxed)) {
+      if (stale) {
+        // seq moved on since it was loaded, so the pid was of a newer
+        // claim by the same writer. Give it back.
+        uint32_t expected = 0;
+        slot.writer_pid.compare_exchange_strong(expected, stale,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed);
+      }
+      return false;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.claimed_ns.store(now, std::memory_order_relaxed);
+    slot.writer_pid.store(pid_, std::memory_order_release);
+    *seq = next;
+    return true;
+  }
+
+  // Makes seq even again, unless the entry was reclaimed from us. Then the
+  // new writer owns it and readers reject whatever mix is left by the
+  // checksum.
+  void release(Slot& slot, uint32_t seq) {
+    // Cleared first, while seq is odd, so nobody takes it for a stale
+    // claim of ours once seq is next made odd. Only if still ours, a
+    // writer that reclaimed the entry has stored its own.
+    auto writer = pid_;
+    if (!slot.writer_pid.compare_exchange_strong(writer, 0,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed))
+      return;
+    slot.seq.compare_exchange_strong(seq, seq + 1,
+                                     std::memory_order_release,
+                                     std::memory_order_relaxed);
+  }
+
+  static void pack(int width, uint8_t const* modules, uint8_t* bits) {
+    size_t const count = static_cast<size_t>(width) * width;
+    memset(bits, 0, (count + 7) / 8);
+    for (size_t i = 0; i < count; ++i) {
+      if (modules[i] & 1)
+        bits[i / 8] |= 1 << (i % 8);
+    }
+  }
+
+  static void unpack(int width, uint8_t const* bits, uint8_t* modules) {
+    size_t const count = static_cast<size_t>(width) * width;
+    for (size_t i = 0; i < count; ++i)
+      modules[i] = (bits[i / 8] >> (i % 8)) & 1;
+  }
+
+  Header* const header_;
+  Slot* const slots_;
+  uint32_t const pid_;
+  // Copy of the entry being read, checked before anything is returned.
+  uint8_t bits_[kMaxBits];
+};
+
+// Sets up a new, or broken, file. Returns false if it's made by another
+// version of qrwnd. Called with the file locked.
+bool init(int fd) {
+  struct stat st;
+  if (fstat(fd, &st))
+    return false;
+  Layout layout;
+  if (static_cast<size_t>(st.st_size) >= sizeof(Header) &&
+      pread(fd, &layout, sizeof(layout), 0) == sizeof(layout) &&
+      memcmp(layout.magic, kMagic, sizeof(kMagic)) == 0) {
+    return layout.buckets == kBuckets && layout.ways == kWays &&
+      layout.slot_size == sizeof(Slot) &&
+      static_cast<size_t>(st.st_size) == kFileSize;
+  }
+  // Nobody can have it mapped without a valid header, start over.
+  if (ftruncate(fd, 0) || ftruncate(fd, kFileSize))
+    return false;
+  layout = Layout{ {}, kBuckets, kWays, sizeof(Slot), 0 };
+  if (pwrite(fd, &layout, sizeof(layout), 0) != sizeof(layout))
+    return false;
+  // Magic last, so a half done init is redone by the next one.
+  return pwrite(fd, kMagic, sizeof(kMagic), 0) == sizeof(kMagic);
+}
+
+}  // namespace
+
+std::unique_ptr<SharedCache> SharedCache::open(std::string const& path) {
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return nullptr;
+  bool ok = false;
+  if (flock(fd, LOCK_EX) == 0) {
+    ok = init(fd);
+    flock(fd, LOCK_UN);
+  }
+  void* ptr = MAP_FAILED;
+  if (ok) {
+    ptr = mmap(nullptr, kFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+               0);
+  }
+  ::close(fd);
+  if (ptr == MAP_FAILED)
+    return nullptr;
+  auto* header = reinterpret_cast<Header*>(ptr);
+  return std::make_unique<SharedCacheImpl>(
+      header, reinterpret_cast<Slot*>(header + 1));
+}
@@ -0,0 +1,50 @@
+#ifndef SHARED_CACHE_HH
+#define SHARED_CACHE_HH
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+// Encoded codes shared by every qrwnd that opens the same file, so a
+// payload encoded by one instance isn't encoded again by the others.
+// Entries are keyed by Snapshot::hash() of the payload and also hold the
+// payload itself. Lookups never block: a writer marks an entry as busy
+// while it writes, and readers skip busy entries and reject any copy that
+// changed under them or fails its checksum. An entry left busy by a writer
+// that died is reclaimed by the next writer.
+//
+// Anyone who can write the file decides what codes the others show, only
+// share it between users that trust each other.
+class SharedCache {
+public:
+  virtual ~SharedCache() = default;
+
+  // Most modules in a code, what find() may write to modules.
+  static constexpr size_t kMaxModules = 177 * 177;
+
+  // Opens, or creates, the cache file. Returns nullptr on error, or if the
+  // file has a layout from another version of qrwnd.
+  static std::unique_ptr<SharedCache> open(std::string const& path);
+
+  // Copies the code for payload to version, width and modules, bit 0 set
+  // for dark modules. Returns false if it isn't cached.
+  virtual bool find(uint64_t hash, std::string_view payload, int* version,
+                    int* width, uint8_t* modules) = 0;
+
+  // Adds the code for payload, unless the entry it would go in is busy.
+  virtual void store(uint64_t hash, std::string_view payload, int version,
+                     int width, uint8_t const* modules) = 0;
+
+  // Lookups by every instance since the file was created.
+  virtual uint64_t total_hits() const = 0;
+  virtual uint64_t total_misses() const = 0;
+
+protected:
+  SharedCache() = default;
+  SharedCache(SharedCache const&) = delete;
+  SharedCache& operator=(SharedCache const&) = delete;
+};
+
+#endif  // SHARED_CACHE_HH
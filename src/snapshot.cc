@@ -0,0 +1,181 @@
+#include "common.hh"
+
+#include "snapshot.hh"
+
+#include <atomic>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+constexpr char const kMagic[8] = { 'Q', 'R', 'W', 'N', 'D', 'S', 'S', '2' };
+// Width of version 1 and 40 codes
+constexpr uint32_t kMinWidth = 21;
+constexpr uint32_t kMaxWidth = 177;
+constexpr size_t kMaxModules = kMaxWidth * kMaxWidth;
+
+struct Header {
+  char magic[8];
+  uint64_t payload_hash;
+  uint32_t payload_size;
+  uint32_t version;
+  uint32_t width;
+  uint32_t reserved;
+  // Snapshot::hash() of the width * width modules.
+  uint64_t checksum;
+};
+
+// Room for the largest code, the file never shrinks as other instances
+// may have it mapped.
+constexpr size_t kFileSize = sizeof(Header) + kMaxModules;
+
+uint64_t checksum(uint8_t const* modules, size_t count) {
+  return Snapshot::hash(std::string_view(
+      reinterpret_cast<char const*>(modules), count));
+}
+
+// valid(), data() and the rest read a private copy, taken at open and
+// replaced by store(). Other instances may write the file at any time.
+class SnapshotImpl : public Snapshot {
+public:
+  explicit SnapshotImpl(int fd)
+    : fd_(fd) {}
+
+  ~SnapshotImpl() override {
+    if (header_)
+      munmap(header_, kFileSize);
+    ::close(fd_);
+  }
+
+  bool init() {
+    struct stat st;
+    if (fstat(fd_, &st))
+      return false;
+    // Growing is safe for others that have it mapped, shrinking isn't.
+    if (static_cast<size_t>(st.st_size) < kFileSize &&
+        ftruncate(fd_, kFileSize))
+      return false;
+    auto* ptr = mmap(nullptr, kFileSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd_, 0);
+    if (ptr == MAP_FAILED)
+      return false;
+    header_ = reinterpret_cast<Header*>(ptr);
+    modules_.reserve(kMaxModules);
+    load();
+    return true;
+  }
+
+  bool valid() const override {
+    return valid_;
+  }
+
+  uint64_t payload_hash() const override {
+    return copy_.payload_hash;
+  }
+
+  size_t payload_size() const override {
+    return copy_.payload_size;
+  }
+
+  int version() const override {
+    return copy_.version;
+  }
+
+  int width() const override {
+    return copy_.width;
+  }
+
+  uint8_t const* data() const override {
+    return modules_.data();
+  }
+
+  void store(uint64_t payload_hash, size_t payload_size,
+             int version, int width, uint8_t const* data) override {
+    if (!header_ || width < static_cast<int>(kMinWidth) ||
+        width > static_cast<int>(kMaxWidth))
+      return;
+    size_t const count = static_cast<size_t>(width) * width;
+    modules_.resize(count);
+    for (size_t i = 0; i < count; ++i)
+      modules_[i] = data[i] & 1;
+    copy_ = Header{};
+    memcpy(copy_.magic, kMagic, sizeof(kMagic));
+    copy_.payload_hash = payload_hash;
+    copy_.payload_size = payload_size;
+    copy_.version = version;
+    copy_.width = width;
+    copy_.checksum = checksum(modules_.data(), count);
+    valid_ = true;
+
+    // Invalidate while writing, in case we crash half-way. Readers also
+    // check the checksum, for when two instances write at once.
+    memset(header_->magic, 0, sizeof(kMagic));
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header_ + 1, modules_.data(), count);
+    header_->payload_hash = copy_.payload_hash;
+    header_->payload_size = copy_.payload_size;
+    header_->version = copy_.version;
+    header_->width = copy_.width;
+    header_->reserved = 0;
+    header_->checksum = copy_.checksum;
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header_->magic, kMagic, sizeof(kMagic));
+  }
+
+private:
+  // Copies the snapshot, then checks that it didn't change meanwhile.
+  void load() {
+    valid_ = false;
+    memcpy(&copy_, header_, sizeof(copy_));
+    if (memcmp(copy_.magic, kMagic, sizeof(kMagic)) != 0 ||
+        copy_.width < kMinWidth || copy_.width > kMaxWidth)
+      return;
+    size_t const count = static_cast<size_t>(copy_.width) * copy_.width;
+    modules_.resize(count);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    memcpy(modules_.data(), header_ + 1, count);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    valid_ = memcmp(&copy_, header_, sizeof(copy_)) == 0 &&
+      checksum(modules_.data(), count) == copy_.checksum;
+  }
+
+  int const fd_;
+  Header* header_ = nullptr;
+  Header copy_{};
+  bool valid_ = false;
+  std::vector<uint8_t> modules_;
+};
+
+}  // namespace
+
+std::unique_ptr<Snapshot> Snapshot::open(std::string const& path) {
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return nullptr;
+  auto ret = std::make_unique<SnapshotImpl>(fd);
+  if (ret->init())
+    return ret;
+  return nullptr;
+}
+
+std::string Snapshot::default_path() {
+  auto* runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if (!runtime_dir || !*runtime_dir)
+    return std::string();
+  return std::string(runtime_dir) + "/qrwnd.snapshot";
+}
+
+uint64_t Snapshot::hash(std::string_view data) {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (auto c : data) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
@@ -0,0 +1,49 @@
+#ifndef SNAPSHOT_HH
+#define SNAPSHOT_HH
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+// The last displayed code, kept in a memory mapped state file so that it
+// can be painted right away at startup, before the selection is fetched.
+class Snapshot {
+public:
+  virtual ~Snapshot() = default;
+
+  // Opens, or creates, the state file. Returns nullptr on error.
+  static std::unique_ptr<Snapshot> open(std::string const& path);
+
+  // Returns $XDG_RUNTIME_DIR/qrwnd.snapshot or an empty string if
+  // XDG_RUNTIME_DIR isn't set.
+  static std::string default_path();
+
+  static uint64_t hash(std::string_view data);
+
+  // Returns false if there is no, or an invalid, snapshot stored.
+  virtual bool valid() const = 0;
+
+  // Hash of the encoded payload, see hash().
+  virtual uint64_t payload_hash() const = 0;
+
+  virtual size_t payload_size() const = 0;
+
+  virtual int version() const = 0;
+
+  virtual int width() const = 0;
+
+  // width() * width() modules, bit 0 is set for dark modules.
+  virtual uint8_t const* data() const = 0;
+
+  virtual void store(uint64_t payload_hash, size_t payload_size,
+                     int version, int width, uint8_t const* data) = 0;
+
+protected:
+  Snapshot() = default;
+  Snapshot(Snapshot const&) = delete;
+  Snapshot& operator=(Snapshot const&) = delete;
+};
+
+#endif  // SNAPSHOT_HH
@@ -0,0 +1,179 @@
+#include "common.hh"
+
+#include "startup.hh"
+#include "xcb_atoms.hh"
+#include "xcb_resource.hh"
+
+#include <ostream>
+#include <stdio.h>
+#include <xcb/xcb_icccm.h>
+#include <xcb/xfixes.h>
+
+namespace {
+
+constexpr char const kTitle[] = "QRwnd";
+constexpr char const kClass[] = "org.the_jk.qrwnd";
+
+constexpr uint16_t kWidth = 175;
+constexpr uint16_t kHeight = 175;
+
+// WM_PROTOCOLS and WM_DELETE_WINDOW first, as they are needed before
+// mapping the window.
+enum class Atom {
+  WM_PROTOCOLS,
+  WM_DELETE_WINDOW,
+  UTF8_STRING,
+  INCR,
+  NET_WM_STATE,
+  NET_WM_STATE_HIDDEN,
+  QRWND_PAINT,
+  LAST = QRWND_PAINT,
+};
+
+// In the same order as Atom. PRIMARY and STRING are predefined.
+constexpr xcb::AtomTable<Atom, 7> kAtomNames = {{
+  { Atom::WM_PROTOCOLS, "WM_PROTOCOLS" },
+  { Atom::WM_DELETE_WINDOW, "WM_DELETE_WINDOW" },
+  { Atom::UTF8_STRING, "UTF8_STRING" },
+  { Atom::INCR, "INCR" },
+  { Atom::NET_WM_STATE, "_NET_WM_STATE" },
+  { Atom::NET_WM_STATE_HIDDEN, "_NET_WM_STATE_HIDDEN" },
+  { Atom::QRWND_PAINT, "_QRWND_PAINT" },
+}};
+static_assert(xcb::in_order(kAtomNames));
+
+class StartupImpl : public Startup {
+public:
+  StartupImpl(xcb::shared_conn conn, xcb_screen_t const* screen, bool popup)
+    : conn_(conn), screen_(screen), popup_(popup), atoms_(conn, kAtomNames) {
+    for (size_t i = 0; i < kTargetProperties; ++i) {
+      char tmp[15];
+      snprintf(tmp, sizeof(tmp), "QRWND_DATA%zu", i);
+      atoms_.add(tmp);
+    }
+  }
+
+  bool map_window(std::ostream& err) override {
+    wnd_ = xcb::make_unique_wnd(conn_);
+    window_ = { wnd_->id(), screen_->root, kWidth, kHeight };
+
+    // No background so the server doesn't clear the window on resize, and
+    // center bit gravity to keep the centered code where it is.
+    // Controller only repaints what that doesn't cover.
+    uint32_t value_list[3];
+    uint32_t value_mask = 0;
+    value_mask |= XCB_CW_BACK_PIXMAP;
+    value_list[0] = XCB_BACK_PIXMAP_NONE;
+    value_mask |= XCB_CW_BIT_GRAVITY;
+    value_list[1] = XCB_GRAVITY_CENTER;
+    value_mask |= XCB_CW_EVENT_MASK;
+    value_list[2] = XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_KEY_PRESS |
+      XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_PROPERTY_CHANGE |
+      XCB_EVENT_MASK_VISIBILITY_CHANGE;
+    xcb_create_window(conn_.get(), XCB_COPY_FROM_PARENT, wnd_->id(),
+                      screen_->root, 0, 0, kWidth, kHeight, 0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen_->root_visual,
+                      value_mask, value_list);
+
+    // STRING is predefined so no need to wait for atoms
+    xcb_icccm_set_wm_name(conn_.get(), wnd_->id(), XCB_ATOM_STRING,
+                          8, sizeof(kTitle) - 1, kTitle);
+    xcb_icccm_set_wm_class(conn_.get(), wnd_->id(), sizeof(kClass) - 1,
+                           kClass);
+
+    // ICCCM wants WM_PROTOCOLS set before the window is first mapped. Only
+    // the first replies are waited for, the rest arrive while mapping.
+    if (!atoms_.sync({ Atom::WM_PROTOCOLS, Atom::WM_DELETE_WINDOW })) {
+      err << "Failed to get X atoms." << std::endl;
+      return false;
+    }
+    xcb_atom_t atom_list[1];
+    atom_list[0] = atoms_[Atom::WM_DELETE_WINDOW];
+    xcb_icccm_set_wm_protocols(conn_.get(), wnd_->id(),
+                               atoms_[Atom::WM_PROTOCOLS], 1, atom_list);
+
+    // In popup mode the window is only mapped when the key is pressed.
+    if (!popup_)
+      xcb_map_window(conn_.get(), wnd_->id());
+    xcb_flush(conn_.get());
+    return true;
+  }
+
+  bool sync_atoms(std::ostream& err) override {
+    if (!atoms_.sync()) {
+      err << "Failed to get X atoms." << std::endl;
+      return false;
+    }
+    atoms_out_.utf8_string = atoms_[Atom::UTF8_STRING];
+    atoms_out_.incr = atoms_[Atom::INCR];
+    atoms_out_.net_wm_state = atoms_[Atom::NET_WM_STATE];
+    atoms_out_.net_wm_state_hidden = atoms_[Atom::NET_WM_STATE_HIDDEN];
+    atoms_out_.qrwnd_paint = atoms_[Atom::QRWND_PAINT];
+    for (size_t i = 0; i < kTargetProperties; ++i)
+      atoms_out_.target_property[i] = atoms_.dynamic(i);
+    return true;
+  }
+
+  bool select_input(std::ostream& err) override {
+    if (popup_) {
+      // Without XFixes first_event would be 0, which would have X errors
+      // taken for selection changes.
+      atoms_out_.xfixes_first_event = Controller::kNoXFixes;
+      return true;
+    }
+    auto* xfixes = xcb_get_extension_data(conn_.get(), &xcb_xfixes_id);
+    if (!xfixes || !xfixes->present) {
+      err << "No XFixes extension, needed to monitor selection."
+          << std::endl;
+      return false;
+    }
+    atoms_out_.xfixes_first_event = xfixes->first_event;
+    // The server wants the version before any other XFixes request, the
+    // reply isn't needed.
+    xcb_xfixes_query_version(conn_.get(), XCB_XFIXES_MAJOR_VERSION,
+                             XCB_XFIXES_MINOR_VERSION);
+    xcb_xfixes_select_selection_input(
+        conn_.get(), screen_->root, XCB_ATOM_PRIMARY,
+        XCB_XFIXES_SELECTION_EVENT_MASK_SET_SELECTION_OWNER);
+    return true;
+  }
+
+  Controller::Window const& window() const override {
+    return window_;
+  }
+
+  Controller::Atoms const& atoms() const override {
+    return atoms_out_;
+  }
+
+  xcb_atom_t wm_protocols() const override {
+    return atoms_[Atom::WM_PROTOCOLS];
+  }
+
+  xcb_atom_t wm_delete_window() const override {
+    return atoms_[Atom::WM_DELETE_WINDOW];
+  }
+
+private:
+  xcb::shared_conn conn_;
+  xcb_screen_t const* const screen_;
+  bool const popup_;
+  xcb::Atoms<Atom, kAtomNames.size()> atoms_;
+  xcb::unique_wnd wnd_;
+  Controller::Window window_{};
+  Controller::Atoms atoms_out_{};
+};
+
+}  // namespace
+
+std::unique_ptr<Startup> Startup::create(xcb::shared_conn conn,
+                                         xcb_screen_t const* screen,
+                                         bool popup) {
+  // Only sends QueryExtension. Any XFixes request would block on its
+  // reply, and libxcb closes the connection if the server lacks XFixes.
+  // Sent before the atoms so that by the time their replies are in, so is
+  // this one, and select_input() doesn't block.
+  if (!popup)
+    xcb_prefetch_extension_data(conn.get(), &xcb_xfixes_id);
+  return std::make_unique<StartupImpl>(conn, screen, popup);
+}
@@ -0,0 +1,52 @@
+#ifndef STARTUP_HH
+#define STARTUP_HH
+
+#include "controller.hh"
+#include "xcb_connection.hh"
+
+#include <iosfwd>
+#include <memory>
+#include <xcb/xproto.h>
+
+// The X requests qrwnd makes before Controller takes over, split in steps
+// so --timing can tell them apart. Replies are only waited for once the
+// window is created and mapped.
+class Startup {
+public:
+  virtual ~Startup() = default;
+
+  // Queues the atoms and, unless popup, the query for XFixes. Nothing is
+  // waited for. In popup mode the selection is only fetched when the key
+  // is pressed, so XFixes isn't needed.
+  static std::unique_ptr<Startup> create(xcb::shared_conn conn,
+                                         xcb_screen_t const* screen,
+                                         bool popup);
+
+  // Creates the window and maps it, unless popup. Waits for the atoms
+  // WM_PROTOCOLS needs, returns false if they failed.
+  virtual bool map_window(std::ostream& err) = 0;
+
+  // Waits for the rest of the atoms, returns false if any failed.
+  virtual bool sync_atoms(std::ostream& err) = 0;
+
+  // Selects selection owner changes, unless popup. Returns false if that
+  // needs XFixes and the server doesn't have it.
+  virtual bool select_input(std::ostream& err) = 0;
+
+  // Valid after map_window().
+  virtual Controller::Window const& window() const = 0;
+
+  // Valid after select_input().
+  virtual Controller::Atoms const& atoms() const = 0;
+
+  virtual xcb_atom_t wm_protocols() const = 0;
+
+  virtual xcb_atom_t wm_delete_window() const = 0;
+
+protected:
+  Startup() = default;
+  Startup(Startup const&) = delete;
+  Startup& operator=(Startup const&) = delete;
+};
+
+#endif  // STARTUP_HH
@@ -0,0 +1,295 @@
+#include "common.hh"
+
+#ifdef QRWND_ALLOC_CHECK
+#include "alloc_check.hh"
+#endif
+#include "roundtrip.hh"
+#include "stats.hh"
+#include "unix_socket.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <signal.h>
+#include <sstream>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+constexpr double kPercentiles[] = { 50, 90, 99 };
+
+void print_histogram(std::ostream& out, char const* name,
+                     Histogram const& histogram, double scale,
+                     char const* unit) {
+  out << "  " << name << ": " << histogram.count();
+  if (histogram.count()) {
+    out << ", min " << histogram.min() / scale << unit
+        << ", mean " << histogram.mean() / scale << unit;
+    for (auto p : kPercentiles) {
+      out << ", p" << p << " " << histogram.percentile(p) / scale << unit;
+    }
+    out << ", max " << histogram.max() / scale << unit;
+  }
+  out << '\n';
+}
+
+void print_histogram_json(std::ostream& out, Histogram const& histogram) {
+  out << "{\"count\":" << histogram.count()
+      << ",\"min\":" << histogram.min()
+      << ",\"mean\":" << histogram.mean()
+      << ",\"max\":" << histogram.max();
+  for (auto p : kPercentiles)
+    out << ",\"p" << p << "\":" << histogram.percentile(p);
+  out << '}';
+}
+
+class StatsServerImpl : public StatsServer {
+public:
+  StatsServerImpl(Stats const* stats, std::string socket_path, int signal_fd,
+                  int listen_fd, int wake_read, int wake_write)
+    : stats_(stats), socket_path_(std::move(socket_path)),
+      signal_fd_(signal_fd), listen_fd_(listen_fd), wake_read_(wake_read),
+      wake_write_(wake_write), thread_(&StatsServerImpl::run, this) {}
+
+  ~StatsServerImpl() override {
+    char c = 0;
+    while (write(wake_write_, &c, 1) < 0 && errno == EINTR) {}
+    thread_.join();
+    close(wake_write_);
+    close(wake_read_);
+    close(signal_fd_);
+    if (listen_fd_ >= 0) {
+      close(listen_fd_);
+      unlink(socket_path_.c_str());
+    }
+  }
+
+private:
+  void run() {
+#ifdef QRWND_ALLOC_CHECK
+    // Printing allocates, at any time, also while a selection change is
+    // being checked.
+    alloc_check::ignore_thread();
+#endif
+    struct pollfd pfd[3];
+    pfd[0].fd = wake_read_;
+    pfd[1].fd = signal_fd_;
+    pfd[2].fd = listen_fd_;
+    while (true) {
+      for (auto& p : pfd) {
+        p.events = POLLIN;
+        p.revents = 0;
+      }
+      if (poll(pfd, listen_fd_ >= 0 ? 3 : 2, -1) < 0) {
+        if (errno == EINTR)
+          continue;
+        return;
+      }
+      if (pfd[0].revents)
+        return;
+      if (pfd[1].revents) {
+        struct signalfd_siginfo info;
+        if (read(signal_fd_, &info, sizeof(info)) == sizeof(info))
+          stats_->print(std::cerr);
+      }
+      if (pfd[2].revents) {
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd >= 0) {
+          std::ostringstream json;
+          stats_->print_json(json);
+          auto str = json.str();
+          size_t offset = 0;
+          while (offset < str.size()) {
+            auto ret = write(fd, str.data() + offset, str.size() - offset);
+            if (ret < 0) {
+              if (errno == EINTR)
+                continue;
+              break;
+            }
+            offset += ret;
+          }
+          close(fd);
+        }
+      }
+    }
+  }
+
+  Stats const* const stats_;
+  std::string const socket_path_;
+  int const signal_fd_;
+  int const listen_fd_;
+  int const wake_read_;
+  int const wake_write_;
+  std::thread thread_;
+};
+
+}  // namespace
+
+size_t Histogram::index(uint64_t value) {
+  if (value < kSubBuckets)
+    return value;
+  int msb = 63 - __builtin_clzll(value);
+  if (msb >= kMaxBits)
+    return kBuckets - 1;
+  int shift = msb - kSubBits;
+  return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+}
+
+uint64_t Histogram::upper_bound(size_t index) {
+  if (index < kSubBuckets)
+    return index;
+  int shift = index / kSubBuckets - 1;
+  uint64_t sub = index % kSubBuckets;
+  return ((kSubBuckets + sub + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+  bucket_[index(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  auto min = min_.load(std::memory_order_relaxed);
+  while (value < min &&
+         !min_.compare_exchange_weak(min, value, std::memory_order_relaxed)) {}
+  auto max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+}
+
+uint64_t Histogram::min() const {
+  return count() ? min_.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t Histogram::max() const {
+  return max_.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::mean() const {
+  auto count = this->count();
+  return count ? sum_.load(std::memory_order_relaxed) / count : 0;
+}
+
+uint64_t Histogram::percentile(double p) const {
+  auto count = this->count();
+  if (count == 0)
+    return 0;
+  auto target = static_cast<uint64_t>(p / 100.0 * count + 0.5);
+  if (target < 1)
+    target = 1;
+  uint64_t seen = 0;
+  // The last bucket also holds everything out of range.
+  for (size_t i = 0; i + 1 < kBuckets; ++i) {
+    seen += bucket_[i].load(std::memory_order_relaxed);
+    if (seen >= target)
+      return std::min(upper_bound(i), max());
+  }
+  return max();
+}
+
+void Stats::print(std::ostream& out) const {
+  out << "Statistics:\n"
+      << "  selection changes: " << selection_changes.load() << '\n'
+      << "  conversions: " << conversions.load()
+      << ", timed out: " << conversion_timeouts.load()
+      << ", stalled: " << stalls.load() << '\n'
+      << "  active requests: " << active_requests.load() << '\n'
+      << "  INCR transfers: " << incr_transfers.load() << '\n';
+  print_histogram(out, "conversion", conversion_ns, 1e6, " ms");
+  print_histogram(out, "property bytes", property_bytes, 1, "");
+  print_histogram(out, "INCR chunks", incr_chunks, 1, "");
+  for (size_t i = 0; i < encode_ns.size(); ++i) {
+    if (encode_ns[i].count()) {
+      auto name = "encode v" + std::to_string(i + 1);
+      print_histogram(out, name.c_str(), encode_ns[i], 1e6, " ms");
+    }
+  }
+  print_histogram(out, "paint", paint_ns, 1e6, " ms");
+  out << "  resizes: " << resizes.load()
+      << ", repaints: " << resize_paints.load() << '\n';
+  print_histogram(out, "resize repaint pixels", resize_paint_pixels, 1, "");
+  auto const lookups = shared_cache_hits.load() + shared_cache_misses.load();
+  if (lookups) {
+    out << "  shared cache hits: " << shared_cache_hits.load()
+        << ", misses: " << shared_cache_misses.load() << ", hit rate: "
+        << 100.0 * shared_cache_hits.load() / lookups << "%\n";
+  }
+  roundtrip::print(out);
+  out << std::flush;
+}
+
+void Stats::print_json(std::ostream& out) const {
+  out << "{\"selection_changes\":" << selection_changes.load()
+      << ",\"conversions\":" << conversions.load()
+      << ",\"conversion_timeouts\":" << conversion_timeouts.load()
+      << ",\"stalls\":" << stalls.load()
+      << ",\"active_requests\":" << active_requests.load()
+      << ",\"incr_transfers\":" << incr_transfers.load()
+      << ",\"conversion_ns\":";
+  print_histogram_json(out, conversion_ns);
+  out << ",\"property_bytes\":";
+  print_histogram_json(out, property_bytes);
+  out << ",\"incr_chunks\":";
+  print_histogram_json(out, incr_chunks);
+  out << ",\"encode_ns\":{";
+  bool first = true;
+  for (size_t i = 0; i < encode_ns.size(); ++i) {
+    if (encode_ns[i].count()) {
+      out << (first ? "" : ",") << '"' << i + 1 << "\":";
+      first = false;
+      print_histogram_json(out, encode_ns[i]);
+    }
+  }
+  out << "},\"paint_ns\":";
+  print_histogram_json(out, paint_ns);
+  out << ",\"resizes\":" << resizes.load()
+      << ",\"resize_paints\":" << resize_paints.load()
+      << ",\"resize_paint_pixels\":";
+  print_histogram_json(out, resize_paint_pixels);
+  out << ",\"shared_cache_hits\":" << shared_cache_hits.load()
+      << ",\"shared_cache_misses\":" << shared_cache_misses.load()
+      << ",\"round_trips\":";
+  roundtrip::print_json(out);
+  out << "}\n";
+}
+
+std::unique_ptr<StatsServer> StatsServer::create(Stats const* stats,
+                                                 std::string socket_path,
+                                                 std::ostream& err) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+  int signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+  if (signal_fd < 0) {
+    err << "signalfd: " << strerror(errno) << std::endl;
+    return nullptr;
+  }
+
+  int listen_fd = -1;
+  if (!socket_path.empty()) {
+    listen_fd = listen_unix_socket(socket_path, err);
+    if (listen_fd < 0) {
+      close(signal_fd);
+      return nullptr;
+    }
+  }
+
+  int wake[2];
+  if (pipe2(wake, O_CLOEXEC)) {
+    err << "pipe: " << strerror(errno) << std::endl;
+    if (listen_fd >= 0) {
+      close(listen_fd);
+      unlink(socket_path.c_str());
+    }
+    close(signal_fd);
+    return nullptr;
+  }
+
+  return std::make_unique<StatsServerImpl>(stats, std::move(socket_path),
+                                           signal_fd, listen_fd, wake[0],
+                                           wake[1]);
+}
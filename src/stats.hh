@@ -0,0 +1,105 @@
+#ifndef STATS_HH
+#define STATS_HH
+
+#include "qr_capacity.hh"
+
+#include <array>
+#include <atomic>
+#include <iosfwd>
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+// Log-linear histogram in the style of HdrHistogram: each power of two
+// range is split into kSubBuckets linear buckets, so values are kept with
+// at most 1/kSubBuckets relative error. Recording never allocates and may
+// happen while another thread reads.
+class Histogram {
+public:
+  void record(uint64_t value);
+
+  uint64_t count() const {
+    return count_.load(std::memory_order_relaxed);
+  }
+
+  // Zero if count() is zero.
+  uint64_t min() const;
+  uint64_t max() const;
+  uint64_t mean() const;
+
+  // Upper bound of the bucket holding percentile p, 0-100.
+  uint64_t percentile(double p) const;
+
+private:
+  static constexpr int kSubBits = 3;
+  static constexpr uint64_t kSubBuckets = 1 << kSubBits;
+  // Larger values are counted as the largest value in range.
+  static constexpr int kMaxBits = 40;
+  static constexpr size_t kBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets;
+
+  static size_t index(uint64_t value);
+  static uint64_t upper_bound(size_t index);
+
+  std::array<std::atomic<uint64_t>, kBuckets> bucket_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> min_{UINT64_MAX};
+  std::atomic<uint64_t> max_{0};
+};
+
+// Counters and histograms kept by Controller for the whole run.
+struct Stats {
+  std::atomic<uint64_t> selection_changes{0};
+  std::atomic<uint64_t> conversions{0};
+  // Conversions never answered before expiring.
+  std::atomic<uint64_t> conversion_timeouts{0};
+  // Conversions delayed as all target properties were in use.
+  std::atomic<uint64_t> stalls{0};
+  std::atomic<uint64_t> incr_transfers{0};
+  // Conversions waiting for an answer right now, not a counter.
+  std::atomic<uint64_t> active_requests{0};
+  // Size changes of the window, and paints done for them alone.
+  std::atomic<uint64_t> resizes{0};
+  std::atomic<uint64_t> resize_paints{0};
+  // Lookups in the cache shared with other instances, if any.
+  std::atomic<uint64_t> shared_cache_hits{0};
+  std::atomic<uint64_t> shared_cache_misses{0};
+
+  // ConvertSelection to SelectionNotify.
+  Histogram conversion_ns;
+  // Size of each property read, INCR chunks included.
+  Histogram property_bytes;
+  // Chunks per INCR transfer.
+  Histogram incr_chunks;
+  // Indexed by QR version - 1.
+  std::array<Histogram, kQRMaxVersion> encode_ns;
+  Histogram paint_ns;
+  // Pixels repainted by each of resize_paints.
+  Histogram resize_paint_pixels;
+
+  void print(std::ostream& out) const;
+
+  // Same content as print(), as a JSON object.
+  void print_json(std::ostream& out) const;
+};
+
+// Prints stats to stderr on SIGUSR2 and, if socket_path isn't empty,
+// writes them as JSON to every client that connects to a unix socket at
+// socket_path. Runs in its own thread.
+class StatsServer {
+public:
+  virtual ~StatsServer() = default;
+
+  // Blocks SIGUSR2 in the calling thread, so must be called before any
+  // other threads are started. Returns nullptr on error.
+  static std::unique_ptr<StatsServer> create(Stats const* stats,
+                                             std::string socket_path,
+                                             std::ostream& err);
+
+protected:
+  StatsServer() = default;
+  StatsServer(StatsServer const&) = delete;
+  StatsServer& operator=(StatsServer const&) = delete;
+};
+
+#endif  // STATS_HH
@@ -0,0 +1,478 @@
+#include "common.hh"
+
+#include "args.hh"
+#include "qr_encode.hh"
+#include "roundtrip.hh"
+#include "selection.hh"
+#include "snapshot.hh"
+#include "term_render.hh"
+#include "unix_socket.hh"
+#include "url_rewrite.hh"
+#include "xcb_atoms.hh"
+#include "xcb_connection.hh"
+#include "xcb_event.hh"
+#include "xcb_resource.hh"
+
+#include <array>
+#include <errno.h>
+#include <iostream>
+#include <limits>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include <xcb/xfixes.h>
+
+// Shows codes in the terminal instead of a window, for when there is no
+// X server close by. Only writes to the terminal when the content changes.
+
+namespace {
+
+constexpr int kDefaultSixelScale = 4;
+
+// Anything larger can't fit in a code anyway.
+constexpr size_t kMaxContent = 64 * 1024;
+
+// Cursor home and clear screen.
+constexpr char kClear[] = "\x1b[H\x1b[2J";
+
+bool parse_int(std::string const& str, int min, int max, int* out) {
+  char* end = nullptr;
+  errno = 0;
+  auto value = strtol(str.c_str(), &end, 10);
+  if (errno || end == str.c_str() || *end || value < min || value > max)
+    return false;
+  *out = value;
+  return true;
+}
+
+bool write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    auto ret = write(fd, data.data(), data.size());
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data.remove_prefix(ret);
+  }
+  return true;
+}
+
+std::string_view trim_newline(std::string_view str) {
+  while (!str.empty() && (str.back() == '\n' || str.back() == '\r'))
+    str.remove_suffix(1);
+  return str;
+}
+
+class Terminal {
+public:
+  Terminal(bool sixel, int scale, bool everything, UrlRewriter* rewriter)
+    : sixel_(sixel), scale_(scale), everything_(everything),
+      rewriter_(rewriter) {}
+
+  // Returns false if the terminal can't be written to.
+  bool show(std::string_view content) {
+    data_ = content;
+    bool is_url = looks_like_url(data_);
+    if (!everything_ && !is_url) {
+      data_.clear();
+    } else if (is_url && rewriter_) {
+      rewriter_->rewrite(data_);
+    }
+    auto hash = data_.empty() ? 0 : Snapshot::hash(data_);
+    if (hash == shown_hash_)
+      return true;
+    shown_hash_ = hash;
+
+    out_ = kClear;
+    if (!data_.empty()) {
+      auto qrcode = qr_encode(data_);
+      if (!qrcode) {
+        out_.append("Failed to generate QR code: ");
+        out_.append(strerror(errno));
+        out_.push_back('\n');
+      } else if (sixel_) {
+        render_sixel(qrcode->width, qrcode->data, scale_, out_);
+      } else {
+        render_halfblocks(qrcode->width, qrcode->data, out_);
+      }
+    }
+    return write_all(STDOUT_FILENO, out_);
+  }
+
+private:
+  bool const sixel_;
+  int const scale_;
+  bool const everything_;
+  UrlRewriter* const rewriter_;
+  std::string data_;
+  std::string out_;
+  // Zero when nothing is shown.
+  uint64_t shown_hash_ = 0;
+};
+
+// Newline separated content. Only the last complete line of each read is
+// shown, the others would be replaced right away.
+class LineReader {
+public:
+  explicit LineReader(int fd)
+    : fd_(fd) {}
+
+  int fd() const {
+    return fd_;
+  }
+
+  // Returns false on end of file or error. line is empty if no line was
+  // completed.
+  bool read(std::string* line) {
+    line->clear();
+    char buf[4096];
+    auto got = ::read(fd_, buf, sizeof(buf));
+    if (got < 0)
+      return errno == EINTR || errno == EAGAIN;
+    if (got == 0) {
+      // Last line without a newline.
+      line->assign(trim_newline(buffer_));
+      return false;
+    }
+    buffer_.append(buf, got);
+    auto end = buffer_.rfind('\n');
+    if (end != std::string::npos) {
+      auto start = buffer_.rfind('\n', end == 0 ? 0 : end - 1);
+      start = start == std::string::npos || start == end ? 0 : start + 1;
+      line->assign(trim_newline(
+          std::string_view(buffer_).substr(start, end - start)));
+      buffer_.erase(0, end + 1);
+    } else if (buffer_.size() > kMaxContent) {
+      buffer_.clear();
+    }
+    return true;
+  }
+
+private:
+  int const fd_;
+  std::string buffer_;
+};
+
+// Each connection to the socket sends one content and closes.
+class SocketInput {
+public:
+  ~SocketInput() {
+    for (auto& client : client_)
+      close(client.fd);
+    if (listen_fd_ >= 0) {
+      close(listen_fd_);
+      unlink(path_.c_str());
+    }
+  }
+
+  bool open(std::string const& path, std::ostream& err) {
+    listen_fd_ = listen_unix_socket(path, err);
+    if (listen_fd_ < 0)
+      return false;
+    path_ = path;
+    return true;
+  }
+
+  // Adds the listening socket and all clients to pfd.
+  void add_fds(std::vector<struct pollfd>& pfd) const {
+    pfd.push_back({ listen_fd_, POLLIN, 0 });
+    for (auto const& client : client_)
+      pfd.push_back({ client.fd, POLLIN, 0 });
+  }
+
+  // pfd as filled by add_fds(). Sets content to the content of the last
+  // closed connection, empty if none.
+  void handle(struct pollfd const* pfd, std::string* content) {
+    content->clear();
+    // Clients first, add_fds() put them after the listening socket.
+    for (size_t i = client_.size(); i > 0; --i) {
+      if (!pfd[i].revents)
+        continue;
+      auto& client = client_[i - 1];
+      char buf[4096];
+      auto got = read(client.fd, buf, sizeof(buf));
+      if (got < 0 && errno == EINTR)
+        continue;
+      if (got > 0) {
+        if (client.data.size() < kMaxContent)
+          client.data.append(buf, got);
+        continue;
+      }
+      if (got == 0 && content->empty())
+        content->assign(trim_newline(client.data));
+      close(client.fd);
+      client_.erase(client_.begin() + (i - 1));
+    }
+    if (pfd[0].revents) {
+      int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd >= 0)
+        client_.push_back(Client{ fd, std::string() });
+    }
+  }
+
+private:
+  struct Client {
+    int fd;
+    std::string data;
+  };
+
+  std::string path_;
+  int listen_fd_ = -1;
+  std::vector<Client> client_;
+};
+
+enum class Atom {
+  UTF8_STRING,
+  QRWND_TERM,
+  LAST = QRWND_TERM,
+};
+
+constexpr xcb::AtomTable<Atom, 2> kAtomNames = {{
+  { Atom::UTF8_STRING, "UTF8_STRING" },
+  { Atom::QRWND_TERM, "_QRWND_TERM" },
+}};
+static_assert(xcb::in_order(kAtomNames));
+
+// Converts PRIMARY each time its owner changes. Content large enough to
+// need INCR won't fit in a code, so it's ignored.
+class SelectionInput {
+public:
+  bool open(std::string const& display, std::ostream& err) {
+    int screen_index = 0;
+    conn_ = xcb::make_shared_conn(xcb_connect(
+        display.empty() ? nullptr : display.c_str(), &screen_index));
+    if (auto error = xcb_connection_has_error(conn_.get())) {
+      err << "Unable to connect to X display: " << error << std::endl;
+      return false;
+    }
+    // Only QueryExtension, any XFixes request would block on its reply and
+    // libxcb closes the connection if the server lacks XFixes. Before the
+    // atoms, so the reply is in once they are.
+    xcb_prefetch_extension_data(conn_.get(), &xcb_xfixes_id);
+    xcb::Atoms<Atom, kAtomNames.size()> atoms(conn_, kAtomNames);
+
+    auto* screen = xcb::get_screen(conn_.get(), screen_index);
+    wnd_ = xcb::make_unique_wnd(conn_);
+    uint32_t const event_mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+    xcb_create_window(conn_.get(), XCB_COPY_FROM_PARENT, wnd_->id(),
+                      screen->root, 0, 0, 1, 1, 0,
+                      XCB_WINDOW_CLASS_INPUT_ONLY, XCB_COPY_FROM_PARENT,
+                      XCB_CW_EVENT_MASK, &event_mask);
+
+    if (!atoms.sync()) {
+      err << "Failed to get X atoms." << std::endl;
+      return false;
+    }
+    utf8_string_ = atoms[Atom::UTF8_STRING];
+    property_ = atoms[Atom::QRWND_TERM];
+
+    auto* xfixes = xcb_get_extension_data(conn_.get(), &xcb_xfixes_id);
+    if (!xfixes || !xfixes->present) {
+      err << "No XFixes extension, needed to monitor selection."
+          << std::endl;
+      return false;
+    }
+    xfixes_first_event_ = xfixes->first_event;
+    xcb_xfixes_query_version(conn_.get(), XCB_XFIXES_MAJOR_VERSION,
+                             XCB_XFIXES_MINOR_VERSION);
+    xcb_xfixes_select_selection_input(
+        conn_.get(), screen->root, XCB_ATOM_PRIMARY,
+        XCB_XFIXES_SELECTION_EVENT_MASK_SET_SELECTION_OWNER);
+    convert(utf8_string_, XCB_CURRENT_TIME);
+    return true;
+  }
+
+  int fd() const {
+    return xcb_get_file_descriptor(conn_.get());
+  }
+
+  // Handles all queued events. Returns false if the connection failed.
+  // content is the new selection, empty if it didn't change.
+  bool read(std::string* content) {
+    content->clear();
+    while (true) {
+      xcb::generic_event event(xcb_poll_for_event(conn_.get()));
+      if (!event)
+        break;
+      auto response_type = XCB_EVENT_RESPONSE_TYPE(event.get());
+      if (response_type ==
+          xfixes_first_event_ + XCB_XFIXES_SELECTION_NOTIFY) {
+        auto* e = reinterpret_cast<xcb_xfixes_selection_notify_event_t*>(
+            event.get());
+        convert(utf8_string_, e->timestamp);
+      } else if (response_type == XCB_SELECTION_NOTIFY) {
+        auto* e = reinterpret_cast<xcb_selection_notify_event_t*>(
+            event.get());
+        if (e->requestor != wnd_->id())
+          continue;
+        if (e->property == XCB_NONE) {
+          // Try with STRING if UTF8_STRING isn't supported.
+          if (e->target == utf8_string_)
+            convert(XCB_ATOM_STRING, e->time);
+          continue;
+        }
+        read_property(content);
+      }
+    }
+    return !xcb_connection_has_error(conn_.get());
+  }
+
+private:
+  void convert(xcb_atom_t target, xcb_timestamp_t time) {
+    xcb_convert_selection(conn_.get(), wnd_->id(), XCB_ATOM_PRIMARY, target,
+                          property_, time);
+    xcb_flush(conn_.get());
+  }
+
+  void read_property(std::string* content) {
+    roundtrip::Scope scope(roundtrip::Op::SELECTION_CHANGE);
+    auto cookie = xcb_get_property(conn_.get(), 1, wnd_->id(), property_,
+                                   XCB_GET_PROPERTY_TYPE_ANY, 0,
+                                   std::numeric_limits<uint32_t>::max() / 4);
+    auto reply = roundtrip::wait_reply<xcb_get_property_reply_t>(
+        conn_.get(), cookie, nullptr);
+    if (reply && (reply->type == utf8_string_ ||
+                  reply->type == XCB_ATOM_STRING)) {
+      content->assign(
+          reinterpret_cast<char*>(xcb_get_property_value(reply.get())),
+          xcb_get_property_value_length(reply.get()));
+    }
+  }
+
+  xcb::shared_conn conn_;
+  xcb::unique_wnd wnd_;
+  xcb_atom_t utf8_string_ = XCB_NONE;
+  xcb_atom_t property_ = XCB_NONE;
+  uint8_t xfixes_first_event_ = 0;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto args = Args::create();
+  auto* help = args->add_option('h', "help", "display this text and exit.");
+  auto* sixel = args->add_option(
+      '\0', "sixel", "draw codes as sixel images instead of Unicode half"
+      " blocks.");
+  auto* scale_opt = args->add_option_with_arg(
+      '\0', "scale", "pixels per module with --sixel, default 4.", "N");
+  auto* stdin_opt = args->add_option(
+      '\0', "stdin", "show a code for each line read from stdin. Default if"
+      " no other input is given.");
+  auto* socket_opt = args->add_option_with_arg(
+      '\0', "socket", "show a code for what is written to each connection"
+      " to the unix socket PATH.", "PATH");
+  auto* selection_opt = args->add_option(
+      '\0', "selection", "show a code for the primary selection, needs an X"
+      " display.");
+  auto* display = args->add_option_with_arg(
+      'd', "display", "X display to use with --selection.", "DISPLAY");
+  auto* everything = args->add_option(
+      'e', "everything", "show a code for everything, not just URLs.");
+  auto* rewrite_rules = args->add_option_with_arg(
+      '\0', "rewrite-rules",
+      "strip URL tracking parameters using rules in FILE, default is to"
+      " not rewrite.", "FILE");
+  std::vector<std::string> arguments;
+  if (!args->run(argc, argv, "qrwnd-term", std::cerr, &arguments)) {
+    std::cerr << "Try `qrwnd-term --help` for usage." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (help->is_set()) {
+    std::cout << "Usage: `qrwnd-term [OPTIONS]`\n"
+              << "Displays QR codes in the terminal.\n"
+              << "\n";
+    args->print_descriptions(std::cout, 80);
+    return EXIT_SUCCESS;
+  }
+  if (!arguments.empty()) {
+    std::cerr << "Unexpected arguments after options.\n"
+              << "Try `qrwnd-term --help` for usage." << std::endl;
+    return EXIT_FAILURE;
+  }
+  int scale = kDefaultSixelScale;
+  if (scale_opt->is_set() && !parse_int(scale_opt->arg(), 1, 64, &scale)) {
+    std::cerr << "Invalid argument to --scale, expected 1-64.\n"
+              << "Try `qrwnd-term --help` for usage." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::unique_ptr<UrlRewriter> rewriter;
+  if (rewrite_rules->is_set()) {
+    rewriter = UrlRewriter::create();
+    if (!rewriter->load(rewrite_rules->arg(), std::cerr))
+      return EXIT_FAILURE;
+  }
+
+  std::unique_ptr<LineReader> line_input;
+  if (stdin_opt->is_set() ||
+      (!socket_opt->is_set() && !selection_opt->is_set()))
+    line_input = std::make_unique<LineReader>(STDIN_FILENO);
+  std::unique_ptr<SocketInput> socket_input;
+  if (socket_opt->is_set()) {
+    socket_input = std::make_unique<SocketInput>();
+    if (!socket_input->open(socket_opt->arg(), std::cerr))
+      return EXIT_FAILURE;
+  }
+  std::unique_ptr<SelectionInput> selection_input;
+  if (selection_opt->is_set()) {
+    selection_input = std::make_unique<SelectionInput>();
+    if (!selection_input->open(display->is_set() ? display->arg()
+                               : std::string(), std::cerr))
+      return EXIT_FAILURE;
+  }
+
+  Terminal terminal(sixel->is_set(), scale, everything->is_set(),
+                    rewriter.get());
+  std::vector<struct pollfd> pfd;
+  std::string content;
+  while (line_input || socket_input || selection_input) {
+    pfd.clear();
+    if (line_input)
+      pfd.push_back({ line_input->fd(), POLLIN, 0 });
+    if (selection_input)
+      pfd.push_back({ selection_input->fd(), POLLIN, 0 });
+    size_t const socket_index = pfd.size();
+    if (socket_input)
+      socket_input->add_fds(pfd);
+    if (poll(pfd.data(), pfd.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "poll: " << strerror(errno) << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    size_t index = 0;
+    if (line_input) {
+      if (pfd[index].revents) {
+        bool open = line_input->read(&content);
+        if (!content.empty() && !terminal.show(content))
+          return EXIT_FAILURE;
+        if (!open)
+          line_input.reset();
+      }
+      ++index;
+    }
+    if (selection_input) {
+      if (pfd[index].revents) {
+        if (!selection_input->read(&content)) {
+          std::cerr << "X connection failed." << std::endl;
+          return EXIT_FAILURE;
+        }
+        if (!content.empty() && !terminal.show(content))
+          return EXIT_FAILURE;
+      }
+      ++index;
+    }
+    if (socket_input) {
+      socket_input->handle(pfd.data() + socket_index, &content);
+      if (!content.empty() && !terminal.show(content))
+        return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+#include "common.hh"
+
+#include "term_render.hh"
+
+namespace {
+
+constexpr int kQuietZone = 4;
+
+// UTF-8 for U+2580 UPPER HALF BLOCK, U+2584 LOWER HALF BLOCK and U+2588
+// FULL BLOCK.
+constexpr char kUpperHalf[] = "\xe2\x96\x80";
+constexpr char kLowerHalf[] = "\xe2\x96\x84";
+constexpr char kFullBlock[] = "\xe2\x96\x88";
+
+// Bright white foreground on black background.
+constexpr char kColors[] = "\x1b[97;40m";
+constexpr char kReset[] = "\x1b[0m";
+
+// Module at x, y including the quiet zone, true if light.
+inline bool light(int width, uint8_t const* modules, int x, int y) {
+  x -= kQuietZone;
+  y -= kQuietZone;
+  if (x < 0 || y < 0 || x >= width || y >= width)
+    return true;
+  return !(modules[y * width + x] & 1);
+}
+
+void append_run(std::string& out, int count, char sixel) {
+  if (count > 3) {
+    out.push_back('!');
+    out.append(std::to_string(count));
+    out.push_back(sixel);
+  } else {
+    out.append(count, sixel);
+  }
+}
+
+}  // namespace
+
+void render_halfblocks(int width, uint8_t const* modules, std::string& out) {
+  int const size = width + 2 * kQuietZone;
+  // Each cell is 3 bytes, plus the colors at the start and end of the row.
+  out.reserve(out.size() + (size + 1) / 2 * (size * 3 + 16));
+  for (int y = 0; y < size; y += 2) {
+    out.append(kColors);
+    for (int x = 0; x < size; ++x) {
+      bool top = light(width, modules, x, y);
+      bool bottom = y + 1 < size && light(width, modules, x, y + 1);
+      if (top && bottom) {
+        out.append(kFullBlock);
+      } else if (top) {
+        out.append(kUpperHalf);
+      } else if (bottom) {
+        out.append(kLowerHalf);
+      } else {
+        out.push_back(' ');
+      }
+    }
+    out.append(kReset);
+    out.push_back('\n');
+  }
+}
+
+void render_sixel(int width, uint8_t const* modules, int scale,
+                  std::string& out) {
+  int const size = (width + 2 * kQuietZone) * scale;
+  // Pixel aspect 1:1, background left as is, then black and white.
+  out.append("\x1bP0;1;0q\"1;1;");
+  out.append(std::to_string(size));
+  out.push_back(';');
+  out.append(std::to_string(size));
+  out.append("#0;2;0;0;0#1;2;100;100;100");
+  for (int band = 0; band < size; band += 6) {
+    for (int color = 0; color < 2; ++color) {
+      // $ returns to the start of the band for the second color.
+      out.append(color ? "$#1" : "#0");
+      char run_sixel = 0;
+      int run = 0;
+      for (int px = 0; px < size; ++px) {
+        int bits = 0;
+        for (int i = 0; i < 6 && band + i < size; ++i) {
+          if (light(width, modules, px / scale, (band + i) / scale) ==
+              (color == 1))
+            bits |= 1 << i;
+        }
+        char sixel = static_cast<char>(63 + bits);
+        if (sixel == run_sixel) {
+          ++run;
+        } else {
+          if (run)
+            append_run(out, run, run_sixel);
+          run_sixel = sixel;
+          run = 1;
+        }
+      }
+      append_run(out, run, run_sixel);
+    }
+    out.push_back('-');
+  }
+  out.append("\x1b\\");
+}
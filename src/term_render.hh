@@ -0,0 +1,20 @@
+#ifndef TERM_RENDER_HH
+#define TERM_RENDER_HH
+
+#include <stdint.h>
+#include <string>
+
+// Renders codes as terminal output. modules is width * width bytes, bit 0
+// set for dark modules, same as QRcode::data. Both add the four module
+// quiet zone and draw light modules explicitly, so the code reads the same
+// on dark and light terminal themes.
+
+// Appends the code to out as rows of Unicode half blocks, two modules per
+// character cell.
+void render_halfblocks(int width, uint8_t const* modules, std::string& out);
+
+// Appends the code to out as a sixel image, scale pixels per module.
+void render_sixel(int width, uint8_t const* modules, int scale,
+                  std::string& out);
+
+#endif  // TERM_RENDER_HH
@@ -0,0 +1,213 @@
+#include "common.hh"
+
+#include "trace.hh"
+
+#include <array>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+// Per thread, must be a power of two.
+constexpr size_t kEvents = 4096;
+constexpr size_t kMaxThreads = 16;
+constexpr size_t kMaxPath = 4096;
+
+struct Event {
+  char const* name;
+  uint64_t start_ns;
+  uint64_t duration_ns;
+  uint64_t arg;
+};
+
+struct Buffer {
+  // Number of events ever recorded, the slot at head is being written.
+  std::atomic<uint64_t> head{0};
+  pid_t tid;
+  std::array<Event, kEvents> events;
+};
+
+std::array<std::atomic<Buffer*>, kMaxThreads> g_buffers;
+std::atomic<size_t> g_threads;
+thread_local Buffer* t_buffer;
+
+char g_signal_path[kMaxPath];
+
+Buffer* register_thread() {
+  auto index = g_threads.fetch_add(1, std::memory_order_relaxed);
+  if (index >= kMaxThreads)
+    return nullptr;
+  auto* buffer = new Buffer();
+  buffer->tid = syscall(SYS_gettid);
+  g_buffers[index].store(buffer, std::memory_order_release);
+  return buffer;
+}
+
+// Buffered writes to a file descriptor, only using async-signal-safe calls.
+class Writer {
+public:
+  explicit Writer(int fd)
+    : fd_(fd) {}
+
+  void str(char const* str) {
+    while (*str) {
+      if (size_ == sizeof(buffer_))
+        flush();
+      buffer_[size_++] = *str++;
+    }
+  }
+
+  void num(uint64_t value) {
+    char tmp[20];
+    size_t i = sizeof(tmp);
+    do {
+      tmp[--i] = '0' + value % 10;
+      value /= 10;
+    } while (value);
+    for (; i < sizeof(tmp); ++i) {
+      if (size_ == sizeof(buffer_))
+        flush();
+      buffer_[size_++] = tmp[i];
+    }
+  }
+
+  // Chrome traces use microseconds.
+  void us(uint64_t ns) {
+    num(ns / 1000);
+    char frac[5] = { '.', '0', '0', '0', '\0' };
+    auto rest = ns % 1000;
+    frac[1] += rest / 100;
+    frac[2] += rest / 10 % 10;
+    frac[3] += rest % 10;
+    str(frac);
+  }
+
+  bool flush() {
+    size_t offset = 0;
+    while (offset < size_) {
+      auto ret = write(fd_, buffer_ + offset, size_ - offset);
+      if (ret < 0) {
+        if (errno == EINTR)
+          continue;
+        ok_ = false;
+        break;
+      }
+      offset += ret;
+    }
+    size_ = 0;
+    return ok_;
+  }
+
+private:
+  int const fd_;
+  char buffer_[4096];
+  size_t size_ = 0;
+  bool ok_ = true;
+};
+
+void signal_handler(int) {
+  auto saved_errno = errno;
+  trace::dump(g_signal_path);
+  errno = saved_errno;
+}
+
+}  // namespace
+
+namespace trace {
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void record(char const* name, uint64_t start_ns, uint64_t duration_ns,
+            uint64_t arg) {
+  auto* buffer = t_buffer;
+  if (!buffer) {
+    buffer = t_buffer = register_thread();
+    if (!buffer)
+      return;
+  }
+  auto head = buffer->head.load(std::memory_order_relaxed);
+  auto& event = buffer->events[head & (kEvents - 1)];
+  event.name = name;
+  event.start_ns = start_ns;
+  event.duration_ns = duration_ns;
+  event.arg = arg;
+  buffer->head.store(head + 1, std::memory_order_release);
+}
+
+bool dump(char const* path) {
+  // Traces show what was copied when, so only for the user, and never
+  // through a symlink someone else planted.
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+                0600);
+  if (fd < 0)
+    return false;
+  Writer out(fd);
+  auto pid = getpid();
+  out.str("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  bool first = true;
+  auto threads = g_threads.load(std::memory_order_relaxed);
+  for (size_t t = 0; t < threads && t < kMaxThreads; ++t) {
+    auto* buffer = g_buffers[t].load(std::memory_order_acquire);
+    if (!buffer)
+      continue;
+    auto head = buffer->head.load(std::memory_order_acquire);
+    // Leave out the oldest slot, the writer might be reusing it.
+    uint64_t begin = head >= kEvents ? head - kEvents + 1 : 0;
+    for (auto i = begin; i < head; ++i) {
+      auto const& event = buffer->events[i & (kEvents - 1)];
+      out.str(first ? "\n" : ",\n");
+      first = false;
+      out.str("{\"name\":\"");
+      out.str(event.name);
+      out.str("\",\"ph\":\"X\",\"pid\":");
+      out.num(pid);
+      out.str(",\"tid\":");
+      out.num(buffer->tid);
+      out.str(",\"ts\":");
+      out.us(event.start_ns);
+      out.str(",\"dur\":");
+      out.us(event.duration_ns);
+      out.str(",\"args\":{\"arg\":");
+      out.num(event.arg);
+      out.str("}}");
+    }
+  }
+  out.str("\n]}\n");
+  bool ok = out.flush();
+  close(fd);
+  return ok;
+}
+
+bool dump_on_signal(std::string const& path) {
+  auto const& actual = path.empty() ? default_path() : path;
+  if (actual.empty() || actual.size() >= sizeof(g_signal_path))
+    return false;
+  memcpy(g_signal_path, actual.c_str(), actual.size() + 1);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = signal_handler;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  return sigaction(SIGUSR1, &action, nullptr) == 0;
+}
+
+std::string default_path() {
+  auto* runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir && *runtime_dir)
+    return std::string(runtime_dir) + "/qrwnd-trace.json";
+  return std::string();
+}
+
+}  // namespace trace
@@ -0,0 +1,59 @@
+#ifndef TRACE_HH
+#define TRACE_HH
+
+#include <stdint.h>
+#include <string>
+
+// Always on tracing of spans into a per-thread ring buffer of the most
+// recent events. Recording is lock-free and never allocates once a thread
+// has recorded its first event. Dumped as Chrome trace event JSON, which
+// chrome://tracing and ui.perfetto.dev can open.
+
+namespace trace {
+
+// CLOCK_MONOTONIC in nanoseconds.
+uint64_t now_ns();
+
+// name must be a string literal, or otherwise outlive the process.
+void record(char const* name, uint64_t start_ns, uint64_t duration_ns,
+            uint64_t arg);
+
+// Records a span from construction to destruction.
+class Span {
+public:
+  explicit Span(char const* name, uint64_t arg = 0)
+    : name_(name), arg_(arg), start_(now_ns()) {}
+
+  ~Span() {
+    record(name_, start_, now_ns() - start_, arg_);
+  }
+
+  void set_arg(uint64_t arg) {
+    arg_ = arg;
+  }
+
+private:
+  Span(Span const&) = delete;
+  Span& operator=(Span const&) = delete;
+
+  char const* const name_;
+  uint64_t arg_;
+  uint64_t const start_;
+};
+
+// Writes all buffered events to path, created with mode 0600. Refuses to
+// follow a symlink. Async-signal-safe. Returns false if path couldn't be
+// written.
+bool dump(char const* path);
+
+// Dumps to path, or default_path() if empty, on SIGUSR1. Returns false if
+// both are empty.
+bool dump_on_signal(std::string const& path);
+
+// Returns $XDG_RUNTIME_DIR/qrwnd-trace.json, or an empty string if
+// XDG_RUNTIME_DIR isn't set. Shared directories like /tmp aren't safe.
+std::string default_path();
+
+}  // namespace trace
+
+#endif  // TRACE_HH
@@ -0,0 +1,62 @@
+#include "common.hh"
+
+#include "unix_socket.hh"
+
+#include <errno.h>
+#include <iostream>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// True if path is a socket nobody listens on. Only then is it safe to
+// unlink, path might be a file or a socket some other process serves.
+bool stale(struct sockaddr_un const& addr) {
+  struct stat st;
+  if (lstat(addr.sun_path, &st) || !S_ISSOCK(st.st_mode))
+    return false;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return false;
+  bool refused = connect(fd, reinterpret_cast<struct sockaddr const*>(&addr),
+                         sizeof(addr)) && errno == ECONNREFUSED;
+  close(fd);
+  return refused;
+}
+
+}  // namespace
+
+int listen_unix_socket(std::string const& path, std::ostream& err) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    err << path << ": Path too long" << std::endl;
+    return -1;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    err << path << ": " << strerror(errno) << std::endl;
+    return -1;
+  }
+  auto bind_path = [&]() {
+    return bind(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                sizeof(addr)) == 0;
+  };
+  bool bound = bind_path();
+  if (!bound && errno == EADDRINUSE && stale(addr)) {
+    // Left behind by an earlier run.
+    unlink(path.c_str());
+    bound = bind_path();
+  }
+  if (!bound || listen(fd, 4)) {
+    err << path << ": " << strerror(errno) << std::endl;
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
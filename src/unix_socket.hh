@@ -0,0 +1,13 @@
+#ifndef UNIX_SOCKET_HH
+#define UNIX_SOCKET_HH
+
+#include <iosfwd>
+#include <string>
+
+// Returns a listening unix socket bound to path, or -1 after writing the
+// error to err. A socket left behind by an earlier run is replaced, but
+// only if nothing accepts connections on it anymore. Anything else at path,
+// like a regular file or a live socket, is left alone and is an error.
+int listen_unix_socket(std::string const& path, std::ostream& err);
+
+#endif  // UNIX_SOCKET_HH
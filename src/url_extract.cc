@@ -0,0 +1,120 @@
+#include "common.hh"
+
+#include "url_extract.hh"
+
+#include <algorithm>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Longest scheme looked for, the registered ones are all far shorter.
+constexpr size_t kMaxScheme = 32;
+
+bool is_alpha(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+bool is_scheme_char(char c) {
+  return is_alpha(c) || (c >= '0' && c <= '9') || c == '+' || c == '-' ||
+    c == '.';
+}
+
+bool ends_url(char c) {
+  return static_cast<unsigned char>(c) <= ' ' || c == 0x7f || c == '"' ||
+    c == '\'' || c == '<' || c == '>' || c == '`';
+}
+
+bool is_trailing_punctuation(char c) {
+  return c == '.' || c == ',' || c == ';' || c == ':' || c == '!' ||
+    c == '?';
+}
+
+// Returns the offset of the first "://" at or after pos, or size.
+size_t find_separator(char const* data, size_t size, size_t pos) {
+#if defined(__SSE2__)
+  auto const colon = _mm_set1_epi8(':');
+  auto const slash = _mm_set1_epi8('/');
+  // Each step reads 18 bytes, the 16 candidates and the two after.
+  while (pos + 18 <= size) {
+    auto a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + pos));
+    auto b = _mm_loadu_si128(
+        reinterpret_cast<__m128i const*>(data + pos + 1));
+    auto c = _mm_loadu_si128(
+        reinterpret_cast<__m128i const*>(data + pos + 2));
+    auto match = _mm_and_si128(
+        _mm_cmpeq_epi8(a, colon),
+        _mm_and_si128(_mm_cmpeq_epi8(b, slash), _mm_cmpeq_epi8(c, slash)));
+    auto mask = _mm_movemask_epi8(match);
+    if (mask)
+      return pos + __builtin_ctz(mask);
+    pos += 16;
+  }
+#endif
+  while (pos + 3 <= size) {
+    auto* colon = static_cast<char const*>(
+        memchr(data + pos, ':', size - 2 - pos));
+    if (!colon)
+      break;
+    pos = colon - data;
+    if (data[pos + 1] == '/' && data[pos + 2] == '/')
+      return pos;
+    ++pos;
+  }
+  return size;
+}
+
+}  // namespace
+
+void extract_urls(std::string_view text, size_t max,
+                  std::vector<std::string_view>* urls) {
+  auto const* data = text.data();
+  auto const size = text.size();
+  size_t const first = urls->size();
+  size_t pos = 0;
+  while (urls->size() - first < max) {
+    auto sep = find_separator(data, size, pos);
+    if (sep == size)
+      break;
+
+    auto limit = sep > kMaxScheme ? sep - kMaxScheme : 0;
+    auto start = sep;
+    while (start > limit && is_scheme_char(data[start - 1]))
+      --start;
+    while (start < sep && !is_alpha(data[start]))
+      ++start;
+
+    auto end = sep + 3;
+    int open = 0;
+    while (end < size && !ends_url(data[end])) {
+      if (data[end] == '(') {
+        ++open;
+      } else if (data[end] == ')') {
+        --open;
+      }
+      ++end;
+    }
+    while (end > sep + 3) {
+      char c = data[end - 1];
+      if (is_trailing_punctuation(c)) {
+        --end;
+      } else if (c == ')' && open < 0) {
+        // Closes a parenthesis around the URL, not one in it.
+        ++open;
+        --end;
+      } else {
+        break;
+      }
+    }
+    pos = std::max(end, sep + 3);
+    if (start == sep || end == sep + 3)
+      continue;
+
+    std::string_view url(data + start, end - start);
+    if (std::find(urls->begin() + first, urls->end(), url) == urls->end())
+      urls->push_back(url);
+  }
+}
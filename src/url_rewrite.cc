@@ -0,0 +1,244 @@
+#include "common.hh"
+
+#include "qr_capacity.hh"
+#include "url_rewrite.hh"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+struct Rule {
+  std::string name;
+  bool prefix;
+  std::string host;
+};
+
+char ascii_tolower(char c) {
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+void append_lower(std::string& out, std::string_view str) {
+  for (auto c : str)
+    out.push_back(ascii_tolower(c));
+}
+
+bool valid_scheme(std::string_view scheme) {
+  if (scheme.empty())
+    return false;
+  for (auto c : scheme) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') || c == '+' || c == '-' || c == '.')
+      continue;
+    return false;
+  }
+  return true;
+}
+
+bool is_default_port(std::string_view scheme, std::string_view port) {
+  if (port.empty())
+    return true;
+  if (scheme == "http" || scheme == "ws")
+    return port == "80";
+  if (scheme == "https" || scheme == "wss")
+    return port == "443";
+  if (scheme == "ftp")
+    return port == "21";
+  return false;
+}
+
+// host is already lowercase, rule host is lowercased when loaded.
+bool host_matches(std::string_view host, std::string_view rule_host) {
+  if (rule_host.empty())
+    return true;
+  if (host.size() < rule_host.size())
+    return false;
+  if (host.substr(host.size() - rule_host.size()) != rule_host)
+    return false;
+  return host.size() == rule_host.size() ||
+    host[host.size() - rule_host.size() - 1] == '.';
+}
+
+class UrlRewriterImpl : public UrlRewriter {
+public:
+  UrlRewriterImpl() = default;
+
+  bool load(std::string const& file, std::ostream& err) override {
+    std::ifstream in(file);
+    if (!in.good()) {
+      err << file << ": Unable to open file" << std::endl;
+      return false;
+    }
+    std::vector<Rule> rules;
+    std::string line;
+    int line_nr = 0;
+    while (std::getline(in, line)) {
+      ++line_nr;
+      auto comment = line.find('#');
+      if (comment != std::string::npos)
+        line.erase(comment);
+      std::istringstream tokens(line);
+      std::string directive;
+      if (!(tokens >> directive))
+        continue;
+      if (directive != "strip") {
+        err << file << ':' << line_nr << ": Unknown rule: " << directive
+            << std::endl;
+        return false;
+      }
+      Rule rule;
+      if (!(tokens >> rule.name)) {
+        err << file << ':' << line_nr << ": strip needs a parameter name"
+            << std::endl;
+        return false;
+      }
+      rule.prefix = rule.name.back() == '*';
+      if (rule.prefix)
+        rule.name.pop_back();
+      std::string host;
+      if (tokens >> host)
+        append_lower(rule.host, host);
+      std::string extra;
+      if (tokens >> extra) {
+        err << file << ':' << line_nr << ": Unexpected " << extra
+            << std::endl;
+        return false;
+      }
+      rules.push_back(std::move(rule));
+    }
+    rules_ = std::move(rules);
+    return true;
+  }
+
+  bool rewrite(std::string& url) override {
+    ++stats_.urls;
+
+    auto scheme_end = url.find("://");
+    if (scheme_end == std::string::npos ||
+        !valid_scheme(std::string_view(url).substr(0, scheme_end)))
+      return false;
+
+    std::string_view in(url);
+    auto& out = buffer_;
+    out.clear();
+    out.reserve(url.size());
+
+    append_lower(out, in.substr(0, scheme_end));
+    out.append("://");
+
+    auto authority_start = scheme_end + 3;
+    auto authority_end = in.find_first_of("/?#", authority_start);
+    if (authority_end == std::string_view::npos)
+      authority_end = in.size();
+    auto authority = in.substr(authority_start,
+                               authority_end - authority_start);
+    auto at = authority.rfind('@');
+    if (at != std::string_view::npos) {
+      out.append(authority.substr(0, at + 1));
+      authority = authority.substr(at + 1);
+    }
+    auto port_start = authority.rfind(':');
+    // Make sure not to confuse IPv6 address with port
+    if (port_start != std::string_view::npos &&
+        authority.find(']', port_start) != std::string_view::npos)
+      port_start = std::string_view::npos;
+    auto host_start = out.size();
+    append_lower(out, authority.substr(0, port_start));
+    auto host_size = out.size() - host_start;
+    if (port_start != std::string_view::npos) {
+      auto port = authority.substr(port_start + 1);
+      if (!is_default_port(std::string_view(out.data(), scheme_end), port)) {
+        out.push_back(':');
+        out.append(port);
+      }
+    }
+
+    auto rest = in.substr(authority_end);
+    auto fragment_start = rest.find('#');
+    auto query_start = rest.substr(0, fragment_start).find('?');
+    out.append(rest.substr(0, std::min(query_start, fragment_start)));
+
+    if (query_start != std::string_view::npos) {
+      auto query = rest.substr(query_start + 1,
+                               fragment_start == std::string_view::npos
+                               ? std::string_view::npos
+                               : fragment_start - query_start - 1);
+      bool first = true;
+      while (true) {
+        auto end = query.find('&');
+        auto param = query.substr(0, end);
+        if (!param.empty() &&
+            !strip(std::string_view(out.data() + host_start, host_size),
+                   param.substr(0, param.find('=')))) {
+          out.push_back(first ? '?' : '&');
+          out.append(param);
+          first = false;
+        }
+        if (end == std::string_view::npos)
+          break;
+        query = query.substr(end + 1);
+      }
+    }
+
+    if (fragment_start != std::string_view::npos &&
+        fragment_start + 1 < rest.size()) {
+      out.append(rest.substr(fragment_start));
+    }
+
+    if (out == url)
+      return false;
+
+    ++stats_.rewritten;
+    stats_.bytes_saved += url.size() > out.size() ? url.size() - out.size() : 0;
+    auto old_version = qr_min_version_8bit(url.size());
+    auto new_version = qr_min_version_8bit(out.size());
+    if (old_version == 0 && new_version > 0) {
+      ++stats_.made_to_fit;
+    } else if (old_version > new_version && new_version > 0) {
+      stats_.versions_saved += old_version - new_version;
+    }
+    // Copy rather than swap, url keeps its (preallocated) buffer.
+    url.assign(out);
+    return true;
+  }
+
+  Stats const& stats() const override {
+    return stats_;
+  }
+
+  void print_stats(std::ostream& out) const override {
+    out << "URL rewrite: " << stats_.urls << " urls, "
+        << stats_.rewritten << " rewritten, "
+        << stats_.bytes_saved << " bytes saved, "
+        << stats_.versions_saved << " versions saved, "
+        << stats_.made_to_fit << " made to fit" << std::endl;
+  }
+
+private:
+  bool strip(std::string_view host, std::string_view name) const {
+    for (auto const& rule : rules_) {
+      if (rule.prefix) {
+        if (name.substr(0, rule.name.size()) != rule.name)
+          continue;
+      } else if (name != rule.name) {
+        continue;
+      }
+      if (host_matches(host, rule.host))
+        return true;
+    }
+    return false;
+  }
+
+  std::vector<Rule> rules_;
+  std::string buffer_;
+  Stats stats_;
+};
+
+}  // namespace
+
+std::unique_ptr<UrlRewriter> UrlRewriter::create() {
+  return std::make_unique<UrlRewriterImpl>();
+}
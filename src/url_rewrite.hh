@@ -0,0 +1,49 @@
+#ifndef URL_REWRITE_HH
+#define URL_REWRITE_HH
+
+#include <iosfwd>
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+// Strips tracking parameters from, and normalizes, URLs before they are
+// encoded so that the code ends up as small as possible.
+class UrlRewriter {
+public:
+  virtual ~UrlRewriter() = default;
+
+  struct Stats {
+    uint64_t urls = 0;
+    uint64_t rewritten = 0;
+    uint64_t bytes_saved = 0;
+    // Only of URLs that fit in a code before the rewrite.
+    uint64_t versions_saved = 0;
+    // URLs too long for any code until rewritten.
+    uint64_t made_to_fit = 0;
+  };
+
+  // Returned rewriter has no rules, it only normalizes.
+  static std::unique_ptr<UrlRewriter> create();
+
+  // Replaces the current rules with the ones in file.
+  // Rules are one per line, "#" starts a comment:
+  //   strip NAME [HOST]
+  // Removes query parameter NAME, NAME may end with "*" to match all
+  // parameters with that prefix. If HOST is given the rule only applies
+  // to that host and its subdomains.
+  virtual bool load(std::string const& file, std::ostream& err) = 0;
+
+  // Rewrites url in place, returns true if url was changed.
+  virtual bool rewrite(std::string& url) = 0;
+
+  virtual Stats const& stats() const = 0;
+
+  virtual void print_stats(std::ostream& out) const = 0;
+
+protected:
+  UrlRewriter() = default;
+  UrlRewriter(UrlRewriter const&) = delete;
+  UrlRewriter& operator=(UrlRewriter const&) = delete;
+};
+
+#endif  // URL_REWRITE_HH
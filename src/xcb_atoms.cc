@@ -1,75 +1,38 @@
 #include "common.hh"
 
+#include "roundtrip.hh"
 #include "xcb_atoms.hh"
 #include "xcb_connection.hh"
 #include "xcb_event.hh"
 
-#include <map>
-#include <vector>
-
 namespace xcb {
 
-namespace {
+namespace internal {
 
-class AtomsImpl : public Atoms {
-public:
-  explicit AtomsImpl(shared_conn conn)
-    : conn_(conn), storage_(std::make_shared<StorageImpl>()) {}
+xcb_intern_atom_cookie_t intern_atom(xcb_connection_t* conn,
+                                     std::string_view name) {
+  return xcb_intern_atom(conn, 0, name.size(), name.data());
+}
 
-  Reference get(std::string atom) override {
-    auto it = index_.find(atom);
-    size_t index;
-    if (it == index_.end()) {
-      index = cookie_.size();
-      cookie_.push_back(
-          xcb_intern_atom(conn_.get(), 0, atom.size(), atom.c_str()));
-      index_.emplace(std::move(atom), index);
+bool intern_atom_replies(xcb_connection_t* conn,
+                         xcb_intern_atom_cookie_t const* cookie,
+                         size_t count, xcb_atom_t* atom) {
+  bool ret = true;
+  // Always collect all replies, even after a failure, so none is left
+  // queued in the connection.
+  for (size_t i = 0; i < count; ++i) {
+    auto reply = roundtrip::wait_reply<xcb_intern_atom_reply_t>(
+        conn, cookie[i], nullptr);
+    if (reply) {
+      atom[i] = reply->atom;
     } else {
-      index = it->second;
+      atom[i] = XCB_NONE;
+      ret = false;
     }
-    return Reference(storage_, index);
   }
-
-  bool sync() override {
-    std::vector<xcb_atom_t> atoms;
-    atoms.reserve(cookie_.size());
-    for (auto const& cookie : cookie_) {
-      xcb::reply<xcb_intern_atom_reply_t> reply(
-          xcb_intern_atom_reply(conn_.get(), cookie, nullptr));
-      if (!reply)
-        return false;
-      atoms.push_back(reply->atom);
-    }
-    storage_->set(std::move(atoms));
-    return true;
-  }
-
-private:
-  class StorageImpl : public Storage {
-  public:
-    xcb_atom_t get(size_t id) const override {
-      assert(id < resolved_.size());
-      return resolved_[id];
-    }
-
-    void set(std::vector<xcb_atom_t> resolved) {
-      resolved_ = std::move(resolved);
-    }
-
-  private:
-    std::vector<xcb_atom_t> resolved_;
-  };
-
-  shared_conn conn_;
-  std::map<std::string, size_t> index_;
-  std::vector<xcb_intern_atom_cookie_t> cookie_;
-  std::shared_ptr<StorageImpl> storage_;
-};
-
-}  // namespace
-
-std::unique_ptr<Atoms> Atoms::create(shared_conn conn) {
-  return std::make_unique<AtomsImpl>(conn);
+  return ret;
 }
 
+}  // namespace internal
+
 }  // namespace xcb
@@ -3,53 +3,123 @@
 
 #include "xcb_connection.hh"
 
-#include <memory>
-#include <string>
+#include <array>
+#include <initializer_list>
+#include <stddef.h>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 #include <xcb/xproto.h>
 
 namespace xcb {
 
-class Atoms {
-protected:
-  class Storage;
+namespace internal {
 
-public:
-  virtual ~Atoms() = default;
+xcb_intern_atom_cookie_t intern_atom(xcb_connection_t* conn,
+                                     std::string_view name);
 
-  class Reference {
-  public:
-    xcb_atom_t get() {
-      return atoms_->get(id_);
-    }
+// Waits for all replies, returns false if any of them failed.
+bool intern_atom_replies(xcb_connection_t* conn,
+                         xcb_intern_atom_cookie_t const* cookie,
+                         size_t count, xcb_atom_t* atom);
 
-    Reference(std::shared_ptr<Storage> atoms, size_t id)
-      : atoms_(atoms), id_(id) {}
+}  // namespace internal
 
-  private:
-    std::shared_ptr<Storage> atoms_;
-    size_t id_;
-  };
+template<typename Id>
+struct AtomName {
+  Id id;
+  std::string_view name;
+};
 
-  virtual Reference get(std::string atom) = 0;
+template<typename Id, size_t N>
+using AtomTable = std::array<AtomName<Id>, N>;
+
+// True if every entry is at the index of its id, for a static_assert next
+// to the table.
+template<typename Id, size_t N>
+constexpr bool in_order(AtomTable<Id, N> const& names) {
+  for (size_t i = 0; i < N; ++i) {
+    if (static_cast<size_t>(names[i].id) != i)
+      return false;
+  }
+  return true;
+}
+
+// Interns all atoms in one pipelined batch. Atoms with names known at compile
+// time are listed in a constexpr table and looked up by the enum Id, whose
+// values must be 0 to N - 1 in table order, with Id::LAST the last one.
+// Atoms with names only known at runtime are added with add() before
+// sync().
+template<typename Id, size_t N>
+class Atoms {
+public:
+  static_assert(std::is_enum_v<Id>, "Id must be an enum");
+  static_assert(static_cast<size_t>(Id::LAST) + 1 == N,
+                "The table must have one name per Id");
 
-  virtual bool sync() = 0;
+  using Table = AtomTable<Id, N>;
 
-  static std::unique_ptr<Atoms> create(shared_conn conn);
+  // Queues intern requests for all names, call sync() to wait for them.
+  Atoms(shared_conn conn, Table const& names)
+    : conn_(std::move(conn)) {
+    assert(in_order(names));
+    for (size_t i = 0; i < N; ++i)
+      cookie_[i] = internal::intern_atom(conn_.get(), names[i].name);
+  }
 
-protected:
-  Atoms() = default;
   Atoms(Atoms const&) = delete;
   Atoms& operator=(Atoms const&) = delete;
 
-  class Storage {
-  public:
-    virtual ~Storage() = default;
-
-    virtual xcb_atom_t get(size_t id) const = 0;
-
-  protected:
-    Storage() = default;
-  };
+  // Returns the index to use with dynamic().
+  size_t add(std::string_view name) {
+    dynamic_cookie_.push_back(internal::intern_atom(conn_.get(), name));
+    return dynamic_cookie_.size() - 1;
+  }
+
+  // Waits for the replies of ids only, so they can be used before sync().
+  bool sync(std::initializer_list<Id> ids) {
+    for (auto id : ids)
+      wait(static_cast<size_t>(id));
+    return ok_;
+  }
+
+  bool sync() {
+    for (size_t i = 0; i < N; ++i)
+      wait(i);
+    dynamic_.resize(dynamic_cookie_.size());
+    if (!internal::intern_atom_replies(conn_.get(), dynamic_cookie_.data(),
+                                       dynamic_cookie_.size(),
+                                       dynamic_.data()))
+      ok_ = false;
+    return ok_;
+  }
+
+  // Only valid after sync() has returned true, or sync(ids) for ids.
+  xcb_atom_t operator[](Id id) const {
+    return atom_[static_cast<size_t>(id)];
+  }
+
+  xcb_atom_t dynamic(size_t index) const {
+    return dynamic_[index];
+  }
+
+private:
+  void wait(size_t index) {
+    if (done_[index])
+      return;
+    done_[index] = true;
+    if (!internal::intern_atom_replies(conn_.get(), &cookie_[index], 1,
+                                       &atom_[index]))
+      ok_ = false;
+  }
+
+  shared_conn conn_;
+  std::array<xcb_intern_atom_cookie_t, N> cookie_;
+  std::array<xcb_atom_t, N> atom_{};
+  std::array<bool, N> done_{};
+  bool ok_ = true;
+  std::vector<xcb_intern_atom_cookie_t> dynamic_cookie_;
+  std::vector<xcb_atom_t> dynamic_;
 };
 
 }  // namespace xcb
@@ -1,8 +1,16 @@
 #include "common.hh"
 
+#include "roundtrip.hh"
 #include "xcb_event.hh"
 #include "xcb_xkb.hh"
 
+#include <algorithm>
+#include <optional>
+#include <string.h>
+#include <string>
+#include <strings.h>
+#include <vector>
+
 #define explicit dont_use_cxx_explicit
 #include <xcb/xkb.h>
 #undef explicit
@@ -38,27 +46,47 @@ public:
   KeyboardImpl() = default;
 
   bool init(xcb_connection_t* conn) {
-    if (!xkb_x11_setup_xkb_extension(conn,
-                                     XKB_X11_MIN_MAJOR_XKB_VERSION,
-                                     XKB_X11_MIN_MINOR_XKB_VERSION,
-                                     XKB_X11_SETUP_XKB_EXTENSION_NO_FLAGS,
-                                     NULL, NULL, &first_xkb_event_, NULL))
-      return false;
+    conn_ = conn;
+    // Only sends QueryExtension. UseExtension would block on its reply,
+    // and libxcb closes the connection if the server lacks XKB, so it
+    // waits for setup().
+    xcb_prefetch_extension_data(conn, &xcb_xkb_id);
 
     ctx_.reset(xkb_context_new(XKB_CONTEXT_NO_FLAGS));
-    if (!ctx_)
+    return ctx_ != nullptr;
+  }
+
+  bool setup() override {
+    if (setup_ != SetupState::PENDING)
+      return setup_ == SetupState::DONE;
+    setup_ = SetupState::FAILED;
+
+    // Same as xkb_x11_setup_xkb_extension(), with the round trip counted.
+    auto* extension = xcb_get_extension_data(conn_, &xcb_xkb_id);
+    if (!extension || !extension->present)
       return false;
-    device_id_ = xkb_x11_get_core_keyboard_device_id(conn);
+    auto reply = roundtrip::wait_reply<xcb_xkb_use_extension_reply_t>(
+        conn_, xcb_xkb_use_extension(conn_, XKB_X11_MIN_MAJOR_XKB_VERSION,
+                                     XKB_X11_MIN_MINOR_XKB_VERSION),
+        nullptr);
+    if (!reply || !reply->supported)
+      return false;
+    first_xkb_event_ = extension->first_event;
+
+    device_id_ = xkb_x11_get_core_keyboard_device_id(conn_);
     if (device_id_ == -1)
       return false;
-    if (!update_keymap(conn))
+    if (!update_keymap())
       return false;
-    select_events(conn);
+    select_events();
+    setup_ = SetupState::DONE;
     return true;
   }
 
-  bool handle_event(xcb_connection_t* conn,
+  bool handle_event(xcb_connection_t* /* conn */,
                     xcb_generic_event_t* event) override {
+    if (setup_ != SetupState::DONE)
+      return false;
     if (XCB_EVENT_RESPONSE_TYPE(event) == first_xkb_event_) {
       auto* xkb_event = reinterpret_cast<xkb_generic_event_t*>(event);
       if (xkb_event->deviceID == device_id_) {
@@ -67,20 +95,21 @@ public:
           auto* e =
             reinterpret_cast<xcb_xkb_new_keyboard_notify_event_t*>(event);
           if (e->changed & XCB_XKB_NKN_DETAIL_KEYCODES)
-            update_keymap(conn);
+            keymap_dirty_ = true;
           break;
         }
         case XCB_XKB_MAP_NOTIFY:
-          update_keymap(conn);
-          break;
-        case XCB_XKB_STATE_NOTIFY: {
-          auto* e =
-            reinterpret_cast<xcb_xkb_state_notify_event_t*>(event);
-          xkb_state_update_mask(state_.get(),
-                                e->baseMods, e->latchedMods, e->lockedMods,
-                                e->baseGroup, e->latchedGroup, e->lockedGroup);
+          // Map changes tend to come in bursts, only recompile once when
+          // the keymap is needed next.
+          keymap_dirty_ = true;
           break;
         }
+        if (keymap_dirty_ && grab_keysym_ != XKB_KEY_NoSymbol) {
+          // The grabbed key may have moved, can't wait for the next press.
+          keymap_dirty_ = false;
+          update_keymap();
+          ungrab();
+          grab();
         }
       }
       return true;
@@ -88,13 +117,71 @@ public:
     return false;
   }
 
-  std::string get_utf8(xcb_key_press_event_t* event) override {
-    char tmp[16];
-    xkb_state_key_get_utf8(state_.get(), event->detail, tmp, sizeof(tmp));
-    return std::string(tmp);
+  bool grab_key(xcb_window_t window, std::string_view key) override {
+    uint16_t modifiers = 0;
+    while (true) {
+      auto plus = key.find('+');
+      // A trailing + is the keysym, not a separator.
+      if (plus == std::string_view::npos || plus + 1 == key.size())
+        break;
+      auto modifier = parse_modifier(key.substr(0, plus));
+      if (!modifier)
+        return false;
+      modifiers |= *modifier;
+      key.remove_prefix(plus + 1);
+    }
+    std::string name(key);
+    auto keysym = xkb_keysym_from_name(name.c_str(), XKB_KEYSYM_NO_FLAGS);
+    if (keysym == XKB_KEY_NoSymbol) {
+      keysym = xkb_keysym_from_name(name.c_str(),
+                                    XKB_KEYSYM_CASE_INSENSITIVE);
+    }
+    if (keysym == XKB_KEY_NoSymbol || !setup())
+      return false;
+    if (keymap_dirty_) {
+      keymap_dirty_ = false;
+      update_keymap();
+    }
+    ungrab();
+    grab_window_ = window;
+    grab_keysym_ = keysym;
+    grab_modifiers_ = modifiers;
+    return grab();
+  }
+
+  bool is_grabbed(xcb_key_press_event_t const* event) const override {
+    return (event->state & kCoreModsMask & ~kIgnoredModsMask) ==
+      grab_modifiers_ &&
+      std::find(grab_keycode_.begin(), grab_keycode_.end(), event->detail)
+      != grab_keycode_.end();
+  }
+
+  std::string_view get_utf8(xcb_key_press_event_t* event) override {
+    if (!setup())
+      return std::string_view();
+    if (keymap_dirty_) {
+      keymap_dirty_ = false;
+      update_keymap();
+    }
+    // The modifiers and group in effect for the key are included in the
+    // event, so no need to track the keyboard state for the whole desktop.
+    xkb_state_update_mask(state_.get(),
+                          event->state & kCoreModsMask, 0, 0,
+                          0, 0, (event->state >> kCoreGroupShift) & 3);
+    auto len = xkb_state_key_get_utf8(state_.get(), event->detail,
+                                      utf8_, sizeof(utf8_));
+    if (len < 0)
+      return std::string_view();
+    return std::string_view(utf8_, std::min<size_t>(len, sizeof(utf8_) - 1));
   }
 
 private:
+  enum class SetupState {
+    PENDING,
+    DONE,
+    FAILED,
+  };
+
   struct xkb_generic_event_t {
     uint8_t response_type;
     uint8_t xkbType;
@@ -103,12 +190,101 @@ private:
     uint8_t deviceID;
   };
 
-  bool update_keymap(xcb_connection_t* conn) {
-    auto* keymap = xkb_x11_keymap_new_from_device(ctx_.get(), conn, device_id_,
+  // Shift, Lock, Control and Mod1-5 in xcb_key_press_event_t::state
+  static constexpr uint16_t kCoreModsMask = 0xff;
+  // Bits 13 and 14 in xcb_key_press_event_t::state is the XKB group.
+  static constexpr int kCoreGroupShift = 13;
+  // Caps Lock and Num Lock, Num Lock is Mod2 on about every keymap.
+  static constexpr uint16_t kIgnoredModsMask =
+    XCB_MOD_MASK_LOCK | XCB_MOD_MASK_2;
+
+  static std::optional<uint16_t> parse_modifier(std::string_view name) {
+    static constexpr struct {
+      char const* name;
+      uint16_t mask;
+    } kModifiers[] = {
+      { "Shift", XCB_MOD_MASK_SHIFT },
+      { "Control", XCB_MOD_MASK_CONTROL },
+      { "Ctrl", XCB_MOD_MASK_CONTROL },
+      { "Alt", XCB_MOD_MASK_1 },
+      { "Mod1", XCB_MOD_MASK_1 },
+      { "Mod3", XCB_MOD_MASK_3 },
+      { "Super", XCB_MOD_MASK_4 },
+      { "Mod4", XCB_MOD_MASK_4 },
+      { "Mod5", XCB_MOD_MASK_5 },
+    };
+    for (auto const& modifier : kModifiers) {
+      if (name.size() == strlen(modifier.name) &&
+          strncasecmp(name.data(), modifier.name, name.size()) == 0)
+        return modifier.mask;
+    }
+    return std::nullopt;
+  }
+
+  struct KeycodeSearch {
+    xkb_keysym_t keysym;
+    std::vector<xcb_keycode_t>* keycode;
+  };
+
+  static void find_keycode(xkb_keymap* keymap, xkb_keycode_t key,
+                           void* data) {
+    auto* search = reinterpret_cast<KeycodeSearch*>(data);
+    // Only the first layout, grabs are by keycode and work in all layouts.
+    auto levels = xkb_keymap_num_levels_for_key(keymap, key, 0);
+    for (xkb_level_index_t level = 0; level < levels; ++level) {
+      xkb_keysym_t const* syms;
+      auto count = xkb_keymap_key_get_syms_by_level(keymap, key, 0, level,
+                                                    &syms);
+      if (std::find(syms, syms + count, search->keysym) != syms + count) {
+        search->keycode->push_back(key);
+        return;
+      }
+    }
+  }
+
+  bool grab() {
+    KeycodeSearch search{ grab_keysym_, &grab_keycode_ };
+    xkb_keymap_key_for_each(keymap_.get(), find_keycode, &search);
+    if (grab_keycode_.empty())
+      return false;
+    static constexpr uint16_t kIgnored[] = {
+      0, XCB_MOD_MASK_LOCK, XCB_MOD_MASK_2,
+      XCB_MOD_MASK_LOCK | XCB_MOD_MASK_2,
+    };
+    std::vector<xcb_void_cookie_t> cookie;
+    for (auto keycode : grab_keycode_) {
+      for (auto ignored : kIgnored) {
+        cookie.push_back(xcb_grab_key_checked(
+            conn_, 1, grab_window_, grab_modifiers_ | ignored, keycode,
+            XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC));
+      }
+    }
+    bool ret = true;
+    // Check all, so no error is left to show up as an event.
+    for (auto const& c : cookie) {
+      xcb::reply<xcb_generic_error_t> err(xcb_request_check(conn_, c));
+      if (err)
+        ret = false;
+    }
+    if (!ret)
+      ungrab();
+    return ret;
+  }
+
+  void ungrab() {
+    for (auto keycode : grab_keycode_)
+      xcb_ungrab_key(conn_, keycode, grab_window_, XCB_MOD_MASK_ANY);
+    grab_keycode_.clear();
+  }
+
+  bool update_keymap() {
+    auto* keymap = xkb_x11_keymap_new_from_device(ctx_.get(), conn_,
+                                                  device_id_,
                                                   XKB_KEYMAP_COMPILE_NO_FLAGS);
     if (!keymap)
       return false;
-    auto* state = xkb_x11_state_new_from_device(keymap, conn, device_id_);
+    // State is set from each key event, no need to fetch it from the server.
+    auto* state = xkb_state_new(keymap);
     if (!state) {
       xkb_keymap_unref(keymap);
       return false;
@@ -118,7 +294,7 @@ private:
     return true;
   }
 
-  void select_events(xcb_connection_t *conn) {
+  void select_events() {
     static const uint16_t new_keyboard_details = XCB_XKB_NKN_DETAIL_KEYCODES;
     static const uint16_t map_parts = XCB_XKB_MAP_PART_KEY_TYPES |
       XCB_XKB_MAP_PART_KEY_SYMS |
@@ -127,24 +303,17 @@ private:
       XCB_XKB_MAP_PART_KEY_ACTIONS |
       XCB_XKB_MAP_PART_VIRTUAL_MODS |
       XCB_XKB_MAP_PART_VIRTUAL_MOD_MAP;
-    static const uint16_t state_details = XCB_XKB_STATE_PART_MODIFIER_BASE |
-      XCB_XKB_STATE_PART_MODIFIER_LATCH |
-      XCB_XKB_STATE_PART_MODIFIER_LOCK |
-      XCB_XKB_STATE_PART_GROUP_BASE |
-      XCB_XKB_STATE_PART_GROUP_LATCH |
-      XCB_XKB_STATE_PART_GROUP_LOCK;
 
+    // No XCB_XKB_EVENT_TYPE_STATE_NOTIFY, that would wake us up for every
+    // modifier change on the whole desktop.
     xcb_xkb_select_events_details_t details = {};
     details.affectNewKeyboard = new_keyboard_details;
     details.newKeyboardDetails = new_keyboard_details;
-    details.affectState = state_details;
-    details.stateDetails = state_details;
 
-    xcb_xkb_select_events_aux(conn,
+    xcb_xkb_select_events_aux(conn_,
                               device_id_,
                               XCB_XKB_EVENT_TYPE_NEW_KEYBOARD_NOTIFY |
-                              XCB_XKB_EVENT_TYPE_MAP_NOTIFY |
-                              XCB_XKB_EVENT_TYPE_STATE_NOTIFY,
+                              XCB_XKB_EVENT_TYPE_MAP_NOTIFY,
                               0,
                               0,
                               map_parts,
@@ -155,8 +324,16 @@ private:
   std::unique_ptr<xkb_context, ContextDeleter> ctx_;
   std::unique_ptr<xkb_keymap, KeymapDeleter> keymap_;
   std::unique_ptr<xkb_state, StateDeleter> state_;
+  xcb_connection_t* conn_ = nullptr;
+  SetupState setup_ = SetupState::PENDING;
   uint8_t first_xkb_event_;
   int32_t device_id_;
+  bool keymap_dirty_ = false;
+  char utf8_[16];
+  xcb_window_t grab_window_ = XCB_NONE;
+  xkb_keysym_t grab_keysym_ = XKB_KEY_NoSymbol;
+  uint16_t grab_modifiers_ = 0;
+  std::vector<xcb_keycode_t> grab_keycode_;
 };
 
 }  // namespace
@@ -2,7 +2,7 @@
 #define XCB_XKB_HH
 
 #include <memory>
-#include <string>
+#include <string_view>
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
 
@@ -15,8 +15,25 @@ public:
   virtual bool handle_event(xcb_connection_t* conn,
                             xcb_generic_event_t* event) = 0;
 
-  virtual std::string get_utf8(xcb_key_press_event_t* event) = 0;
+  // Returned string is valid until the next call.
+  virtual std::string_view get_utf8(xcb_key_press_event_t* event) = 0;
 
+  // Completes the initialization started by create(). Needs several round
+  // trips and compiles the keymap, so call it when there is time to spare.
+  // Called by get_utf8() if needed, returns false if XKB is unusable.
+  virtual bool setup() = 0;
+
+  // Grabs key on window, usually the root, for all clients. key is a
+  // keysym name, optionally prefixed by modifiers, like "Super+q". Caps
+  // Lock and Num Lock are ignored. The grab follows keymap changes.
+  // Returns false if key can't be parsed, isn't on the keyboard or is
+  // already grabbed by someone else.
+  virtual bool grab_key(xcb_window_t window, std::string_view key) = 0;
+
+  // True if event is a press of the key grabbed by grab_key().
+  virtual bool is_grabbed(xcb_key_press_event_t const* event) const = 0;
+
+  // Only prefetches the extension, call setup() to finish initialization.
   static std::unique_ptr<Keyboard> create(xcb_connection_t* conn);
 
 protected:
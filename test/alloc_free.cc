@@ -0,0 +1,164 @@
+#include "common.hh"
+
+#include "alloc_check.hh"
+#include "fixture.hh"
+#include "stats.hh"
+#include "test.hh"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Only built with the alloc_check option, which counts every operator new.
+// Drives Controller through selection changes with a scripted EventSource
+// and checks that, once caches and pools are warm, none of them makes C++
+// heap allocations. malloc() in libqrencode and libxcb isn't counted.
+// Values are queued before each change, as queuing them allocates.
+
+namespace {
+
+// Enough to fill the code cache with the grid changes, which have two
+// codes each, and to see every INCR size, as the surface pool only has
+// images for versions seen so far.
+constexpr int kWarmup = 20;
+constexpr int kChanges = 20;
+constexpr size_t kIncrChunk = 1000;
+constexpr int kIncrSizes = 5;
+
+// Checks that fn, a whole selection change, doesn't allocate.
+template<typename Fn>
+void expect_no_allocations(char const* name, int change, Fn const& fn) {
+  auto const before = alloc_check::count();
+  fn();
+  auto const allocations = alloc_check::count() - before;
+  EXPECT(allocations == 0);
+  if (allocations) {
+    std::cerr << name << " change " << change << " made " << allocations
+              << " allocations" << std::endl;
+  }
+}
+
+std::string url(int i) {
+  return "https://example.org/" + std::to_string(i);
+}
+
+void test_plain() {
+  Fixture fixture;
+  xcb_timestamp_t time = 1000;
+  for (int i = 0; i < kWarmup + kChanges; ++i) {
+    fixture.source().push(kUtf8String, url(i));
+    auto change = [&]() {
+      fixture.change_owner(time++);
+      fixture.answer();
+    };
+    if (i < kWarmup) {
+      change();
+    } else {
+      expect_no_allocations("Plain", i, change);
+    }
+  }
+  EXPECT(fixture.shown_hash() != 0);
+}
+
+void test_incr() {
+  Fixture fixture;
+  xcb_timestamp_t time = 1000;
+  for (int i = 0; i < kWarmup + kChanges; ++i) {
+    // Sizes vary, all within what a single code holds.
+    auto data = url(i) + "/" + std::string(1500 + (i % kIncrSizes) * 200,
+                                           'a');
+    uint32_t const size = data.size();
+    fixture.source().push(kIncr, std::string(
+        reinterpret_cast<char const*>(&size), sizeof(size)));
+    size_t chunks = 0;
+    for (size_t offset = 0; offset < data.size(); offset += kIncrChunk) {
+      fixture.source().push(kUtf8String, data.substr(offset, kIncrChunk));
+      ++chunks;
+    }
+    // Zero length chunk ends the transfer.
+    fixture.source().push(kUtf8String, "");
+    ++chunks;
+    auto change = [&]() {
+      fixture.change_owner(time++);
+      fixture.answer();
+      for (size_t c = 0; c < chunks; ++c)
+        fixture.chunk();
+    };
+    if (i < kWarmup) {
+      change();
+    } else {
+      expect_no_allocations("INCR", i, change);
+    }
+  }
+  EXPECT(fixture.shown_hash() != 0);
+}
+
+void test_grid() {
+  Fixture fixture;
+  xcb_timestamp_t time = 1000;
+  for (int i = 0; i < kWarmup + kChanges; ++i) {
+    fixture.source().push(kUtf8String, "See " + url(2 * i) + " and " +
+                          url(2 * i + 1) + ".");
+    auto change = [&]() {
+      fixture.change_owner(time++);
+      fixture.answer();
+    };
+    if (i < kWarmup) {
+      change();
+    } else {
+      expect_no_allocations("Grid", i, change);
+    }
+  }
+  EXPECT(fixture.shown_hash() != 0);
+}
+
+// The stats thread allocates to print, at any time, so isn't counted.
+void test_stats_server() {
+  char dir[] = "/tmp/qrwnd-alloc-free-XXXXXX";
+  if (!mkdtemp(dir))
+    return;
+  std::string const path = std::string(dir) + "/stats";
+  Stats stats;
+  auto server = StatsServer::create(&stats, path, std::cerr);
+  EXPECT(server);
+  if (server) {
+    expect_no_allocations("Stats query", 0, [&]() {
+      int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      struct sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      memcpy(addr.sun_path, path.data(), path.size());
+      char buf[4096];
+      size_t total = 0;
+      if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr),
+                             sizeof(addr)) == 0) {
+        // Until the server is done and closes the connection.
+        while (true) {
+          auto ret = read(fd, buf, sizeof(buf));
+          if (ret <= 0)
+            break;
+          total += ret;
+        }
+      }
+      if (fd >= 0)
+        close(fd);
+      EXPECT(total > 0);
+    });
+    server.reset();
+  }
+  rmdir(dir);
+}
+
+}  // namespace
+
+int main() {
+  test_plain();
+  test_incr();
+  test_grid();
+  test_stats_server();
+  return test_result();
+}
@@ -0,0 +1,174 @@
+#include "common.hh"
+
+#include "fake_server.hh"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+
+namespace {
+
+constexpr uint8_t kInternAtom = 16;
+constexpr uint8_t kGetInputFocus = 43;
+constexpr uint8_t kQueryExtension = 98;
+
+constexpr uint32_t kRoot = 0x100;
+constexpr uint32_t kRootVisual = 0x21;
+
+template<typename T>
+void put(uint8_t* data, T value) {
+  memcpy(data, &value, sizeof(value));
+}
+
+template<typename T>
+T get(uint8_t const* data) {
+  T value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+}  // namespace
+
+FakeServer::FakeServer(std::vector<std::string> extensions)
+  : extensions_(std::move(extensions)) {
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fd_))
+    return;
+  // Answered only once the client has sent its setup request, xcb reads
+  // anything arriving earlier as a reply.
+  std::thread setup([this]() {
+    uint8_t request[12];
+    read_all(request, sizeof(request));
+    // No vendor or pixmap formats, enough for xcb_connect_to_fd() and
+    // get_screen().
+    uint8_t reply[80] = {};
+    reply[0] = 1;  // Success.
+    reply[2] = 11;  // Protocol major version.
+    put<uint16_t>(reply + 6, (sizeof(reply) - 8) / 4);
+    put<uint32_t>(reply + 16, 0x1fffff);  // resource_id_mask
+    put<uint16_t>(reply + 26, 0xffff);  // maximum_request_length
+    reply[28] = 1;  // roots_len
+    auto* screen = reply + 40;
+    put<uint32_t>(screen, kRoot);
+    put<uint16_t>(screen + 20, 1920);
+    put<uint16_t>(screen + 22, 1080);
+    put<uint32_t>(screen + 32, kRootVisual);
+    screen[38] = 24;  // root_depth
+    write_all(reply, sizeof(reply));
+  });
+  conn_ = xcb::make_shared_conn(xcb_connect_to_fd(fd_[0], nullptr));
+  setup.join();
+}
+
+FakeServer::~FakeServer() {
+  stop();
+  conn_.reset();
+  if (fd_[1] >= 0)
+    close(fd_[1]);
+}
+
+void FakeServer::reply(std::initializer_list<uint16_t> sequences) {
+  std::vector<uint8_t> replies(32 * sequences.size());
+  auto* reply = replies.data();
+  for (auto sequence : sequences) {
+    reply[0] = 1;  // Reply.
+    put(reply + 2, sequence);
+    reply += 32;
+  }
+  write_all(replies.data(), replies.size());
+}
+
+void FakeServer::serve() {
+  thread_ = std::thread([this]() { run(); });
+}
+
+std::vector<FakeServer::Request> FakeServer::stop() {
+  if (thread_.joinable()) {
+    // Has the blocked read() return 0.
+    shutdown(fd_[1], SHUT_RD);
+    thread_.join();
+  }
+  return requests_;
+}
+
+void FakeServer::read_all(uint8_t* data, size_t size) {
+  while (size) {
+    auto ret = read(fd_[1], data, size);
+    if (ret <= 0)
+      return;
+    data += ret;
+    size -= ret;
+  }
+}
+
+void FakeServer::write_all(uint8_t const* data, size_t size) {
+  while (size) {
+    auto ret = write(fd_[1], data, size);
+    if (ret <= 0)
+      return;
+    data += ret;
+    size -= ret;
+  }
+}
+
+void FakeServer::run() {
+  std::vector<uint8_t> buffer;
+  std::vector<uint8_t> replies;
+  while (true) {
+    uint8_t tmp[4096];
+    auto ret = read(fd_[1], tmp, sizeof(tmp));
+    if (ret <= 0)
+      return;
+    buffer.insert(buffer.end(), tmp, tmp + ret);
+
+    size_t offset = 0;
+    while (buffer.size() - offset >= 4) {
+      size_t length = get<uint16_t>(buffer.data() + offset + 2) * 4;
+      // Zero is a BIG-REQUESTS length, which isn't supported.
+      if (length == 0)
+        return;
+      if (buffer.size() - offset < length)
+        break;
+      answer(buffer.data() + offset, &replies);
+      offset += length;
+    }
+    buffer.erase(buffer.begin(), buffer.begin() + offset);
+    write_all(replies.data(), replies.size());
+    replies_ += replies.size() / 32;
+    replies.clear();
+  }
+}
+
+void FakeServer::answer(uint8_t const* request,
+                        std::vector<uint8_t>* replies) {
+  ++sequence_;
+  Request record{ request[0], 0, std::string(), replies_ };
+  uint8_t reply[32] = {};
+  reply[0] = 1;  // Reply.
+  put(reply + 2, sequence_);
+  bool has_reply = true;
+  if (request[0] == kInternAtom) {
+    put(reply + 8, next_atom_++);
+  } else if (request[0] == kQueryExtension) {
+    record.extension.assign(reinterpret_cast<char const*>(request + 8),
+                            get<uint16_t>(request + 4));
+    for (size_t i = 0; i < extensions_.size(); ++i) {
+      if (extensions_[i] == record.extension) {
+        reply[8] = 1;  // present
+        reply[9] = major_opcode(i);
+        reply[10] = first_event(i);
+        reply[11] = 128 + i;  // first_error
+      }
+    }
+  } else if (request[0] >= 128) {
+    record.minor = request[1];
+    // Only the version requests, like XKB UseExtension, have minor 0.
+    has_reply = record.minor == 0;
+    reply[1] = 1;  // Supported, for UseExtension.
+  } else {
+    has_reply = request[0] == kGetInputFocus;
+  }
+  if (has_reply)
+    replies->insert(replies->end(), reply, reply + sizeof(reply));
+  requests_.push_back(std::move(record));
+}
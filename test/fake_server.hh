@@ -0,0 +1,79 @@
+#ifndef FAKE_SERVER_HH
+#define FAKE_SERVER_HH
+
+#include "xcb_connection.hh"
+
+#include <initializer_list>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The server end of an xcb connection over a socketpair, for tests that
+// need libxcb without a display. The setup has one screen, with a root
+// window and a visual but no depths.
+class FakeServer {
+public:
+  struct Request {
+    uint8_t major;
+    // Only for extension requests.
+    uint8_t minor;
+    // Only for QueryExtension.
+    std::string extension;
+    // Replies written before the request was read.
+    size_t replies_before;
+  };
+
+  // Extensions not listed are reported missing by QueryExtension.
+  explicit FakeServer(std::vector<std::string> extensions = {});
+  ~FakeServer();
+
+  // Owns the client end.
+  xcb::shared_conn const& conn() const {
+    return conn_;
+  }
+
+  bool ok() const {
+    return conn_ && !xcb_connection_has_error(conn_.get());
+  }
+
+  // Writes GetInputFocus replies to requests sequences in one write, so
+  // the client reads them all at once. Only without serve().
+  void reply(std::initializer_list<uint16_t> sequences);
+
+  // Reads requests in a thread from now on. InternAtom, QueryExtension,
+  // GetInputFocus and the version request, minor 0, of each extension are
+  // answered, the replies to everything read at once in one write.
+  void serve();
+
+  // Stops serving, returns the requests read.
+  std::vector<Request> stop();
+
+  // Major opcode of extension index in extensions.
+  static uint8_t major_opcode(size_t index) {
+    return 128 + index;
+  }
+
+  static uint8_t first_event(size_t index) {
+    return 64 + 16 * index;
+  }
+
+private:
+  void read_all(uint8_t* data, size_t size);
+  void write_all(uint8_t const* data, size_t size);
+  void run();
+  // Appends the reply to request, if it has one, to replies.
+  void answer(uint8_t const* request, std::vector<uint8_t>* replies);
+
+  std::vector<std::string> const extensions_;
+  int fd_[2] = { -1, -1 };
+  xcb::shared_conn conn_;
+  std::thread thread_;
+  std::vector<Request> requests_;
+  uint16_t sequence_ = 0;
+  size_t replies_ = 0;
+  uint32_t next_atom_ = 100;
+};
+
+#endif  // FAKE_SERVER_HH
@@ -0,0 +1,128 @@
+#include "common.hh"
+
+#include "fixture.hh"
+#include "roundtrip.hh"
+
+#include <stdlib.h>
+#include <string.h>
+#include <xcb/xfixes.h>
+
+namespace {
+
+constexpr xcb_window_t kWindow = 1;
+constexpr xcb_window_t kRoot = 2;
+constexpr uint8_t kXFixesFirstEvent = 80;
+
+template<typename T>
+xcb_generic_event_t const* as_event(T const& event) {
+  return reinterpret_cast<xcb_generic_event_t const*>(&event);
+}
+
+}  // namespace
+
+EventSource::Clock::time_point ScriptedSource::now() {
+  return now_;
+}
+
+xcb::generic_event ScriptedSource::next_event(
+    std::optional<Clock::time_point>) {
+  return nullptr;
+}
+
+xcb::reply<xcb_get_property_reply_t> ScriptedSource::get_property(
+    bool, xcb_window_t, xcb_atom_t, xcb_atom_t, uint32_t,
+    xcb_generic_error_t**) {
+  roundtrip::account(0);
+  if (next_property_ == properties_.size())
+    return nullptr;
+  auto const& property = properties_[next_property_++];
+  auto size = property.value.size();
+  // Like xcb, replies are malloc'd.
+  auto* reply = reinterpret_cast<xcb_get_property_reply_t*>(
+      calloc(1, sizeof(xcb_get_property_reply_t) + size + 4));
+  reply->response_type = XCB_GET_PROPERTY;
+  reply->format = 8;
+  reply->type = property.type;
+  reply->length = (size + 3) / 4;
+  reply->value_len = size;
+  memcpy(reply + 1, property.value.data(), size);
+  return xcb::reply<xcb_get_property_reply_t>(reply);
+}
+
+void ScriptedSource::convert_selection(xcb_window_t, xcb_atom_t,
+                                       xcb_atom_t target,
+                                       xcb_atom_t property,
+                                       xcb_timestamp_t) {
+  last_target_ = target;
+  last_property_ = property;
+  ++conversions_;
+}
+
+void ScriptedSource::change_property(uint8_t, xcb_window_t, xcb_atom_t,
+                                     xcb_atom_t, uint8_t, uint32_t,
+                                     void const*) {}
+
+void ScriptedSource::flush() {}
+
+void ScriptedSource::push(xcb_atom_t type, std::string value) {
+  properties_.push_back(Property{ type, std::move(value) });
+}
+
+Fixture::Fixture()
+  : canvas_(make_memory_canvas(256, 256)) {
+  Controller::Window window{ kWindow, kRoot, 256, 256 };
+  Controller::Atoms atoms{};
+  atoms.utf8_string = kUtf8String;
+  atoms.incr = kIncr;
+  atoms.net_wm_state = 102;
+  atoms.net_wm_state_hidden = 103;
+  atoms.qrwnd_paint = 104;
+  for (size_t i = 0; i < atoms.target_property.size(); ++i)
+    atoms.target_property[i] = 200 + i;
+  atoms.xfixes_first_event = kXFixesFirstEvent;
+  Controller::Options options{};
+  options.fps = 5;
+  options.frame_version = 12;
+  controller_ = Controller::create(&source_, window, atoms, options,
+                                   canvas_.get(), &stats_, nullptr, nullptr,
+                                   nullptr, nullptr);
+
+  xcb_map_notify_event_t map{};
+  map.response_type = XCB_MAP_NOTIFY;
+  map.event = kWindow;
+  map.window = kWindow;
+  controller_->handle(as_event(map));
+  controller_->run();
+}
+
+void Fixture::change_owner(xcb_timestamp_t time) {
+  xcb_xfixes_selection_notify_event_t notify{};
+  notify.response_type = kXFixesFirstEvent + XCB_XFIXES_SELECTION_NOTIFY;
+  notify.selection = XCB_ATOM_PRIMARY;
+  notify.timestamp = time;
+  controller_->handle(as_event(notify));
+  controller_->run();
+  time_ = time;
+}
+
+void Fixture::answer() {
+  xcb_selection_notify_event_t notify{};
+  notify.response_type = XCB_SELECTION_NOTIFY;
+  notify.time = time_;
+  notify.requestor = kWindow;
+  notify.selection = XCB_ATOM_PRIMARY;
+  notify.target = source_.last_target();
+  notify.property = source_.last_property();
+  controller_->handle(as_event(notify));
+  controller_->run();
+}
+
+void Fixture::chunk() {
+  xcb_property_notify_event_t notify{};
+  notify.response_type = XCB_PROPERTY_NOTIFY;
+  notify.window = kWindow;
+  notify.atom = source_.last_property();
+  notify.state = XCB_PROPERTY_NEW_VALUE;
+  controller_->handle(as_event(notify));
+  controller_->run();
+}
@@ -0,0 +1,100 @@
+#ifndef FIXTURE_HH
+#define FIXTURE_HH
+
+#include "controller.hh"
+#include "event_source.hh"
+#include "render.hh"
+#include "stats.hh"
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// A Controller driven through selection changes by a scripted EventSource,
+// no X server involved.
+
+constexpr xcb_atom_t kUtf8String = 100;
+constexpr xcb_atom_t kIncr = 101;
+
+// Returns queued property values in order. Counts every get_property() as
+// one round trip, like the live source would, but never waits for one.
+class ScriptedSource : public EventSource {
+public:
+  Clock::time_point now() override;
+
+  xcb::generic_event next_event(std::optional<Clock::time_point>) override;
+
+  xcb::reply<xcb_get_property_reply_t> get_property(
+      bool, xcb_window_t, xcb_atom_t, xcb_atom_t, uint32_t,
+      xcb_generic_error_t**) override;
+
+  void convert_selection(xcb_window_t, xcb_atom_t, xcb_atom_t target,
+                         xcb_atom_t property, xcb_timestamp_t) override;
+
+  void change_property(uint8_t, xcb_window_t, xcb_atom_t, xcb_atom_t,
+                       uint8_t, uint32_t, void const*) override;
+
+  void flush() override;
+
+  // Allocates, so call before the selection change it's for.
+  void push(xcb_atom_t type, std::string value);
+
+  xcb_atom_t last_target() const {
+    return last_target_;
+  }
+
+  xcb_atom_t last_property() const {
+    return last_property_;
+  }
+
+  uint64_t conversions() const {
+    return conversions_;
+  }
+
+private:
+  struct Property {
+    xcb_atom_t type;
+    std::string value;
+  };
+
+  Clock::time_point const now_ = Clock::now();
+  std::vector<Property> properties_;
+  size_t next_property_ = 0;
+  xcb_atom_t last_target_ = XCB_NONE;
+  xcb_atom_t last_property_ = XCB_NONE;
+  uint64_t conversions_ = 0;
+};
+
+class Fixture {
+public:
+  // Maps the window and requests the selection present at start.
+  Fixture();
+
+  ScriptedSource& source() {
+    return source_;
+  }
+
+  // Owner changes and the conversion request is sent.
+  void change_owner(xcb_timestamp_t time);
+
+  // Owner answers the last conversion request.
+  void answer();
+
+  // Owner writes the next INCR chunk.
+  void chunk();
+
+  uint64_t shown_hash() const {
+    return controller_->shown_hash();
+  }
+
+private:
+  ScriptedSource source_;
+  Stats stats_;
+  unique_canvas canvas_;
+  std::unique_ptr<Controller> controller_;
+  // Of the last owner change, the initial request uses XCB_CURRENT_TIME.
+  xcb_timestamp_t time_ = XCB_CURRENT_TIME;
+};
+
+#endif  // FIXTURE_HH
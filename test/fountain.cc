@@ -0,0 +1,123 @@
+#include "common.hh"
+
+#include "fountain.hh"
+#include "test.hh"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+// Encodes random payloads, feeds the decoder a random subset of frames and
+// checks that the data comes back unchanged, from slightly more than K
+// frames on average.
+
+namespace {
+
+// Frames any one payload may need. Some draws need far more than K when
+// there are only a few blocks, the average is checked separately.
+size_t allowed_frames(size_t k) {
+  return 2 * k + 16;
+}
+
+// Most frames needed per block on average, over payloads of at least
+// kMinBlocks blocks.
+constexpr double kMaxOverhead = 1.2;
+constexpr size_t kMinBlocks = 20;
+
+struct Result {
+  size_t blocks;
+  size_t frames;
+};
+
+std::string random_data(std::mt19937& rng, size_t size) {
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::string data(size, '\0');
+  for (auto& c : data)
+    c = static_cast<char>(byte(rng));
+  return data;
+}
+
+Result test_round_trip(std::mt19937& rng, size_t size, size_t frame_size) {
+  auto data = random_data(rng, size);
+  auto encoder = FountainEncoder::create(data, frame_size);
+  EXPECT(encoder);
+  if (!encoder)
+    return { 0, 0 };
+  auto const k = encoder->blocks();
+  auto const block_size = encoder->block_size();
+  EXPECT(k == std::max<size_t>(1, (size + block_size - 1) / block_size));
+
+  // A random subset of the first frames, source and coded ones mixed, as
+  // when a reader joins late and misses some.
+  std::vector<uint32_t> seqs(4 * k + 16);
+  std::iota(seqs.begin(), seqs.end(), 0);
+  std::shuffle(seqs.begin(), seqs.end(), rng);
+
+  auto decoder = FountainDecoder::create();
+  std::vector<uint8_t> frame(encoder->frame_size());
+  size_t used = 0;
+  for (auto seq : seqs) {
+    if (decoder->done() || used == allowed_frames(k))
+      break;
+    encoder->frame(seq, frame.data());
+    EXPECT(decoder->add(frame.data(), frame.size()));
+    ++used;
+  }
+  EXPECT(decoder->done());
+  if (decoder->done()) {
+    EXPECT(decoder->data() == data);
+  } else {
+    std::cerr << "Not decoded from " << used << " frames, " << size
+              << " bytes in " << k << " blocks" << std::endl;
+  }
+  return { k, used };
+}
+
+void test_rejects_other_data(std::mt19937& rng) {
+  auto encoder = FountainEncoder::create(random_data(rng, 1000), 115);
+  auto other = FountainEncoder::create(random_data(rng, 900), 115);
+  auto decoder = FountainDecoder::create();
+  std::vector<uint8_t> frame(encoder->frame_size());
+  encoder->frame(0, frame.data());
+  EXPECT(decoder->add(frame.data(), frame.size()));
+  other->frame(1, frame.data());
+  EXPECT(!decoder->add(frame.data(), frame.size()));
+  frame[0] = 0;
+  EXPECT(!decoder->add(frame.data(), frame.size()));
+}
+
+}  // namespace
+
+int main() {
+  std::mt19937 rng(1);
+  size_t const block_size = 100;
+  size_t const frame_size = block_size + kFountainHeaderSize;
+  // K = 1, smaller than one block and exactly one block.
+  EXPECT(test_round_trip(rng, 1, frame_size).blocks == 1);
+  EXPECT(test_round_trip(rng, block_size, frame_size).blocks == 1);
+  // The last block full, and not.
+  EXPECT(test_round_trip(rng, block_size * 10, frame_size).blocks == 10);
+  EXPECT(test_round_trip(rng, block_size * 10 + 37, frame_size).blocks == 11);
+
+  size_t blocks = 0;
+  size_t frames = 0;
+  for (int i = 0; i < 100; ++i) {
+    std::uniform_int_distribution<size_t> size(1, 50000);
+    std::uniform_int_distribution<size_t> frame_size(
+        kFountainHeaderSize + 50, 400);
+    auto result = test_round_trip(rng, size(rng), frame_size(rng));
+    if (result.blocks >= kMinBlocks) {
+      blocks += result.blocks;
+      frames += result.frames;
+    }
+  }
+  EXPECT(blocks > 0);
+  EXPECT(frames <= blocks * kMaxOverhead);
+  std::cerr << "Decoded from " << static_cast<double>(frames) / blocks
+            << " frames per block on average" << std::endl;
+
+  test_rejects_other_data(rng);
+  return test_result();
+}
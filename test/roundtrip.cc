@@ -0,0 +1,106 @@
+#include "common.hh"
+
+#include "fake_server.hh"
+#include "roundtrip.hh"
+#include "test.hh"
+
+#include <chrono>
+#include <stdint.h>
+#include <thread>
+#include <xcb/xcb.h>
+
+// Checks what roundtrip counts: account() and Scope nesting, and
+// wait_reply() against libxcb talking to a fake server over a socketpair.
+
+namespace {
+
+using roundtrip::Op;
+
+// Long enough that the client is sure to block waiting for a reply.
+constexpr auto kServerDelay = std::chrono::milliseconds(20);
+
+void test_scope_nesting() {
+  roundtrip::reset();
+  roundtrip::account(5);
+  {
+    roundtrip::Scope change(Op::SELECTION_CHANGE);
+    roundtrip::account(7);
+    {
+      roundtrip::Scope chunk(Op::INCR_CHUNK);
+      roundtrip::account(1);
+    }
+    // Back to the outer scope, not to OTHER.
+    roundtrip::account(2);
+  }
+  roundtrip::account(3);
+
+  auto other = roundtrip::get(Op::OTHER);
+  EXPECT(other.count == 2);
+  EXPECT(other.blocked_ns == 8);
+  auto change = roundtrip::get(Op::SELECTION_CHANGE);
+  EXPECT(change.count == 2);
+  EXPECT(change.blocked_ns == 9);
+  auto chunk = roundtrip::get(Op::INCR_CHUNK);
+  EXPECT(chunk.count == 1);
+  EXPECT(chunk.blocked_ns == 1);
+  EXPECT(roundtrip::get(Op::STARTUP).count == 0);
+
+  roundtrip::reset();
+  EXPECT(roundtrip::get(Op::OTHER).count == 0);
+  EXPECT(roundtrip::get(Op::SELECTION_CHANGE).blocked_ns == 0);
+}
+
+// A reply that has arrived before it's waited for costs no round trip.
+void test_wait_reply_ready() {
+  FakeServer server;
+  EXPECT(server.ok());
+  if (!server.ok())
+    return;
+  roundtrip::reset();
+  auto cookie = xcb_get_input_focus(server.conn().get());
+  xcb_flush(server.conn().get());
+  server.reply({ static_cast<uint16_t>(cookie.sequence) });
+  auto reply = roundtrip::wait_reply<xcb_get_input_focus_reply_t>(
+      server.conn().get(), cookie, nullptr);
+  EXPECT(reply);
+  EXPECT(roundtrip::get(Op::OTHER).count == 0);
+}
+
+// Of two pipelined requests, only waiting for the first blocks. The second
+// reply is read along with it and isn't counted.
+void test_wait_reply_pipelined() {
+  FakeServer server;
+  EXPECT(server.ok());
+  if (!server.ok())
+    return;
+  roundtrip::reset();
+  roundtrip::Scope scope(Op::STARTUP);
+  auto first = xcb_get_input_focus(server.conn().get());
+  auto second = xcb_get_input_focus(server.conn().get());
+  xcb_flush(server.conn().get());
+  std::thread answer([&]() {
+    std::this_thread::sleep_for(kServerDelay);
+    server.reply({ static_cast<uint16_t>(first.sequence),
+                   static_cast<uint16_t>(second.sequence) });
+  });
+  auto first_reply = roundtrip::wait_reply<xcb_get_input_focus_reply_t>(
+      server.conn().get(), first, nullptr);
+  answer.join();
+  auto second_reply = roundtrip::wait_reply<xcb_get_input_focus_reply_t>(
+      server.conn().get(), second, nullptr);
+  EXPECT(first_reply);
+  EXPECT(second_reply);
+  auto startup = roundtrip::get(Op::STARTUP);
+  EXPECT(startup.count == 1);
+  EXPECT(startup.blocked_ns > 0);
+  EXPECT(roundtrip::get(Op::OTHER).count == 0);
+}
+
+}  // namespace
+
+int main() {
+  test_scope_nesting();
+  test_wait_reply_ready();
+  test_wait_reply_pipelined();
+  return test_result();
+}
@@ -0,0 +1,111 @@
+#include "common.hh"
+
+#include "fake_server.hh"
+#include "fixture.hh"
+#include "roundtrip.hh"
+#include "startup.hh"
+#include "test.hh"
+#include "xcb_connection.hh"
+
+#include <iostream>
+#include <string>
+
+// Drives Controller through selection changes with a scripted EventSource
+// and checks the number of blocking round trips each one costs. The budget
+// is measured on ScriptedSource, which counts every get_property() as a
+// round trip. The live source only counts those that block, see
+// wait_reply(), tested in roundtrip.cc. Startup runs against a fake
+// server, where only round trips that block are counted.
+
+namespace {
+
+// Blocking round trips allowed per operation.
+constexpr uint64_t kSelectionChangeBudget = 1;
+constexpr uint64_t kIncrChunkBudget = 1;
+constexpr uint64_t kOtherBudget = 0;
+// Up to the extensions, before Controller takes over. Only the atoms
+// WM_PROTOCOLS needs are waited for, the other replies arrive with them.
+// The keyboard is set up after the first paint and isn't included.
+constexpr uint64_t kStartupBudget = 1;
+
+void expect_within_budget(uint64_t selection_changes, uint64_t incr_chunks) {
+  auto selection = roundtrip::get(roundtrip::Op::SELECTION_CHANGE).count;
+  auto incr = roundtrip::get(roundtrip::Op::INCR_CHUNK).count;
+  auto other = roundtrip::get(roundtrip::Op::OTHER).count;
+  EXPECT(selection <= selection_changes * kSelectionChangeBudget);
+  EXPECT(incr <= incr_chunks * kIncrChunkBudget);
+  EXPECT(other <= kOtherBudget);
+  if (g_failures) {
+    std::cerr << "Round trips for " << selection_changes
+              << " selection changes and " << incr_chunks << " chunks:\n";
+    roundtrip::print(std::cerr);
+  }
+}
+
+void test_plain() {
+  Fixture fixture;
+  fixture.source().push(kUtf8String, "https://example.org/");
+  fixture.answer();
+  EXPECT(fixture.shown_hash() != 0);
+  for (int i = 0; i < 10; ++i) {
+    fixture.change_owner(1000 + i);
+    fixture.source().push(kUtf8String,
+                          "https://example.org/" + std::to_string(i));
+    fixture.answer();
+  }
+  EXPECT(fixture.source().conversions() == 11);
+  expect_within_budget(11, 0);
+}
+
+void test_incr() {
+  Fixture fixture;
+  uint32_t const size = 2 * 1000;
+  fixture.source().push(kIncr, std::string(
+      reinterpret_cast<char const*>(&size), sizeof(size)));
+  fixture.answer();
+  std::string url = "https://example.org/" + std::string(size - 20, 'a');
+  uint64_t chunks = 0;
+  for (size_t offset = 0; offset < url.size(); offset += 1000) {
+    fixture.source().push(kUtf8String, url.substr(offset, 1000));
+    fixture.chunk();
+    ++chunks;
+  }
+  // Zero length chunk ends the transfer.
+  fixture.source().push(kUtf8String, "");
+  fixture.chunk();
+  ++chunks;
+  EXPECT(fixture.shown_hash() != 0);
+  expect_within_budget(1, chunks);
+}
+
+void test_startup() {
+  FakeServer server({ "XFIXES" });
+  EXPECT(server.ok());
+  if (!server.ok())
+    return;
+  server.serve();
+  roundtrip::Scope scope(roundtrip::Op::STARTUP);
+  auto* screen = xcb::get_screen(server.conn().get(), 0);
+  auto startup = Startup::create(server.conn(), screen, false);
+  EXPECT(startup->map_window(std::cerr));
+  EXPECT(startup->sync_atoms(std::cerr));
+  EXPECT(startup->select_input(std::cerr));
+  EXPECT(server.ok());
+  auto startup_count = roundtrip::get(roundtrip::Op::STARTUP).count;
+  EXPECT(startup_count <= kStartupBudget);
+  EXPECT(roundtrip::get(roundtrip::Op::OTHER).count == 0);
+  if (startup_count > kStartupBudget)
+    roundtrip::print(std::cerr);
+}
+
+}  // namespace
+
+int main() {
+  roundtrip::reset();
+  test_plain();
+  roundtrip::reset();
+  test_incr();
+  roundtrip::reset();
+  test_startup();
+  return test_result();
+}
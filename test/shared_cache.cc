@@ -0,0 +1,339 @@
+#include "common.hh"
+
+#include "shared_cache.hh"
+#include "test.hh"
+
+#include <atomic>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// Stores and finds codes through two instances sharing a file, and pokes
+// at the file like a broken or dead writer would.
+
+namespace {
+
+// Matches the start of Slot in shared_cache.cc, up to the payload.
+struct SlotStart {
+  std::atomic<uint32_t> seq;
+  std::atomic<uint32_t> writer_pid;
+  std::atomic<uint64_t> claimed_ns;
+  std::atomic<uint64_t> used_ns;
+  uint64_t hash;
+  uint64_t checksum;
+  uint32_t payload_size;
+  uint16_t version;
+  uint16_t width;
+};
+
+// Matches kMaxPayload in shared_cache.cc, the bits follow the payload.
+constexpr size_t kMaxPayload = 2953;
+constexpr int kWidth = 25;
+
+uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// The whole file mapped, to find and change slots in.
+class Mapping {
+public:
+  explicit Mapping(std::string const& path) {
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+      size_ = st.st_size;
+      auto* ptr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+      if (ptr != MAP_FAILED)
+        data_ = reinterpret_cast<uint8_t*>(ptr);
+    }
+    if (fd >= 0)
+      close(fd);
+  }
+
+  ~Mapping() {
+    if (data_)
+      munmap(data_, size_);
+  }
+
+  // Start of the slot holding payload, which must be unique in the file.
+  SlotStart* slot(std::string const& payload) const {
+    if (!data_)
+      return nullptr;
+    auto* found = static_cast<uint8_t*>(
+        memmem(data_, size_, payload.data(), payload.size()));
+    if (!found)
+      return nullptr;
+    return reinterpret_cast<SlotStart*>(found - sizeof(SlotStart));
+  }
+
+  // First byte of the modules in the slot holding payload.
+  uint8_t* bits(std::string const& payload) const {
+    auto* start = slot(payload);
+    return start ? reinterpret_cast<uint8_t*>(start + 1) + kMaxPayload
+      : nullptr;
+  }
+
+private:
+  uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+class Test {
+public:
+  Test() {
+    char dir[] = "/tmp/qrwnd-shared-cache-XXXXXX";
+    if (mkdtemp(dir))
+      dir_ = dir;
+    path_ = dir_ + "/cache";
+    modules_.resize(kWidth * kWidth);
+    for (size_t i = 0; i < modules_.size(); ++i)
+      modules_[i] = (i * 7 / 3) & 1;
+  }
+
+  ~Test() {
+    unlink(path_.c_str());
+    rmdir(dir_.c_str());
+  }
+
+  std::string const& path() const {
+    return path_;
+  }
+
+  // True if cache finds payload with the stored code.
+  bool found(SharedCache& cache, uint64_t hash, std::string const& payload) {
+    int version = 0;
+    int width = 0;
+    std::vector<uint8_t> modules(SharedCache::kMaxModules, 0xff);
+    if (!cache.find(hash, payload, &version, &width, modules.data()))
+      return false;
+    modules.resize(width * width);
+    return version == 2 && width == kWidth && modules == modules_;
+  }
+
+  void store(SharedCache& cache, uint64_t hash, std::string const& payload) {
+    cache.store(hash, payload, 2, kWidth, modules_.data());
+  }
+
+private:
+  std::string dir_;
+  std::string path_;
+  std::vector<uint8_t> modules_;
+};
+
+void test_find_store() {
+  Test test;
+  auto writer = SharedCache::open(test.path());
+  auto reader = SharedCache::open(test.path());
+  EXPECT(writer && reader);
+  if (!writer || !reader)
+    return;
+  std::string const payload = "https://example.org/find-store";
+  EXPECT(!test.found(*reader, 1, payload));
+  test.store(*writer, 1, payload);
+  EXPECT(test.found(*reader, 1, payload));
+  EXPECT(test.found(*writer, 1, payload));
+  // Same hash but another payload isn't a hit.
+  EXPECT(!test.found(*reader, 1, payload + "/other"));
+  EXPECT(reader->total_hits() == 2);
+  EXPECT(reader->total_misses() == 2);
+
+  // A finished store leaves no writer behind.
+  Mapping mapping(test.path());
+  auto* slot = mapping.slot(payload);
+  EXPECT(slot);
+  if (slot) {
+    EXPECT((slot->seq.load() & 1) == 0);
+    EXPECT(slot->writer_pid.load() == 0);
+  }
+}
+
+void test_checksum_mismatch() {
+  Test test;
+  auto cache = SharedCache::open(test.path());
+  EXPECT(cache);
+  if (!cache)
+    return;
+  std::string const payload = "https://example.org/checksum";
+  test.store(*cache, 2, payload);
+  EXPECT(test.found(*cache, 2, payload));
+  Mapping mapping(test.path());
+  auto* bits = mapping.bits(payload);
+  EXPECT(bits);
+  if (!bits)
+    return;
+  // Like a stuck writer waking up and writing over the entry.
+  bits[0] ^= 1;
+  EXPECT(!test.found(*cache, 2, payload));
+  bits[0] ^= 1;
+  EXPECT(test.found(*cache, 2, payload));
+}
+
+void test_claims() {
+  Test test;
+  auto cache = SharedCache::open(test.path());
+  EXPECT(cache);
+  if (!cache)
+    return;
+  std::string const payload = "https://example.org/claims";
+  test.store(*cache, 3, payload);
+  Mapping mapping(test.path());
+  auto* slot = mapping.slot(payload);
+  EXPECT(slot);
+  if (!slot)
+    return;
+
+  // Just claimed, the writer hasn't stored its pid yet. Busy, even with
+  // an old claimed_ns left from an earlier writer.
+  slot->seq.fetch_add(1);
+  slot->claimed_ns.store(1);
+  EXPECT(!test.found(*cache, 3, payload));
+  test.store(*cache, 3, payload);
+  EXPECT((slot->seq.load() & 1) == 1);
+  EXPECT(!test.found(*cache, 3, payload));
+
+  // Claimed by a live writer just now.
+  slot->claimed_ns.store(monotonic_ns());
+  slot->writer_pid.store(getpid());
+  test.store(*cache, 3, payload);
+  EXPECT(!test.found(*cache, 3, payload));
+
+  // Claimed by a writer that has died since.
+  pid_t child = fork();
+  if (child == 0)
+    _exit(0);
+  waitpid(child, nullptr, 0);
+  slot->writer_pid.store(child);
+  test.store(*cache, 3, payload);
+  EXPECT(test.found(*cache, 3, payload));
+  EXPECT(slot->writer_pid.load() == 0);
+
+  // Claimed by a live writer long ago, so stuck.
+  slot->seq.fetch_add(1);
+  slot->claimed_ns.store(monotonic_ns() - 2000000000ull);
+  slot->writer_pid.store(getppid());
+  test.store(*cache, 3, payload);
+  EXPECT(test.found(*cache, 3, payload));
+}
+
+// Two contenders judging the same claim stale at once must not both take
+// the entry over. Plays the one that wins, step by step, and has the cache
+// try after each step.
+void test_takeover() {
+  Test test;
+  auto cache = SharedCache::open(test.path());
+  EXPECT(cache);
+  if (!cache)
+    return;
+  std::string const payload = "https://example.org/takeover";
+  test.store(*cache, 4, payload);
+  Mapping mapping(test.path());
+  auto* slot = mapping.slot(payload);
+  EXPECT(slot);
+  if (!slot)
+    return;
+
+  // Stuck.
+  auto const stuck = slot->seq.fetch_add(1) + 1;
+  slot->claimed_ns.store(monotonic_ns() - 2000000000ull);
+  slot->writer_pid.store(getppid());
+
+  // Won the stale pid, the claim looks just made.
+  uint32_t writer = getppid();
+  EXPECT(slot->writer_pid.compare_exchange_strong(writer, 0));
+  test.store(*cache, 4, payload);
+  EXPECT(slot->seq.load() == stuck);
+  EXPECT(slot->writer_pid.load() == 0);
+  EXPECT(!test.found(*cache, 4, payload));
+
+  // Moved seq on, with the old claimed_ns still there.
+  slot->seq.fetch_add(2);
+  test.store(*cache, 4, payload);
+  EXPECT(slot->seq.load() == stuck + 2);
+  EXPECT(slot->writer_pid.load() == 0);
+
+  slot->claimed_ns.store(monotonic_ns());
+  slot->writer_pid.store(getpid());
+  test.store(*cache, 4, payload);
+  EXPECT(slot->seq.load() == stuck + 2);
+  EXPECT(!test.found(*cache, 4, payload));
+
+  // Released.
+  slot->writer_pid.store(0);
+  slot->seq.fetch_add(1);
+  test.store(*cache, 4, payload);
+  EXPECT(test.found(*cache, 4, payload));
+}
+
+// Several processes racing to take a stuck entry over leave it free, with
+// a complete code.
+void test_takeover_race() {
+  constexpr int kContenders = 8;
+  Test test;
+  std::string const payload = "https://example.org/takeover-race";
+  {
+    auto cache = SharedCache::open(test.path());
+    EXPECT(cache);
+    if (!cache)
+      return;
+    test.store(*cache, 5, payload);
+  }
+  Mapping mapping(test.path());
+  auto* slot = mapping.slot(payload);
+  EXPECT(slot);
+  if (!slot)
+    return;
+  slot->seq.fetch_add(1);
+  slot->claimed_ns.store(monotonic_ns() - 2000000000ull);
+  slot->writer_pid.store(getppid());
+
+  int go[2];
+  if (pipe(go) != 0)
+    return;
+  std::vector<pid_t> children;
+  for (int i = 0; i < kContenders; ++i) {
+    pid_t child = fork();
+    if (child == 0) {
+      close(go[1]);
+      // Opened in the child, the cache keeps the pid it was opened by.
+      auto cache = SharedCache::open(test.path());
+      char c;
+      if (cache && read(go[0], &c, 1) == 0)
+        test.store(*cache, 5, payload);
+      _exit(0);
+    }
+    if (child > 0)
+      children.push_back(child);
+  }
+  close(go[0]);
+  // Wakes all of them at once.
+  close(go[1]);
+  for (auto child : children)
+    waitpid(child, nullptr, 0);
+
+  EXPECT((slot->seq.load() & 1) == 0);
+  EXPECT(slot->writer_pid.load() == 0);
+  auto cache = SharedCache::open(test.path());
+  EXPECT(cache && test.found(*cache, 5, payload));
+}
+
+}  // namespace
+
+int main() {
+  test_find_store();
+  test_checksum_mismatch();
+  test_claims();
+  test_takeover();
+  test_takeover_race();
+  return test_result();
+}
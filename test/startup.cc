@@ -0,0 +1,130 @@
+#include "common.hh"
+
+#include "fake_server.hh"
+#include "startup.hh"
+#include "test.hh"
+#include "xcb_event.hh"
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <xcb/xcb.h>
+
+// Runs Startup against a fake server, with and without XFixes, and checks
+// the requests it got.
+
+namespace {
+
+struct Result {
+  bool ok;
+  std::string err;
+  Controller::Atoms atoms;
+  std::vector<FakeServer::Request> requests;
+};
+
+Result run(FakeServer& server, bool popup) {
+  Result result{};
+  EXPECT(server.ok());
+  if (!server.ok())
+    return result;
+  server.serve();
+  std::ostringstream err;
+  auto* screen = xcb::get_screen(server.conn().get(), 0);
+  auto startup = Startup::create(server.conn(), screen, popup);
+  result.ok = startup->map_window(err) && startup->sync_atoms(err) &&
+    startup->select_input(err);
+  if (result.ok)
+    result.atoms = startup->atoms();
+  result.err = err.str();
+  // Let the server read everything sent.
+  xcb::reply<xcb_get_input_focus_reply_t>(xcb_get_input_focus_reply(
+      server.conn().get(), xcb_get_input_focus(server.conn().get()),
+      nullptr));
+  result.requests = server.stop();
+  return result;
+}
+
+size_t count(std::vector<FakeServer::Request> const& requests,
+             uint8_t major) {
+  size_t ret = 0;
+  for (auto const& request : requests)
+    ret += request.major == major;
+  return ret;
+}
+
+bool queried(std::vector<FakeServer::Request> const& requests,
+             std::string const& extension) {
+  for (auto const& request : requests) {
+    if (request.extension == extension)
+      return true;
+  }
+  return false;
+}
+
+// Popup mode doesn't need XFixes, so must start without it. Any XFixes
+// request would have libxcb close the connection.
+void test_popup_without_xfixes() {
+  FakeServer server;
+  auto result = run(server, true);
+  EXPECT(result.ok);
+  EXPECT(result.err.empty());
+  EXPECT(server.ok());
+  EXPECT(result.atoms.xfixes_first_event == Controller::kNoXFixes);
+  EXPECT(!queried(result.requests, "XFIXES"));
+  EXPECT(count(result.requests, XCB_CREATE_WINDOW) == 1);
+  // Only mapped when the key is pressed.
+  EXPECT(count(result.requests, XCB_MAP_WINDOW) == 0);
+}
+
+void test_without_xfixes() {
+  FakeServer server;
+  auto result = run(server, false);
+  EXPECT(!result.ok);
+  EXPECT(result.err == "No XFixes extension, needed to monitor selection.\n");
+  EXPECT(server.ok());
+}
+
+void test_xfixes() {
+  FakeServer server({ "XFIXES" });
+  auto result = run(server, false);
+  EXPECT(result.ok);
+  EXPECT(server.ok());
+  EXPECT(result.atoms.xfixes_first_event == FakeServer::first_event(0));
+  EXPECT(count(result.requests, XCB_MAP_WINDOW) == 1);
+  // QueryVersion, then SelectSelectionInput.
+  std::vector<uint8_t> minor;
+  for (auto const& request : result.requests) {
+    if (request.major == FakeServer::major_opcode(0))
+      minor.push_back(request.minor);
+  }
+  EXPECT(minor == std::vector<uint8_t>({ 0, 2 }));
+}
+
+// Nothing blocks before the window is created. libxcb blocks any
+// extension request on the reply to QueryExtension, so those are only sent
+// after the atoms, and the query before them so its reply is in by then.
+void test_window_first() {
+  FakeServer server({ "XFIXES" });
+  auto result = run(server, false);
+  EXPECT(result.ok);
+  EXPECT(!result.requests.empty());
+  if (result.requests.empty())
+    return;
+  EXPECT(result.requests.front().extension == "XFIXES");
+  for (auto const& request : result.requests) {
+    if (request.major == XCB_CREATE_WINDOW)
+      EXPECT(request.replies_before == 0);
+    if (request.major == FakeServer::major_opcode(0))
+      EXPECT(request.replies_before > 0);
+  }
+}
+
+}  // namespace
+
+int main() {
+  test_popup_without_xfixes();
+  test_without_xfixes();
+  test_xfixes();
+  test_window_first();
+  return test_result();
+}
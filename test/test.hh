@@ -0,0 +1,29 @@
+#ifndef TEST_HH
+#define TEST_HH
+
+#include <iostream>
+#include <stdlib.h>
+
+// Minimal test helpers. A failed EXPECT() is reported and counted, the test
+// keeps going, main() returns test_result().
+
+inline int g_failures = 0;
+
+#define EXPECT(cond)                                                    \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      std::cerr << __FILE__ << ':' << __LINE__ << ": Expected " #cond   \
+                << std::endl;                                           \
+      ++g_failures;                                                     \
+    }                                                                   \
+  } while (false)
+
+inline int test_result() {
+  if (g_failures) {
+    std::cerr << g_failures << " failed expectations" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+#endif  // TEST_HH
@@ -0,0 +1,108 @@
+#include "common.hh"
+
+#include "test.hh"
+#include "url_extract.hh"
+
+#include <iostream>
+#include <stddef.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// Matches kMaxScheme in url_extract.cc.
+constexpr size_t kMaxScheme = 32;
+
+struct Case {
+  char const* name;
+  std::string text;
+  size_t max;
+  std::vector<std::string> expected;
+};
+
+void check(std::string const& name, std::string const& text, size_t max,
+           std::vector<std::string> const& expected) {
+  std::vector<std::string_view> urls;
+  extract_urls(text, max, &urls);
+  bool const match = std::vector<std::string>(urls.begin(), urls.end()) ==
+    expected;
+  EXPECT(match);
+  if (!match) {
+    std::cerr << name << ": got";
+    for (auto const& url : urls)
+      std::cerr << " \"" << url << '"';
+    std::cerr << std::endl;
+  }
+}
+
+void test_table() {
+  Case const cases[] = {
+    { "empty", "", 10, {} },
+    { "no url", "nothing to see here", 10, {} },
+    { "scheme at start", "http://example.org", 10,
+      { "http://example.org" } },
+    { "separator at start", "://example.org", 10, {} },
+    { "no scheme", "see ://example.org", 10, {} },
+    { "nothing after", "http:// and", 10, {} },
+    { "digits before scheme", "1http://a.org", 10, { "http://a.org" } },
+    { "scheme chars", "git+ssh://host/repo", 10,
+      { "git+ssh://host/repo" } },
+    { "trailing dot", "Go to https://example.org/path.", 10,
+      { "https://example.org/path" } },
+    { "trailing punctuation", "https://x.org/?a=1!?;:,.", 10,
+      { "https://x.org/?a=1" } },
+    { "inner punctuation", "https://x.org/a.b,c", 10,
+      { "https://x.org/a.b,c" } },
+    { "balanced parens", "https://en.wikipedia.org/wiki/Foo_(bar)", 10,
+      { "https://en.wikipedia.org/wiki/Foo_(bar)" } },
+    { "unbalanced paren", "(see https://x.org/a)", 10,
+      { "https://x.org/a" } },
+    { "unbalanced paren, trailing dot", "(https://x.org/a).", 10,
+      { "https://x.org/a" } },
+    { "nested parens", "(https://x.org/a_(b))", 10,
+      { "https://x.org/a_(b)" } },
+    { "quotes", "\"https://x.org/a\" and 'ftp://y.org'", 10,
+      { "https://x.org/a", "ftp://y.org" } },
+    { "angle brackets", "<https://x.org/a>", 10, { "https://x.org/a" } },
+    { "control character", "https://x.org/a\tb", 10,
+      { "https://x.org/a" } },
+    // Only the last kMaxScheme characters are taken as the scheme.
+    { "long scheme", std::string(kMaxScheme + 8, 'x') + "://a.org", 10,
+      { std::string(kMaxScheme, 'x') + "://a.org" } },
+    { "longest scheme", std::string(kMaxScheme, 'x') + "://a.org", 10,
+      { std::string(kMaxScheme, 'x') + "://a.org" } },
+    { "duplicates", "http://a http://b http://a http://b http://c", 10,
+      { "http://a", "http://b", "http://c" } },
+    { "max", "http://a http://b http://c", 2, { "http://a", "http://b" } },
+    { "max counts distinct", "http://a http://a http://b http://c", 2,
+      { "http://a", "http://b" } },
+    { "max zero", "http://a", 0, {} },
+  };
+  for (auto const& c : cases)
+    check(c.name, c.text, c.max, c.expected);
+}
+
+// Moves the URL across every offset of the 16 byte SSE2 steps, including
+// "://" within the last 18 bytes, which are searched with memchr().
+void test_offsets() {
+  for (size_t pad = 0; pad < 48; ++pad) {
+    for (size_t tail = 0; tail < 20; ++tail) {
+      auto text = std::string(pad, ' ') + "x://ab" + std::string(tail, ' ');
+      check("offset " + std::to_string(pad) + ", tail " +
+            std::to_string(tail), text, 10, { "x://ab" });
+    }
+  }
+  // A colon without slashes in the last bytes doesn't end the search early.
+  check("colon at end", std::string(40, ' ') + "a:b x://ab :", 10,
+        { "x://ab" });
+  check("separator at end", std::string(40, ' ') + "x://", 10, {});
+}
+
+}  // namespace
+
+int main() {
+  test_table();
+  test_offsets();
+  return test_result();
+}
@@ -0,0 +1,200 @@
+#include "common.hh"
+
+#include "qr_capacity.hh"
+#include "test.hh"
+#include "url_rewrite.hh"
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+// Host is uppercase to check that it's lowercased when loaded.
+constexpr char const kRules[] =
+  "# Comment\n"
+  "strip utm_*\n"
+  "strip fbclid  # Trailing comment\n"
+  "strip ref Example.COM\n";
+
+struct Case {
+  char const* name;
+  std::string url;
+  std::string expected;
+};
+
+// Writes kRules to a temporary file and loads it.
+std::unique_ptr<UrlRewriter> create_rewriter() {
+  char path[] = "/tmp/qrwnd-rewrite-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return nullptr;
+  close(fd);
+  std::ofstream(path) << kRules;
+  auto rewriter = UrlRewriter::create();
+  bool const loaded = rewriter->load(path, std::cerr);
+  unlink(path);
+  EXPECT(loaded);
+  if (!loaded)
+    return nullptr;
+  return rewriter;
+}
+
+void check(UrlRewriter& rewriter, std::string const& name,
+           std::string const& url, std::string const& expected) {
+  auto result = url;
+  bool const changed = rewriter.rewrite(result);
+  bool const match = result == expected && changed == (url != expected);
+  EXPECT(match);
+  if (!match) {
+    std::cerr << name << ": got \"" << result << '"'
+              << (changed ? ", changed" : ", unchanged") << std::endl;
+  }
+}
+
+void test_table() {
+  auto rewriter = create_rewriter();
+  if (!rewriter)
+    return;
+  Case const cases[] = {
+    { "not a url", "example.org/?utm_source=x",
+      "example.org/?utm_source=x" },
+    { "bad scheme", "ht_tp://Example.org/", "ht_tp://Example.org/" },
+    { "unchanged", "https://example.org/a?id=1#top",
+      "https://example.org/a?id=1#top" },
+
+    // Scheme and host are lowercased, the rest is kept.
+    { "lowercase", "HTTPS://Example.ORG/Path?Q=A#F",
+      "https://example.org/Path?Q=A#F" },
+    { "lowercase, no path", "HTTP://EXAMPLE.ORG", "http://example.org" },
+
+    { "http default port", "http://example.org:80/a",
+      "http://example.org/a" },
+    { "https default port", "https://example.org:443/",
+      "https://example.org/" },
+    { "ftp default port", "ftp://Files.example.org:21/x",
+      "ftp://files.example.org/x" },
+    { "wss default port", "wss://example.org:443", "wss://example.org" },
+    { "empty port", "http://example.org:/a", "http://example.org/a" },
+    { "other port", "https://example.org:8443/",
+      "https://example.org:8443/" },
+    { "port of other scheme", "http://example.org:443/",
+      "http://example.org:443/" },
+    { "unknown scheme keeps port", "gopher://example.org:70/",
+      "gopher://example.org:70/" },
+
+    { "ipv6", "http://[2001:DB8::1]/", "http://[2001:db8::1]/" },
+    { "ipv6 default port", "http://[::1]:80/a", "http://[::1]/a" },
+    { "ipv6 other port", "http://[::1]:8080/a", "http://[::1]:8080/a" },
+
+    // Userinfo is kept as is, its colon isn't a port.
+    { "userinfo", "https://User:PW@Example.org/",
+      "https://User:PW@example.org/" },
+    { "userinfo and port", "http://u:p@Host:80/", "http://u:p@host/" },
+    { "userinfo without host port", "http://u:80@host/",
+      "http://u:80@host/" },
+
+    { "prefix rule", "https://a.org/?utm_source=x&utm_medium=y&id=1",
+      "https://a.org/?id=1" },
+    { "order kept", "https://a.org/?id=1&fbclid=abc&b=2",
+      "https://a.org/?id=1&b=2" },
+    { "no value", "https://a.org/?fbclid&a", "https://a.org/?a" },
+    { "names are case sensitive", "https://a.org/?FBCLID=1",
+      "https://a.org/?FBCLID=1" },
+    { "prefix needs prefix", "https://a.org/?xutm_a=1",
+      "https://a.org/?xutm_a=1" },
+    { "host rule", "https://example.com/?ref=x&a=1",
+      "https://example.com/?a=1" },
+    { "host rule, subdomain", "https://www.Example.com/?ref=x",
+      "https://www.example.com/" },
+    { "host rule, other host", "https://notexample.com/?ref=x",
+      "https://notexample.com/?ref=x" },
+    { "host rule, userinfo", "https://ref@example.org/?ref=x",
+      "https://ref@example.org/?ref=x" },
+
+    // Nothing left of the query, or fragment, drops its separator.
+    { "empty query", "https://a.org/p?utm_source=x", "https://a.org/p" },
+    { "question mark only", "https://a.org/p?", "https://a.org/p" },
+    { "empty parameters", "https://a.org/?&a=1&&b=2&",
+      "https://a.org/?a=1&b=2" },
+    { "empty query, fragment", "https://a.org/p?fbclid=1#top",
+      "https://a.org/p#top" },
+    { "empty query and fragment", "https://a.org/p?fbclid=1#",
+      "https://a.org/p" },
+    { "hash only", "https://a.org/p#", "https://a.org/p" },
+    { "query in fragment", "https://a.org/#x?utm_source=1",
+      "https://a.org/#x?utm_source=1" },
+  };
+  for (auto const& c : cases)
+    check(*rewriter, c.name, c.url, c.expected);
+}
+
+void test_load_errors() {
+  char path[] = "/tmp/qrwnd-rewrite-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return;
+  close(fd);
+  auto rewriter = UrlRewriter::create();
+  for (auto const* rules : { "keep utm_source\n", "strip\n",
+                             "strip a host extra\n" }) {
+    std::ofstream(path) << rules;
+    std::ostringstream err;
+    EXPECT(!rewriter->load(path, err));
+    EXPECT(!err.str().empty());
+  }
+  unlink(path);
+  std::ostringstream err;
+  EXPECT(!rewriter->load(path, err));
+}
+
+// A URL that only fits once rewritten isn't counted as versions saved.
+void test_stats() {
+  auto rewriter = create_rewriter();
+  if (!rewriter)
+    return;
+  std::string const base = "https://a.org/?id=1";
+  std::string const tracking = "&utm_source=" + std::string(100, 'x');
+
+  auto url = base + tracking;
+  EXPECT(rewriter->rewrite(url));
+  auto const saved = qr_min_version_8bit(base.size() + tracking.size()) -
+    qr_min_version_8bit(base.size());
+  EXPECT(saved > 0);
+
+  // Too long for any code until the tracking is gone.
+  auto const capacity = qr_capacity_8bit(kQRMaxVersion);
+  auto path = std::string(capacity - base.size() - 1, 'p');
+  url = "https://a.org/" + path + "?id=1" + tracking;
+  EXPECT(qr_min_version_8bit(url.size()) == 0);
+  EXPECT(rewriter->rewrite(url));
+  EXPECT(qr_min_version_8bit(url.size()) > 0);
+
+  // Doesn't fit either way.
+  url = "https://a.org/" + std::string(capacity, 'p') + "?id=1" + tracking;
+  EXPECT(rewriter->rewrite(url));
+
+  url = "https://a.org/";
+  EXPECT(!rewriter->rewrite(url));
+
+  auto const& stats = rewriter->stats();
+  EXPECT(stats.urls == 4);
+  EXPECT(stats.rewritten == 3);
+  EXPECT(stats.versions_saved == static_cast<uint64_t>(saved));
+  EXPECT(stats.made_to_fit == 1);
+  EXPECT(stats.bytes_saved == 3 * tracking.size());
+}
+
+}  // namespace
+
+int main() {
+  test_table();
+  test_load_errors();
+  test_stats();
+  return test_result();
+}